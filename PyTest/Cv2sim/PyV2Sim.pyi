@@ -41,10 +41,12 @@ class SegFunc:
 class Point:
     x: float
     y: float
-    label: int
+    label: int  # Unique ID of the point in a KDTree
     def __init__(self, x: float = 0, y: float = 0, label: int = 0) -> None: ...
     def dist_to(self, other: 'Point') -> float: ...
 
+# The labels of the points in a KDTree must be unique: building it from points
+# that share a label raises an error.
 class KDTree:
     @overload
     def __init__(self) -> None: ...
@@ -53,6 +55,12 @@ class KDTree:
     def Init(self, points: List[Point]) -> None: ...
     def findNearestNeighbor(self, target: Point) -> Point: ...
     def findKNearestNeighbors(self, target: Point, k: int) -> List[Point]: ...
+    def findWithinRadius(self, target: Point, radius: float) -> List[Point]: ...
+    def Contains(self, label: int) -> bool: ...
+    def Insert(self, p: Point) -> bool: ...
+    def Remove(self, label: int) -> bool: ...
+    def Relocate(self, label: int, x: float, y: float) -> bool: ...
+    def __len__(self) -> int: ...
 
 class VehStatus(enum.IntEnum):
     Driving = 0
@@ -61,6 +69,12 @@ class VehStatus(enum.IntEnum):
     Parking = 3
     Depleted = 4
 
+class CSVehState(enum.IntEnum):
+    None_ = 0
+    Charging = 1
+    Waiting = 2
+    Idle = 3
+
 class Trip:
     ID: str
     DepartTime: int
@@ -83,6 +97,12 @@ class BattCorrFuncPool:
     @staticmethod
     def Add(id: str, bcf: BattCorrFunc) -> None: ...
     @staticmethod
+    def AddCCCV(id: str, knee: float, end: float) -> None: ...
+    @staticmethod
+    def AddCurve(id: str, points: List[Tuple[float, float]]) -> None: ...
+    @staticmethod
+    def Load(file: str) -> None: ...
+    @staticmethod
     def Get(id: str) -> BattCorrFunc: ...
 
 # V2GAlloc = Callable[
@@ -104,6 +124,47 @@ class V2SimInterface:
     def getStartTime(self) -> int: ...
     def getEndTime(self) -> int: ...
     def getStepLength(self) -> int: ...
+    def getQueryThreads(self) -> int: ...
+    def setQueryThreads(self, n: int) -> None: ...
+    def getUpdateThreads(self) -> int: ...
+    def setUpdateThreads(self, n: int) -> None: ...
+    def getTimeSkip(self) -> int: ...
+    def setTimeSkip(self, sec: int) -> None: ...
+    def getStepMax(self) -> int: ...
+    def setStepMax(self, sec: int) -> None: ...
+    def getStatInterval(self) -> int: ...
+    def setStatInterval(self, sec: int) -> None: ...
+    def getStepTolerance(self) -> float: ...
+    def setStepTolerance(self, kWh: float) -> None: ...
+    def getPipeline(self) -> bool: ...
+    def setPipeline(self, b: bool) -> None: ...
+    def getNetIndexK(self) -> int: ...
+    def setNetIndexK(self, k: int) -> None: ...
+    def getNetIndexCache(self) -> bool: ...
+    def setNetIndexCache(self, b: bool) -> None: ...
+    def getNativeRouting(self) -> bool: ...
+    def setNativeRouting(self, b: bool) -> None: ...
+    def getRouteHierarchy(self) -> bool: ...
+    def setRouteHierarchy(self, b: bool) -> None: ...
+    def getRouteHierarchyCache(self) -> bool: ...
+    def setRouteHierarchyCache(self, b: bool) -> None: ...
+    def getRouteCacheSize(self) -> int: ...
+    def setRouteCacheSize(self, n: int) -> None: ...
+    def getRouteCacheHits(self) -> int: ...
+    def getRouteCacheMisses(self) -> int: ...
+    def getRouteRefresh(self) -> int: ...
+    def setRouteRefresh(self, sec: int) -> None: ...
     def Start(self) -> None: ...
     def Step(self, len: int = -1) -> None: ...
-    def Stop(self) -> None: ...
\ No newline at end of file
+    def Stop(self) -> None: ...
+    def Sync(self) -> None: ...
+    def FCSList_SetPos(self, cs_index: int, x: float, y: float) -> None: ...
+    def FCSList_IsIndexed(self, cs_index: int) -> bool: ...
+    def FCSList_SetIndexed(self, cs_index: int, indexed: bool) -> bool: ...
+    def FCSList_SelectWithin(self, x: float, y: float, d: float) -> List[Point]: ...
+    def FCSList_VehLocations(self) -> Tuple[List[int], List[CSVehState]]: ...
+    def SCSList_SetPos(self, cs_index: int, x: float, y: float) -> None: ...
+    def SCSList_IsIndexed(self, cs_index: int) -> bool: ...
+    def SCSList_SetIndexed(self, cs_index: int, indexed: bool) -> bool: ...
+    def SCSList_SelectWithin(self, x: float, y: float, d: float) -> List[Point]: ...
+    def SCSList_VehLocations(self) -> Tuple[List[int], List[CSVehState]]: ...
\ No newline at end of file
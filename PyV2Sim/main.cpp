@@ -11,6 +11,17 @@ PYBIND11_MODULE(PyV2Sim, m)
     m.doc() = "V2Sim C++ core Python wrapper";
     // V2SimError
     py::register_exception<V2SimError>(m, "V2SimError");
+    // The pipelined background work may call Python correction functions and V2G allocations, which
+    // take the GIL, so every wait for it from a thread holding the GIL releases it
+    V2SimCore::SetWaitHook([](const std::function<void()>& wait) {
+        if (PyGILState_Check()) {
+            py::gil_scoped_release release;
+            wait();
+        }
+        else {
+            wait();
+        }
+    });
 
     // RangeList
     py::class_<RangeList>(m, "RangeList")
@@ -60,7 +71,13 @@ PYBIND11_MODULE(PyV2Sim, m)
         .def(py::init<const std::vector<Point>&>())
         .def("Init", &KDTree::Init)
         .def("findNearestNeighbor", &KDTree::findNearestNeighbor)
-        .def("findKNearestNeighbors", &KDTree::findKNearestNeighbors);
+        .def("findKNearestNeighbors", &KDTree::findKNearestNeighbors)
+        .def("findWithinRadius", &KDTree::findWithinRadius)
+        .def("Contains", &KDTree::Contains)
+        .def("Insert", &KDTree::Insert)
+        .def("Remove", &KDTree::Remove)
+        .def("Relocate", &KDTree::Relocate)
+        .def("__len__", &KDTree::size);
 
     // VehStatus enum
     py::enum_<VehStatus>(m, "VehStatus")
@@ -71,6 +88,13 @@ PYBIND11_MODULE(PyV2Sim, m)
         .value("Depleted", VehStatus::Depleted)
         .export_values();
 
+    // CSVehState enum, not exported to the module scope since its names overlap VehStatus
+    py::enum_<CSVehState>(m, "CSVehState")
+        .value("None_", CSVehState::None)
+        .value("Charging", CSVehState::Charging)
+        .value("Waiting", CSVehState::Waiting)
+        .value("Idle", CSVehState::Idle);
+
     // Trip
     py::class_<Trip>(m, "Trip")
         .def(py::init<const std::string&, int, const std::string&, const std::string&,
@@ -83,10 +107,10 @@ PYBIND11_MODULE(PyV2Sim, m)
             py::arg("route"), py::arg("auto_detect_fixed_route") = true, py::arg("fixed_route") = false)
         .def_readwrite("ID", &Trip::ID)
         .def_readwrite("DepartTime", &Trip::DepartTime)
-        .def_readwrite("FromTAZ", &Trip::FromTAZ)
-        .def_readwrite("ToTAZ", &Trip::ToTAZ)
+        .def_property("FromTAZ", &Trip::FromTAZ, &Trip::SetFromTAZ)
+        .def_property("ToTAZ", &Trip::ToTAZ, &Trip::SetToTAZ)
         .def_readwrite("FixedRoute", &Trip::FixedRoute)
-        .def("Route", &Trip::Route, py::return_value_policy::reference)
+        .def("Route", &Trip::Route)
         .def("FromEdge", &Trip::FromEdge, py::return_value_policy::reference)
         .def("ToEdge", &Trip::ToEdge, py::return_value_policy::reference)
         .def("__repr__", &Trip::__repr__, py::return_value_policy::reference);
@@ -96,6 +120,9 @@ PYBIND11_MODULE(PyV2Sim, m)
     // BattCorrFuncPool
     py::class_<BattCorrFuncPool>(m, "BattCorrFuncPool")
         .def_static("Add", &BattCorrFuncPool::Add)
+        .def_static("AddCCCV", &BattCorrFuncPool::AddCCCV)
+        .def_static("AddCurve", &BattCorrFuncPool::AddCurve)
+        .def_static("Load", py::overload_cast<const string&>(&BattCorrFuncPool::Load))
         .def_static("Get", &BattCorrFuncPool::Get, py::return_value_policy::reference);
 
     py::class_<V2GAlloc>(m, "V2GAlloc");
@@ -116,9 +143,43 @@ PYBIND11_MODULE(PyV2Sim, m)
         .def("getStartTime", &V2SimInterface::getStartTime)
         .def("getEndTime", &V2SimInterface::getEndTime)
         .def("getStepLength", &V2SimInterface::getStepLength)
+        .def("getQueryThreads", &V2SimInterface::getQueryThreads)
+        .def("setQueryThreads", &V2SimInterface::setQueryThreads)
+        .def("getUpdateThreads", &V2SimInterface::getUpdateThreads)
+        .def("setUpdateThreads", &V2SimInterface::setUpdateThreads)
+        .def("getTimeSkip", &V2SimInterface::getTimeSkip)
+        .def("setTimeSkip", &V2SimInterface::setTimeSkip)
+        .def("getStepMax", &V2SimInterface::getStepMax)
+        .def("setStepMax", &V2SimInterface::setStepMax)
+        .def("getStatInterval", &V2SimInterface::getStatInterval)
+        .def("setStatInterval", &V2SimInterface::setStatInterval)
+        .def("getStepTolerance", &V2SimInterface::getStepTolerance)
+        .def("setStepTolerance", &V2SimInterface::setStepTolerance)
+        .def("getPipeline", &V2SimInterface::getPipeline)
+        .def("setPipeline", &V2SimInterface::setPipeline, py::call_guard<py::gil_scoped_release>())
+        .def("getNetIndexK", &V2SimInterface::getNetIndexK)
+        .def("setNetIndexK", &V2SimInterface::setNetIndexK)
+        .def("getNetIndexCache", &V2SimInterface::getNetIndexCache)
+        .def("setNetIndexCache", &V2SimInterface::setNetIndexCache)
+        .def("getNativeRouting", &V2SimInterface::getNativeRouting)
+        .def("setNativeRouting", &V2SimInterface::setNativeRouting)
+        .def("getRouteHierarchy", &V2SimInterface::getRouteHierarchy)
+        .def("setRouteHierarchy", &V2SimInterface::setRouteHierarchy)
+        .def("getRouteHierarchyCache", &V2SimInterface::getRouteHierarchyCache)
+        .def("setRouteHierarchyCache", &V2SimInterface::setRouteHierarchyCache)
+        .def("getRouteCacheSize", &V2SimInterface::getRouteCacheSize)
+        .def("setRouteCacheSize", &V2SimInterface::setRouteCacheSize)
+        .def("getRouteCacheHits", &V2SimInterface::getRouteCacheHits)
+        .def("getRouteCacheMisses", &V2SimInterface::getRouteCacheMisses)
+        .def("getRouteRefresh", &V2SimInterface::getRouteRefresh)
+        .def("setRouteRefresh", &V2SimInterface::setRouteRefresh)
         .def("Start", &V2SimInterface::Start)
-        .def("Step", &V2SimInterface::Step, py::arg("len") = -1)
-        .def("Stop", &V2SimInterface::Stop)
+        // Release the GIL so that Python correction functions can be called from the CS update threads
+        .def("Step", &V2SimInterface::Step, py::arg("len") = -1, py::call_guard<py::gil_scoped_release>())
+        .def("Stop", &V2SimInterface::Stop, py::call_guard<py::gil_scoped_release>())
+        // The background work may call Python correction functions, so wait for it without the GIL
+        // before accessing the SCS when pipelining
+        .def("Sync", &V2SimInterface::Sync, py::call_guard<py::gil_scoped_release>())
         .def("EV_IndexOf", &V2SimInterface::EV_IndexOf)
 		.def("EV_getName", &V2SimInterface::EV_getName)
 		.def("EV_getStatus", &V2SimInterface::EV_getStatus)
@@ -144,5 +205,15 @@ PYBIND11_MODULE(PyV2Sim, m)
 		.def("EV_getEtaC", &V2SimInterface::EV_getEtaC)
 		.def("EV_setEtaC", &V2SimInterface::EV_setEtaC)
 		.def("EV_getPdV2G", &V2SimInterface::EV_getPdV2G)
-		.def("EV_setPdV2G", &V2SimInterface::EV_setPdV2G);
+		.def("EV_setPdV2G", &V2SimInterface::EV_setPdV2G)
+		.def("FCSList_SetPos", &V2SimInterface::FCSList_SetPos)
+		.def("FCSList_IsIndexed", &V2SimInterface::FCSList_IsIndexed)
+		.def("FCSList_SetIndexed", &V2SimInterface::FCSList_SetIndexed)
+		.def("FCSList_SelectWithin", &V2SimInterface::FCSList_SelectWithin)
+		.def("FCSList_VehLocations", &V2SimInterface::FCSList_VehLocations)
+		.def("SCSList_SetPos", &V2SimInterface::SCSList_SetPos)
+		.def("SCSList_IsIndexed", &V2SimInterface::SCSList_IsIndexed)
+		.def("SCSList_SetIndexed", &V2SimInterface::SCSList_SetIndexed)
+		.def("SCSList_SelectWithin", &V2SimInterface::SCSList_SelectWithin)
+		.def("SCSList_VehLocations", &V2SimInterface::SCSList_VehLocations);
 }
\ No newline at end of file
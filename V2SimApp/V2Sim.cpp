@@ -20,6 +20,12 @@ int main(int argc, char *argv[])
 	int start = args.GetInt("b", 0);
 	int end = args.GetInt("e", 172800);
 	int step = args.GetInt("s", 10);
+	int skip = args.GetInt("skip", 0);
+	int threads = args.GetInt("threads", 1);
+	int step_max = args.GetInt("step-max", 0);
+	int stat_interval = args.GetInt("stat-interval", 0);
+	double step_tol = args.GetDouble("step-tol", 0.5);
+	int pipeline = args.GetInt("pipeline", 0);
 
 	auto root = fs::absolute(caseDir);
     cout << "Case directory: " << root.string() << endl;
@@ -72,6 +78,12 @@ int main(int argc, char *argv[])
         scsfile,
 		resdir.string()
     );
+    vc.setTimeSkip(skip);
+    vc.setUpdateThreads(threads);
+    vc.setStepMax(step_max);
+    vc.setStatInterval(stat_interval);
+    vc.setStepTolerance(step_tol);
+    vc.setPipeline(pipeline != 0);
     vc.Start();
     int lastT = 0, tbeg = GetCurrentUnixTime();
     
@@ -1,4 +1,8 @@
 #include <iostream>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <filesystem>
 #include "..\V2SimCore\v2sim.h"
 
 int kdtree() {
@@ -32,6 +36,75 @@ int kdtree() {
     return 0;
 }
 
+// Insert, remove and relocate points at random and compare the k nearest neighbors and the
+// radius searches with a brute-force scan of the live points
+int kdtree_updates(int n = 2000, int ops = 20000, int k = 8) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> coord(0, 10000);
+    std::uniform_int_distribution<int> label(0, 2 * n - 1), op(0, 3);
+    std::unordered_map<int, Point> live;
+    std::vector<Point> points;
+    for (int i = 0; i < n; ++i) {
+        points.emplace_back(coord(rng), coord(rng), i);
+        live[i] = points.back();
+    }
+    KDTree tree(points);
+    auto brute = [&](const Point& q) {
+        std::vector<std::pair<double, int>> d;
+        for (auto& [l, p] : live) d.emplace_back(p.dist_to(q), l);
+        std::sort(d.begin(), d.end());
+        return d;
+    };
+    int bad = 0;
+    for (int i = 0; i < ops; ++i) {
+        int l = label(rng);
+        double x = coord(rng), y = coord(rng);
+        switch (op(rng)) {
+        case 0:
+            bad += tree.Insert(Point(x, y, l)) != !live.contains(l);
+            live.try_emplace(l, x, y, l);
+            break;
+        case 1:
+            bad += tree.Remove(l) != live.contains(l);
+            live.erase(l);
+            break;
+        case 2:
+            bad += tree.Relocate(l, x, y) != live.contains(l);
+            if (live.contains(l)) live[l] = Point(x, y, l);
+            break;
+        default:
+            if (i % 2) tree.Compact();
+            break;
+        }
+        bad += tree.size() != live.size() || tree.Contains(l) != live.contains(l);
+        if (i % 20 != 0 || live.empty()) continue;
+        Point q(coord(rng), coord(rng), 0);
+        auto d = brute(q);
+        auto kn = tree.findKNearestNeighbors(q, k);
+        bad += kn.size() != std::min<size_t>(k, d.size());
+        for (size_t j = 0; j < kn.size() && j < d.size(); ++j) {
+            bad += kn[j].dist_to(q) != d[j].first;
+        }
+        double r = 500;
+        auto in = tree.findWithinRadius(q, r);
+        size_t cnt = std::count_if(d.begin(), d.end(), [&](auto& e) { return e.first <= r * r; });
+        bad += in.size() != cnt;
+        for (auto& p : in) {
+            bad += !live.contains(p.label) || live[p.label].x != p.x || live[p.label].y != p.y;
+        }
+    }
+    // Rebuilding from points that share a label must throw and keep the tree as it was
+    size_t before = tree.size();
+    try {
+        tree.Init({ Point(0, 0, 1), Point(1, 1, 1) });
+        ++bad;
+    }
+    catch (const V2SimError&) {}
+    bad += tree.size() != before || tree.Contains(1) != live.contains(1);
+    std::cout << "Points: " << live.size() << ", mismatches: " << bad << std::endl;
+    return bad;
+}
+
 // ʾ÷
 int ohs() {
     OrderedHashSet<int> oset;
@@ -102,7 +175,7 @@ int segf() {
 
 void inst() {
     Trip t("trip1", 1400, "TAZ1", "TAZ3", "Edge_29to30 Edge_10to11");
-    std::cout << t.ID << " " << t.DepartTime << " " << t.FromTAZ << " " << t.ToTAZ << " " << t.FixedRoute << std::endl;
+    std::cout << t.ID << " " << t.DepartTime << " " << t.FromTAZ() << " " << t.ToTAZ() << " " << t.FixedRoute << std::endl;
     Trip t2("trip2", 14000, "TAZ3", "TAZ1", "Edge_10to11 Edge_29to30");
     EV ev("v0", { t,t2 }, 0.9, 0.9, 100, 0.6, 300, 70.0, 8.0, 10.0, 8, 1.05, 0.25, 0.5, 0.7, "Equal", RangeList(true), 0.8, RangeList(true), 0.9, false);
     std::cout << ev.CanSlowCharge(0, 0.5) << std::endl;
@@ -129,4 +202,501 @@ void inst() {
         std::cout << core.getTime() << std::endl;
     }
     core.Stop();
+}
+
+// Pointer-based KDTree layout, kept here only as the baseline of kdtree_bench
+struct PtrKDNode {
+    Point point;
+    PtrKDNode* left = nullptr;
+    PtrKDNode* right = nullptr;
+    PtrKDNode(const Point& p) : point(p) {}
+};
+
+static PtrKDNode* ptr_build(std::vector<Point>& points, int depth) {
+    if (points.empty()) return nullptr;
+    int axis = depth % 2;
+    std::sort(points.begin(), points.end(), [axis](const Point& a, const Point& b) {
+        return axis == 0 ? a.x < b.x : a.y < b.y;
+    });
+    size_t median = points.size() / 2;
+    PtrKDNode* node = new PtrKDNode(points[median]);
+    std::vector<Point> leftPoints(points.begin(), points.begin() + median);
+    std::vector<Point> rightPoints(points.begin() + median + 1, points.end());
+    node->left = ptr_build(leftPoints, depth + 1);
+    node->right = ptr_build(rightPoints, depth + 1);
+    return node;
+}
+
+static void ptr_nearest(PtrKDNode* node, const Point& target, int depth, PtrKDNode*& best, double& bestDist) {
+    if (node == nullptr) return;
+    double dist = node->point.dist_to(target);
+    if (dist < bestDist) {
+        bestDist = dist;
+        best = node;
+    }
+    double axisDist = depth % 2 == 0 ? target.x - node->point.x : target.y - node->point.y;
+    PtrKDNode* next = axisDist < 0 ? node->left : node->right;
+    PtrKDNode* other = axisDist < 0 ? node->right : node->left;
+    ptr_nearest(next, target, depth + 1, best, bestDist);
+    if (axisDist * axisDist < bestDist) {
+        ptr_nearest(other, target, depth + 1, best, bestDist);
+    }
+}
+
+static void ptr_delete(PtrKDNode* node) {
+    if (node == nullptr) return;
+    ptr_delete(node->left);
+    ptr_delete(node->right);
+    delete node;
+}
+
+// Compare build and nearest-neighbor query time of the pointer layout and the flat layout
+int kdtree_bench(int n = 5000, int queries = 200000) {
+    using clk = std::chrono::steady_clock;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> coord(0, 50000);
+    std::vector<Point> points, targets;
+    for (int i = 0; i < n; ++i) points.emplace_back(coord(rng), coord(rng), i);
+    for (int i = 0; i < queries; ++i) targets.emplace_back(coord(rng), coord(rng), 0);
+
+    auto t0 = clk::now();
+    std::vector<Point> ptrPoints = points;
+    PtrKDNode* root = ptr_build(ptrPoints, 0);
+    auto t1 = clk::now();
+    long long ptrSum = 0;
+    for (auto& q : targets) {
+        PtrKDNode* best = nullptr;
+        double bestDist = std::numeric_limits<double>::max();
+        ptr_nearest(root, q, 0, best, bestDist);
+        ptrSum += best->point.label;
+    }
+    auto t2 = clk::now();
+    ptr_delete(root);
+
+    auto t3 = clk::now();
+    KDTree tree(points);
+    auto t4 = clk::now();
+    long long flatSum = 0;
+    for (auto& q : targets) {
+        flatSum += tree.findNearestNeighbor(q).label;
+    }
+    auto t5 = clk::now();
+
+    auto ms = [](auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    std::cout << "Pointer layout: build " << ms(t1 - t0) << "ms, query " << ms(t2 - t1) << "ms" << std::endl;
+    std::cout << "Flat layout:    build " << ms(t4 - t3) << "ms, query " << ms(t5 - t4) << "ms" << std::endl;
+    std::cout << "Results match: " << (ptrSum == flatSum) << std::endl;
+    return 0;
+}
+
+// Compare the departure queue as a binary heap and as a timing wheel over a multi-day run:
+// every EV departs once at start and again a few hours after each departure
+int timewheel_bench(int n = 1000000, int horizon = 172800, int step = 10) {
+    using clk = std::chrono::steady_clock;
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> first(0, 86400), gap(3600, 36000);
+    std::vector<std::pair<int, int>> items;
+    for (int i = 0; i < n; ++i) items.emplace_back(first(rng), i);
+    std::vector<int> gaps(1 << 20);
+    for (auto& g : gaps) g = gap(rng);
+
+    auto t0 = clk::now();
+    std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<>> heap;
+    for (auto& it : items) heap.push(it);
+    long long heapSum = 0, heapCnt = 0;
+    size_t k = 0;
+    for (int t = 0; t < horizon; t += step) {
+        while (!heap.empty() && heap.top().first <= t) {
+            auto [dt, vid] = heap.top();
+            heap.pop();
+            heapSum = heapSum * 31 + vid;
+            ++heapCnt;
+            int next = dt + gaps[k++ & (gaps.size() - 1)];
+            if (next < horizon) heap.push({ next, vid });
+        }
+    }
+    auto t1 = clk::now();
+
+    TimingWheel wheel;
+    wheel.Assign(0, items);
+    std::vector<std::pair<int, int>> due;
+    long long wheelSum = 0, wheelCnt = 0;
+    k = 0;
+    for (int t = 0; t < horizon; t += step) {
+        due.clear();
+        wheel.PopDue(t, due);
+        for (auto [dt, vid] : due) {
+            wheelSum = wheelSum * 31 + vid;
+            ++wheelCnt;
+            int next = dt + gaps[k++ & (gaps.size() - 1)];
+            if (next < horizon) wheel.Push(next, vid);
+        }
+    }
+    auto t2 = clk::now();
+
+    auto ms = [](auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    std::cout << "Heap:         " << ms(t1 - t0) << "ms for " << heapCnt << " departures" << std::endl;
+    std::cout << "Timing wheel: " << ms(t2 - t1) << "ms for " << wheelCnt << " departures" << std::endl;
+    std::cout << "Results match: " << (heapSum == wheelSum && heapCnt == wheelCnt) << std::endl;
+    return 0;
+}
+
+// Parameters of a random test fleet. Every range is drawn uniformly for each EV.
+struct FleetSpec {
+    std::pair<double, double> cap = { 40, 80 }; // Battery capacity, kWh
+    std::pair<double, double> soc = { 0.1, 0.9 };
+    double pc_fast = 50; // kW
+    std::pair<double, double> pc_slow = { 7, 7 }; // kW
+    std::pair<double, double> pd_v2g = { 10, 10 }; // kW
+    std::pair<double, double> k_v2g = { 0.8, 0.8 };
+    double min_v2g_revenue = 0; // The minimum V2G revenue is 0 to 3 times this, $/kWh
+    std::string rmod = "Equal"; // Charging model
+    bool mixed_models = false; // Two EVs in three charge under "Linear" instead of rmod
+    bool v2g_windows = false; // Three EVs in four may only discharge within a random window
+};
+
+// A fleet of n EVs named v0, v1, ... with one placeholder trip each
+std::vector<EV> make_test_fleet(int n, std::mt19937& rng, const FleetSpec& spec = {}) {
+    std::uniform_real_distribution<double> U(0, 1);
+    auto draw = [&](const std::pair<double, double>& r) { return r.first + (r.second - r.first) * U(rng); };
+    std::vector<EV> fleet;
+    fleet.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        double cap = draw(spec.cap), soc = draw(spec.soc), pcs = draw(spec.pc_slow);
+        double pdv2g = draw(spec.pd_v2g), kv2g = draw(spec.k_v2g);
+        RangeList v2gtime(true);
+        if (spec.v2g_windows && i % 4) {
+            int a = (int)(U(rng) * 6000) / 10 * 10 + 3;
+            v2gtime = RangeList({ { a, a + 2000 + (int)(U(rng) * 3000) } });
+        }
+        double minrev = (int)(U(rng) * 4) * spec.min_v2g_revenue;
+        fleet.emplace_back("v" + std::to_string(i), std::vector<Trip>{ Trip("t", 0, "a", "b", std::vector<std::string>{ "e1", "e2" }) },
+            0.9, 0.9, cap, soc, 300, spec.pc_fast, pcs, pdv2g, 1, 1.25, 0.2, 0.9, kv2g,
+            spec.mixed_models && i % 3 ? "Linear" : spec.rmod, RangeList(true), 100, v2gtime, minrev, false);
+    }
+    return fleet;
+}
+
+// Per-step energy update of n EVs one by one and by the batch kernels of EVMap,
+// with all the EVs driving and then all of them charging under model rmod, in order of vid or shuffled
+int ev_batch_bench(int n = 1000000, int steps = 20, bool shuffled = false, const char* rmod = "Equal") {
+    using clk = std::chrono::steady_clock;
+    std::mt19937 rng(42);
+    EVMap one, batch;
+    for (auto& ev : make_test_fleet(n, rng, { .soc = { 0.5, 0.9 }, .pc_fast = 60, .rmod = rmod })) {
+        one.Add(ev);
+        batch.Add(std::move(ev));
+    }
+    std::vector<int> vids(n);
+    for (int i = 0; i < n; ++i) vids[i] = i;
+    if (shuffled) std::shuffle(vids.begin(), vids.end(), rng);
+    std::vector<double> dist(n), pc(n, 60 / 3.6e3), cost(n, 1.0), d_elec(n);
+
+    double tOne = 0, tBatch = 0;
+    auto ms = [](auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    for (int s = 1; s <= steps; ++s) {
+        for (int k = 0; k < n; ++k) dist[k] = s * 100.0 + k % 100;
+        auto t0 = clk::now();
+        for (int k = 0; k < n; ++k) {
+            auto& ev = one[vids[k]];
+            ev.Drive(dist[k], s);
+            d_elec[k] = ev.Charge(10, cost[k], pc[k]);
+        }
+        auto t1 = clk::now();
+        batch.DriveBatch(vids, dist, s);
+        batch.ChargeBatch(vids, 10, pc, cost, d_elec);
+        auto t2 = clk::now();
+        tOne += ms(t1 - t0);
+        tBatch += ms(t2 - t1);
+    }
+    bool same = true;
+    for (int i = 0; i < n; ++i) {
+        same &= one[i].BattElec() == batch[i].BattElec() && one[i].Cost() == batch[i].Cost();
+    }
+    std::cout << "One by one: " << tOne / steps << "ms per step" << std::endl;
+    std::cout << "Batch:      " << tBatch / steps << "ms per step" << std::endl;
+    std::cout << "Results match: " << same << std::endl;
+    return 0;
+}
+
+// V2G allocation of stations with k EVs each through the vector interface and into preallocated
+// spans, for each built-in allocation
+int v2g_alloc_bench(int stations = 10000, int k = 8, int steps = 100) {
+    using clk = std::chrono::steady_clock;
+    std::mt19937 rng(42);
+    EVMap mp;
+    int n = stations * k;
+    for (auto& ev : make_test_fleet(n, rng, { .soc = { 0.4, 1.0 }, .pc_fast = 60, .pd_v2g = { 5, 15 },
+        .k_v2g = { 0.3, 0.3 }, .min_v2g_revenue = 0.1 })) {
+        mp.Add(std::move(ev));
+    }
+    auto ms = [](auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    for (auto id : { "Average", "SoC", "Headroom", "Price" }) {
+        auto& vec = V2GAllocPool::Get(id);
+        auto& into = V2GAllocPool::GetInto(id);
+        std::vector<std::vector<int>> vids(stations);
+        std::vector<std::vector<double>> out(stations, std::vector<double>(k));
+        std::vector<V2GScratch> buf(stations);
+        for (int c = 0; c < stations; ++c) {
+            for (int j = 0; j < k; ++j) vids[c].push_back(c * k + j);
+        }
+        double sum = 0;
+        auto t0 = clk::now();
+        for (int s = 0; s < steps; ++s) {
+            for (int c = 0; c < stations; ++c) sum += vec(mp, vids[c], 0, s, 0.5)[0];
+        }
+        auto t1 = clk::now();
+        for (int s = 0; s < steps; ++s) {
+            for (int c = 0; c < stations; ++c) {
+                into(mp, vids[c], 0, s, 0.5, out[c], buf[c]);
+                sum -= out[c][0];
+            }
+        }
+        auto t2 = clk::now();
+        std::cout << id << ": vector " << ms(t1 - t0) / steps << "ms, into span " << ms(t2 - t1) / steps
+            << "ms per step, difference " << sum << std::endl;
+    }
+    return 0;
+}
+
+// Plug, unplug and modify EVs at random and compare the V2G capacity that each SCS maintains
+// incrementally with a recomputation over all the EVs plugged in
+int v2g_capacity_check(int stations = 200, int n = 20000, int steps = 1200) {
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<double> U(0, 1);
+    EVMap mp;
+    for (auto& ev : make_test_fleet(n, rng, { .pc_slow = { 7, 14 }, .pd_v2g = { 10, 15 }, .k_v2g = { 0.3, 0.7 },
+        .min_v2g_revenue = 0.5, .mixed_models = true, .v2g_windows = true })) {
+        mp.Add(std::move(ev));
+    }
+    std::vector<SlowCS> v;
+    for (int i = 0; i < stations; ++i) {
+        v.emplace_back("s" + std::to_string(i), "e", 30, "b", 0, 0, RangeList(), 30 * 7 / 3600.0, 30 * 10 / 3600.0,
+            SegFunc({ { 0, 1.0 }, { 4000, 0.5 } }), SegFunc({ { 0, 1.0 }, { 3000, 0.5 }, { 6000, 1.5 } }), "Average");
+    }
+    SlowCSMap scs(std::move(v));
+    scs.ReserveVehs(n);
+    double worst = 0;
+    int bad = 0;
+    for (int t = 10; t <= steps * 10; t += 10) {
+        for (int j = 0; j < 60; ++j) {
+            int i = (int)(U(rng) * n);
+            if (!scs.HasVeh(i)) {
+                scs.AddVeh(i, (int)(U(rng) * stations));
+            }
+            else if (U(rng) < 0.3) {
+                scs.PopVeh(i);
+            }
+            else {
+                // Modify one of the fields the V2G capacity depends on, as the EV_set* accessors do
+                scs.TouchVeh(i);
+                auto& ev = mp[i];
+                switch ((int)(U(rng) * 6)) {
+                case 0: ev.PdV2G = (7 + 7 * U(rng)) / 3600; break;
+                case 1: ev.EtaD = 0.8 + 0.2 * U(rng); break;
+                case 2: ev.MinV2GRevenue = (int)(U(rng) * 4) * 0.5; break;
+                case 3: {
+                    int a = t + (int)(U(rng) * 300) / 10 * 10 + 3;
+                    ev.V2GTime = U(rng) < 0.5 ? RangeList({ { a, a + 1000 + (int)(U(rng) * 3000) } }) : RangeList(true);
+                    break;
+                }
+                case 4: ev.KV2G = 0.3 + 0.4 * U(rng); break;
+                default: ev.BattElec() = ev.BattCap() * U(rng); break;
+                }
+            }
+        }
+        for (int c = 0; c < stations; ++c) scs.SetV2GDemand(c, U(rng) * 0.02);
+        auto& caps = scs.V2GCapacities(mp, t);
+        std::vector<double> brute(stations, 0);
+        for (int i = 0; i < n; ++i) {
+            int c = scs.VehCS(i);
+            if (c < 0) continue;
+            scs.SyncVeh(i);
+            auto& ev = mp[i];
+            if (ev.CanV2G(t, scs[c].PriceSell(t))) brute[c] += ev.PdV2G * ev.EtaD;
+        }
+        for (int c = 0; c < stations; ++c) {
+            double d = fabs(caps[c] - brute[c]);
+            worst = std::max(worst, d);
+            bad += d > 1e-9;
+        }
+        scs.Update(mp, 10, t, nullptr);
+    }
+    std::cout << "Largest difference: " << worst << ", mismatches: " << bad << std::endl;
+    return bad;
+}
+
+// Charge EVs at FCS and SCS and write every battery back at each statistics sample, as
+// V2SimInterface::Step does before recording the EV items. The SoC of an EV charging throughout
+// the interval between two samples must increase.
+int charging_sync_check(int stations = 50, int n = 4000, int steps = 720, int sample = 6) {
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<double> U(0, 1);
+    EVMap mp;
+    for (auto& ev : make_test_fleet(n, rng, { .soc = { 0.1, 0.6 }, .pc_slow = { 7, 14 }, .pd_v2g = { 10, 15 },
+        .k_v2g = { 0.5, 0.5 }, .mixed_models = true })) {
+        mp.Add(std::move(ev));
+    }
+    std::vector<FastCS> vf;
+    std::vector<SlowCS> vs;
+    for (int i = 0; i < stations; ++i) {
+        vf.emplace_back("f" + std::to_string(i), "e", 10, "b", 0, 0, RangeList(), 10 * 100 / 3600.0, SegFunc({ { 0, 1.0 }, { 3600, 2.0 } }));
+        vs.emplace_back("s" + std::to_string(i), "e", 30, "b", 0, 0, RangeList(), 30 * 7 / 3600.0, 30 * 10 / 3600.0,
+            SegFunc({ { 0, 1.0 }, { 4000, 0.5 } }), SegFunc(), "Average");
+    }
+    FastCSMap fcs(std::move(vf));
+    SlowCSMap scs(std::move(vs));
+    fcs.SetThreads(2);
+    scs.ReserveVehs(n);
+    std::vector<double> last(n, -1); // SoC at the last sample, or -1 if not charging then
+    int bad = 0, checked = 0;
+    for (int s = 1; s <= steps; ++s) {
+        int t = s * 10;
+        for (int j = 0; j < 20; ++j) {
+            int i = (int)(U(rng) * n);
+            if (i % 2 ? fcs.VehState(i) != CSVehState::None : scs.HasVeh(i)) continue;
+            if (mp[i].SoC() > 0.95) mp[i].BattElec() = mp[i].BattCap() * 0.2;
+            if (i % 2) {
+                mp[i].TargetCS() = i % stations;
+                fcs.AddVeh(i, i % stations);
+            }
+            else scs.AddVeh(i, i % stations);
+        }
+        fcs.Update(mp, 10, t, nullptr);
+        scs.Update(mp, 10, t, nullptr);
+        if (s % sample) continue;
+        fcs.SyncAll();
+        scs.SyncAll();
+        for (int i = 0; i < n; ++i) {
+            bool charging = i % 2 ? fcs.VehState(i) == CSVehState::Charging : scs.VehState(i) == CSVehState::Charging;
+            double soc = mp[i].SoC();
+            if (charging && last[i] >= 0) {
+                bad += soc <= last[i];
+                ++checked;
+            }
+            last[i] = charging ? soc : -1;
+        }
+    }
+    std::cout << "Checked: " << checked << ", mismatches: " << bad << std::endl;
+    return bad;
+}
+
+// Prices of n CS sharing a few looped schedules read every step, by SegFunc::Get per CS and through
+// a SegFuncTable evaluating each distinct schedule once
+int price_table_bench(int n = 10000, int schedules = 4, int steps = 8640) {
+    using clk = std::chrono::steady_clock;
+    std::vector<SegFunc> fs;
+    for (int i = 0; i < n; ++i) {
+        int k = i % schedules;
+        fs.push_back(SegFunc({ {0, 1.0 + k}, {25200, 1.5 + k}, {39600, 2.0 + k}, {64800, 1.2 + k} }, 86400, -1));
+    }
+    SegFuncTable tab;
+    for (int i = 0; i < n; ++i) tab.Set(i, fs[i]);
+    auto ms = [](auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    double sumGet = 0, sumTab = 0;
+    auto t0 = clk::now();
+    for (int s = 0; s < steps; ++s) {
+        for (int i = 0; i < n; ++i) sumGet += fs[i](s * 10);
+    }
+    auto t1 = clk::now();
+    for (int s = 0; s < steps; ++s) {
+        tab.Eval(s * 10);
+        for (int i = 0; i < n; ++i) sumTab += tab[i];
+    }
+    auto t2 = clk::now();
+    std::cout << "Distinct schedules: " << tab.Distinct() << std::endl;
+    std::cout << "SegFunc::Get: " << ms(t1 - t0) / steps << "ms per step" << std::endl;
+    std::cout << "SegFuncTable: " << ms(t2 - t1) / steps << "ms per step" << std::endl;
+    std::cout << "Results match: " << (sumGet == sumTab) << std::endl;
+    return 0;
+}
+
+// Route over a random roadnet with random travel times. The router is compared with a brute-force
+// Dijkstra and the hierarchy with the router, before and after re-customizing it, including
+// unreachable targets and targets with index -1.
+int route_check(int edges = 1000, int links = 2500, int queries = 100, int ntargets = 64) {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> U(0, 1);
+    auto path = (std::filesystem::temp_directory_path() / "v2sim_route_check.net.xml").string();
+    {
+        std::ofstream f(path);
+        f << "<net>\n";
+        for (int i = 0; i < edges; ++i) {
+            // One edge in 20 is closed to cars, so it has no links at all
+            f << "<edge id=\"e" << i << "\"><lane id=\"e" << i << "_0\" index=\"0\""
+                << (i % 20 == 0 ? " allow=\"rail\"" : "") << " length=\"" << 10 + 990 * U(rng)
+                << "\" speed=\"" << 5 + 25 * U(rng) << "\" shape=\"0,0 1,1\"/></edge>\n";
+        }
+        for (int i = 0; i < links; ++i) {
+            int u = (int)(U(rng) * edges), v = (int)(U(rng) * edges);
+            f << "<connection from=\"e" << u << "\" to=\"e" << v << "\" fromLane=\"0\" toLane=\"0\"/>\n";
+        }
+        f << "</net>\n";
+    }
+    RoadNet net(path);
+    std::remove(path.c_str());
+    Router router(net);
+    RouteHierarchy ch;
+    ch.Build(net);
+    std::vector<int> targets;
+    for (int i = 0; i < ntargets; ++i) {
+        targets.push_back(i % 8 == 0 ? -1 : (int)(U(rng) * edges));
+    }
+    ch.SetTargets(targets);
+    // O(n^2) Dijkstra without a heap, with the origin edge counted like the router does
+    auto brute = [&](int from) {
+        constexpr double inf = std::numeric_limits<double>::infinity();
+        std::vector<double> c(edges, inf), l(edges, inf);
+        std::vector<char> done(edges, 0);
+        c[from] = router.TravelTime(from);
+        l[from] = net.Length(from);
+        while (true) {
+            int u = -1;
+            for (int v = 0; v < edges; ++v) {
+                if (!done[v] && c[v] < inf && (u < 0 || c[v] < c[u])) u = v;
+            }
+            if (u < 0) break;
+            done[u] = 1;
+            for (int v : net.Successors(u)) {
+                if (c[u] + router.TravelTime(v) < c[v]) {
+                    c[v] = c[u] + router.TravelTime(v);
+                    l[v] = l[u] + net.Length(v);
+                }
+            }
+        }
+        std::vector<RouteCost> out;
+        for (int t : targets) out.push_back(t < 0 ? RouteCost{ inf, inf } : RouteCost{ l[t], c[t] });
+        return out;
+    };
+    auto same = [](const RouteCost& a, const RouteCost& b) {
+        auto eq = [](double x, double y) {
+            return (std::isinf(x) && std::isinf(y)) || fabs(x - y) <= 1e-9 * std::max(1.0, fabs(x));
+        };
+        return eq(a.length, b.length) && eq(a.travelTime, b.travelTime);
+    };
+    int bad = 0, reached = 0, total = 0;
+    std::vector<RouteCost> r(targets.size()), h(targets.size());
+    for (int round = 0; round < 2; ++round) {
+        if (round == 1) {
+            // Congestion from 1x to 4x the free-flow travel time
+            std::vector<double> tt(edges);
+            for (int e = 0; e < edges; ++e) tt[e] = router.TravelTime(e) * (1 + 3 * U(rng));
+            router.SetTravelTimes(tt);
+        }
+        ch.Customize(net, router.TravelTimes());
+        for (int q = 0; q < queries; ++q) {
+            int from = (int)(U(rng) * edges);
+            router.OneToMany(from, targets, r);
+            ch.Query(from, h);
+            auto b = brute(from);
+            for (size_t i = 0; i < targets.size(); ++i) {
+                bad += !same(r[i], b[i]) || !same(h[i], r[i]);
+                reached += !std::isinf(r[i].travelTime);
+                ++total;
+            }
+        }
+    }
+    std::cout << "Arcs: " << ch.ArcCount() << ", reached: " << reached << "/" << total
+        << ", mismatches: " << bad << std::endl;
+    return bad;
 }
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <format>
+#include "chargemodel.h"
+
+CCCVCurve::CCCVCurve(double knee, double end) : knee(knee) {
+	if (!(knee >= 0 && knee < 1) || !(end >= 0 && end <= 1)) {
+		throw V2SimError(std::format("Invalid CC/CV curve: knee = {} must be in [0, 1) and end = {} in [0, 1]", knee, end));
+	}
+	slope = (1 - end) / (1 - knee);
+	lim = slope > 0 ? knee + 1 / slope : INFINITY;
+}
+
+double CCCVCurve::TimeBetween(double elec, double target, double rate, double cap) const {
+	if (elec >= target) {
+		return 0;
+	}
+	if (rate <= 0) {
+		return INFINITY;
+	}
+	double k = cap * knee;
+	double t = 0;
+	if (elec < k) {
+		if (target <= k) {
+			return (target - elec) / rate;
+		}
+		t = (k - elec) / rate;
+		elec = k;
+	}
+	if (slope == 0) {
+		return t + (target - elec) / rate;
+	}
+	double l = cap * lim;
+	if (target >= l) {
+		return INFINITY;
+	}
+	return t + log((l - elec) / (l - target)) * cap / (slope * rate);
+}
+
+TableCurve::TableCurve(const vector<pair<double, double>>& points) {
+	if (points.empty()) {
+		throw V2SimError("A charging curve needs at least one point");
+	}
+	for (size_t i = 0; i < points.size(); ++i) {
+		auto [s, f] = points[i];
+		if (f < 0 || (i > 0 && !(s > points[i - 1].first))) {
+			throw V2SimError(std::format("Invalid point {} ({}, {}) of a charging curve: the SoCs must increase and the factors be non-negative", i, s, f));
+		}
+		soc.push_back(s);
+		fac.push_back(f);
+	}
+	size_t k = 0;
+	while (k < fac.size() && fac[k] == 1) {
+		++k;
+	}
+	limit = k == 0 ? 0 : k == fac.size() ? INFINITY : soc[k - 1];
+}
+
+double TableCurve::Factor(double s) const {
+	size_t n = soc.size();
+	if (n == 1 || s <= soc[0]) {
+		return fac[0];
+	}
+	size_t j = upper_bound(soc.begin(), soc.end(), s) - soc.begin();
+	j = min(j, n - 1);
+	double f = fac[j - 1] + (fac[j] - fac[j - 1]) * (s - soc[j - 1]) / (soc[j] - soc[j - 1]);
+	return max(0.0, f);
+}
+
+int TableCurve::pieceOf(double s) const {
+	return (int)(upper_bound(soc.begin(), soc.end(), s) - soc.begin()) - 1;
+}
+
+void TableCurve::piece(int j, double cap, double& a, double& b, double& hi) const {
+	int n = (int)soc.size();
+	if (j < 0 || n == 1) {
+		a = fac[0];
+		b = 0;
+		hi = j < 0 ? soc[0] * cap : INFINITY;
+		return;
+	}
+	int j0 = min(j, n - 2);
+	double m = (fac[j0 + 1] - fac[j0]) / (soc[j0 + 1] - soc[j0]);
+	a = fac[j0] - m * soc[j0];
+	b = m / cap;
+	hi = j + 1 < n ? soc[j + 1] * cap : INFINITY;
+}
+
+// With the factor a + b * E, dg/dt = rate * b * g for g = a + b * E, so g grows or decays exponentially
+static double pieceTime(double a, double b, double e0, double e1, double rate) {
+	double g0 = a + b * e0;
+	if (g0 <= 0) {
+		return INFINITY;
+	}
+	if (b == 0) {
+		return (e1 - e0) / (rate * a);
+	}
+	double x = b * (e1 - e0) / g0;
+	return x <= -1 ? INFINITY : log1p(x) / (rate * b);
+}
+
+static double pieceElec(double a, double b, double e0, double t, double rate) {
+	double g0 = a + b * e0;
+	if (g0 <= 0) {
+		return e0;
+	}
+	return b == 0 ? e0 + rate * a * t : e0 + g0 * expm1(b * rate * t) / b;
+}
+
+double TableCurve::ElecAfter(double elec, double t, double rate, double cap) const {
+	if (rate <= 0 || t <= 0) {
+		return elec;
+	}
+	// Pieces are walked by index, as elec / cap may round back into the previous one at a boundary
+	for (int j = pieceOf(elec / cap); ; ++j) {
+		double a, b, hi;
+		piece(j, cap, a, b, hi);
+		double th = hi == INFINITY ? INFINITY : pieceTime(a, b, elec, hi, rate);
+		if (t < th) {
+			return pieceElec(a, b, elec, t, rate);
+		}
+		t -= th;
+		elec = hi;
+	}
+}
+
+double TableCurve::TimeBetween(double elec, double target, double rate, double cap) const {
+	if (elec >= target) {
+		return 0;
+	}
+	if (rate <= 0) {
+		return INFINITY;
+	}
+	double t = 0;
+	for (int j = pieceOf(elec / cap); ; ++j) {
+		double a, b, hi;
+		piece(j, cap, a, b, hi);
+		double e1 = min(hi, target);
+		t += pieceTime(a, b, elec, e1, rate);
+		if (t == INFINITY || e1 >= target) {
+			return t;
+		}
+		elec = hi;
+	}
+}
+
+deque<ChargeModel> BattCorrFuncPool::_models = { EqualCurve{}, CCCVCurve(0.8, 0.4) };
+
+deque<BattCorrFunc> BattCorrFuncPool::_funcs = {
+	[](double p, double c, double soc) -> double { return BattCorrFuncPool::_models[0].Pc(p, c, soc); },
+	[](double p, double c, double soc) -> double { return BattCorrFuncPool::_models[1].Pc(p, c, soc); },
+};
+
+unordered_map<string, int> BattCorrFuncPool::_ids = {
+	{"Equal", 0},
+	{"Linear", 1}
+};
+
+int BattCorrFuncPool::add(const string& id, ChargeModel m) noexcept {
+	int i = (int)_models.size();
+	if (auto* c = get_if<CustomCurve>(&m.v)) {
+		_funcs.push_back(c->f);
+	}
+	else {
+		_funcs.push_back([i](double p, double c, double soc) -> double { return BattCorrFuncPool::_models[i].Pc(p, c, soc); });
+	}
+	_models.push_back(std::move(m));
+	_ids[id] = i;
+	return i;
+}
+
+void BattCorrFuncPool::Load(const tinyxml2::XMLElement* root) {
+	auto model_id = [](const tinyxml2::XMLElement* e) {
+		const char* id = e->Attribute("id");
+		if (!id) {
+			throw V2SimError(std::format("Charging model ID is not defined on line {}!", e->GetLineNum()));
+		}
+		return string(id);
+	};
+	for (auto* e = root->FirstChildElement("cccv"); e; e = e->NextSiblingElement("cccv")) {
+		AddCCCV(model_id(e), e->DoubleAttribute("knee", 0.8), e->DoubleAttribute("end", 0.4));
+	}
+	for (auto* e = root->FirstChildElement("curve"); e; e = e->NextSiblingElement("curve")) {
+		vector<pair<double, double>> pts;
+		for (auto* p = e->FirstChildElement("point"); p; p = p->NextSiblingElement("point")) {
+			pts.emplace_back(p->DoubleAttribute("soc"), p->DoubleAttribute("factor"));
+		}
+		AddCurve(model_id(e), pts);
+	}
+}
+
+void BattCorrFuncPool::Load(const string& file) {
+	tinyxml2::XMLDocument doc;
+	if (doc.LoadFile(file.c_str()) != tinyxml2::XML_SUCCESS || !doc.RootElement()) {
+		throw V2SimError(std::format("Fail to load charging models {}.", file));
+	}
+	Load(doc.RootElement());
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <variant>
+#include <functional>
+#include <unordered_map>
+#include "tinyxml2.h"
+#include "utilbase.h"
+using namespace std;
+
+// PcNominal, BattCap, SoC -> RealPc
+using BattCorrFunc = function<double(double, double, double)>;
+
+// In the curves below, rate is the nominal power times the charging efficiency (kWh/s), and
+// elec, target and the results are battery levels (kWh) not capped by cap.
+
+// Charges at the nominal power whatever the SoC
+struct EqualCurve {
+	static constexpr bool Analytic = true;
+	double Pc(double p, double cap, double soc) const { return p; }
+	double ConstRateLimit(double cap) const { return INFINITY; }
+	double ElecAfter(double elec, double t, double rate, double cap) const {
+		return rate > 0 && t > 0 ? elec + rate * t : elec;
+	}
+	double TimeBetween(double elec, double target, double rate, double cap) const {
+		return elec >= target ? 0 : rate > 0 ? (target - elec) / rate : INFINITY;
+	}
+};
+
+// Constant current up to the knee SoC, then the power falls linearly with the SoC, down to the
+// fraction end of the nominal power at full charge. Past the knee dE/dt = rate * slope * (lim * cap - E),
+// so the battery approaches lim of its capacity exponentially.
+struct CCCVCurve {
+	static constexpr bool Analytic = true;
+	double knee, slope, lim;
+
+	CCCVCurve(double knee, double end);
+	double Pc(double p, double cap, double soc) const {
+		return soc <= knee ? p : p * max(0.0, 1 - slope * (soc - knee));
+	}
+	double ConstRateLimit(double cap) const { return slope > 0 ? cap * knee : INFINITY; }
+	double ElecAfter(double elec, double t, double rate, double cap) const {
+		if (rate <= 0 || t <= 0) {
+			return elec;
+		}
+		double k = cap * knee;
+		if (elec < k) {
+			double t_knee = (k - elec) / rate;
+			if (t <= t_knee) {
+				return elec + rate * t;
+			}
+			elec = k;
+			t -= t_knee;
+		}
+		if (slope == 0) {
+			return elec + rate * t;
+		}
+		double l = cap * lim;
+		return l - (l - elec) * exp(-slope * rate * t / cap);
+	}
+	double TimeBetween(double elec, double target, double rate, double cap) const;
+};
+
+// Power factor interpolated linearly between (SoC, factor) points: flat before the first point
+// and extrapolated along the last segment after the last one. Each piece has a closed form.
+struct TableCurve {
+	static constexpr bool Analytic = true;
+	vector<double> soc, fac;
+	double limit; // SoC up to which the factor stays 1
+
+	TableCurve(const vector<pair<double, double>>& points);
+	double Factor(double s) const;
+	double Pc(double p, double cap, double soc) const { return p * Factor(soc); }
+	double ConstRateLimit(double cap) const { return limit == INFINITY ? INFINITY : cap * limit; }
+	double ElecAfter(double elec, double t, double rate, double cap) const;
+	double TimeBetween(double elec, double target, double rate, double cap) const;
+private:
+	// Index of the piece holding SoC s: -1 before the first point, i from point i on
+	int pieceOf(double s) const;
+	// The factor on piece j is a + b * E, for E below hi (kWh)
+	void piece(int j, double cap, double& a, double& b, double& hi) const;
+};
+
+// A user function, integrated in sub-steps by EV::Charge
+struct CustomCurve {
+	static constexpr bool Analytic = false;
+	BattCorrFunc f;
+	double Pc(double p, double cap, double soc) const { return f(p, cap, soc); }
+	double ConstRateLimit(double cap) const { return 0; }
+	double ElecAfter(double elec, double t, double rate, double cap) const { return elec; }
+	double TimeBetween(double elec, double target, double rate, double cap) const { return INFINITY; }
+};
+
+// Battery correction model: one of the built-in curves, dispatched without an indirect call,
+// or a user function
+class ChargeModel {
+public:
+	variant<EqualCurve, CCCVCurve, TableCurve, CustomCurve> v;
+
+	template<typename C>
+	ChargeModel(C c) : v(std::move(c)) {}
+
+	bool Analytic() const {
+		return !holds_alternative<CustomCurve>(v);
+	}
+	// Real charging power (kWh/s)
+	double Pc(double p, double cap, double soc) const {
+		return visit([&](const auto& c) { return c.Pc(p, cap, soc); }, v);
+	}
+	// Battery level (kWh) up to which the charging rate stays at the nominal power
+	double ConstRateLimit(double cap) const {
+		return visit([&](const auto& c) { return c.ConstRateLimit(cap); }, v);
+	}
+	double ElecAfter(double elec, double t, double rate, double cap) const {
+		return visit([&](const auto& c) { return c.ElecAfter(elec, t, rate, cap); }, v);
+	}
+	double TimeBetween(double elec, double target, double rate, double cap) const {
+		return visit([&](const auto& c) { return c.TimeBetween(elec, target, rate, cap); }, v);
+	}
+};
+
+// Named battery correction models. "Equal" and "Linear" (CC/CV with the knee at 0.8 and 0.4 of
+// the power at full charge) are built in. Models are never removed, so replacing one by name
+// leaves the EVs created before with the old model.
+class BattCorrFuncPool {
+private:
+	static deque<ChargeModel> _models;
+	static deque<BattCorrFunc> _funcs; // The model as a function, for Get
+	static unordered_map<string, int> _ids;
+
+	static int add(const string& id, ChargeModel m) noexcept;
+public:
+	static void Add(const string& id, BattCorrFunc bcf) noexcept {
+		add(id, CustomCurve{ std::move(bcf) });
+	}
+	// Add a CC/CV curve charging at the nominal power up to SoC knee, and at end of it at full charge
+	static void AddCCCV(const string& id, double knee, double end) {
+		add(id, CCCVCurve(knee, end));
+	}
+	// Add a curve interpolating (SoC, factor of the nominal power) points
+	static void AddCurve(const string& id, const vector<pair<double, double>>& points) {
+		add(id, TableCurve(points));
+	}
+	// Add the <cccv id knee end/> and <curve id><point soc factor/>...</curve> children of an element
+	static void Load(const tinyxml2::XMLElement* root);
+	// Add the models in an XML file
+	static void Load(const string& file);
+
+	// Index of a model
+	static int Find(const string& id) {
+		const auto it = BattCorrFuncPool::_ids.find(id);
+		if (it == BattCorrFuncPool::_ids.end()) {
+			throw V2SimError(std::format("Battery correction function not found: {}", id));
+		}
+		return it->second;
+	}
+	static const ChargeModel& Model(int i) { return BattCorrFuncPool::_models[i]; }
+	static BattCorrFunc& Get(const string& id) {
+		return BattCorrFuncPool::_funcs[Find(id)];
+	}
+};
@@ -0,0 +1,183 @@
+#include "charging.h"
+
+void ChargeSessions::schedule(EV& ev, int vid, Session& s) {
+	s.seq = ++seq;
+	s.rate = 0;
+	s.knee = false;
+	if (ev.AnalyticCharge()) {
+		double lim = ev.ConstRateLimit();
+		if (ev.BattElec() < lim) {
+			s.rate = s.pc * ev.EtaC();
+			rate += s.rate;
+			s.knee = s.target > lim;
+		}
+		else {
+			varying.insert(vid);
+		}
+		s.next = s.t0 + ev.TimeBetween(ev.BattElec(), s.knee ? lim : s.target, s.pc);
+	}
+	else {
+		// Custom functions are charged step by step in Advance
+		varying.insert(vid);
+		s.next = INFINITY;
+	}
+	if (isfinite(s.next)) {
+		events.emplace(s.next, s.seq, vid);
+	}
+}
+
+double ChargeSessions::settle(EV& ev, Session& s, double t) {
+	double d_elec = 0;
+	if (t > s.t0) {
+		if (ev.AnalyticCharge()) {
+			d_elec = ev.ChargeExact(t - s.t0, price, s.pc);
+		}
+		s.t0 = t;
+	}
+	return d_elec;
+}
+
+void ChargeSessions::drop(int vid, Session& s) {
+	rate -= s.rate;
+	if (s.rate == 0) {
+		varying.erase(vid);
+	}
+	sess.erase(vid);
+	if (sess.empty()) {
+		rate = 0; // Clear the rounding errors
+	}
+}
+
+void ChargeSessions::SetPrice(double p, double t) {
+	if (p != price) {
+		SyncAll(t);
+		price = p;
+	}
+}
+
+void ChargeSessions::Start(EVMap& mp, int vid, double t, double pc_nominal, double target) {
+	this->mp = &mp;
+	Stop(vid, t);
+	auto& s = sess[vid];
+	s.t0 = t;
+	s.pc = pc_nominal;
+	s.target = target;
+	schedule(mp[vid], vid, s);
+}
+
+bool ChargeSessions::Sync(int vid, double t) {
+	auto it = sess.find(vid);
+	if (it == sess.end()) {
+		return false;
+	}
+	settle((*mp)[vid], it->second, t);
+	return true;
+}
+
+bool ChargeSessions::Stop(int vid, double t) {
+	auto it = sess.find(vid);
+	if (it == sess.end()) {
+		return false;
+	}
+	settle((*mp)[vid], it->second, t);
+	drop(vid, it->second);
+	return true;
+}
+
+void ChargeSessions::SyncAll(double t) {
+	for (auto& [vid, s] : sess) {
+		settle((*mp)[vid], s, t);
+	}
+}
+
+void ChargeSessions::StopAll(double t) {
+	SyncAll(t);
+	sess.clear();
+	varying.clear();
+	events = {};
+	rate = 0;
+}
+
+double ChargeSessions::Advance(double t0, double t1, vector<int>& ended) {
+	double w = 0, tc = t0;
+	while (!events.empty() && get<0>(events.top()) <= t1) {
+		auto [te, sq, vid] = events.top();
+		events.pop();
+		auto it = sess.find(vid);
+		if (it == sess.end() || it->second.seq != sq) {
+			continue;
+		}
+		auto& s = it->second;
+		auto& ev = (*mp)[vid];
+		te = max(te, tc);
+		w += rate * (te - tc);
+		tc = te;
+		if (s.rate == 0) {
+			w += elecAt(ev, s, te) - elecAt(ev, s, max(t0, s.t0));
+		}
+		settle(ev, s, te);
+		if (s.knee) {
+			// Enter the tapering stage exactly at the knee
+			w += ev.ChargeUntil(ev.ConstRateLimit(), price, s.pc);
+			rate -= s.rate;
+			s.rate = 0;
+			s.knee = false;
+			varying.insert(vid);
+			s.seq = ++seq;
+			s.next = te + ev.TimeBetween(ev.BattElec(), s.target, s.pc);
+			if (isfinite(s.next)) {
+				events.emplace(s.next, s.seq, vid);
+			}
+		}
+		else {
+			w += ev.ChargeUntil(s.target, price, s.pc);
+			drop(vid, s);
+			ended.push_back(vid);
+		}
+	}
+	w += rate * (t1 - tc);
+
+	size_t n_ended = ended.size();
+	for (int vid : varying) {
+		auto& s = sess[vid];
+		auto& ev = (*mp)[vid];
+		double from = max(t0, s.t0);
+		if (ev.AnalyticCharge()) {
+			w += elecAt(ev, s, t1) - elecAt(ev, s, from);
+		}
+		else {
+			w += ev.Charge((int)round(t1 - from), price, s.pc);
+			s.t0 = t1;
+			if (ev.BattElec() >= s.target) {
+				ended.push_back(vid);
+			}
+		}
+	}
+	for (size_t i = n_ended; i < ended.size(); ++i) {
+		drop(ended[i], sess[ended[i]]);
+	}
+	return w;
+}
+
+int ChargeSessions::NextEvent(int ctime) {
+	while (!events.empty()) {
+		auto [te, sq, vid] = events.top();
+		auto it = sess.find(vid);
+		if (it != sess.end() && it->second.seq == sq) {
+			break;
+		}
+		events.pop();
+	}
+	double t = events.empty() ? INFINITY : get<0>(events.top());
+	for (int vid : varying) {
+		auto& ev = (*mp)[vid];
+		if (!ev.AnalyticCharge()) {
+			auto& s = sess[vid];
+			t = min(t, (double)ctime + max(1, ev.ChargeTimeTo(s.target, s.pc)));
+		}
+	}
+	if (t >= (double)numeric_limits<int>::max()) {
+		return numeric_limits<int>::max();
+	}
+	return max(ctime + 1, (int)ceil(t));
+}
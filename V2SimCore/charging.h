@@ -0,0 +1,75 @@
+#pragma once
+
+#include <tuple>
+#include "ev.h"
+
+// Charging sessions of the EVs plugged in at one CS.
+// An EV charged at a constant nominal power under a built-in correction function follows a
+// closed form, so its battery is only written back when the session is settled: when it ends,
+// when the price changes, or on request. Each session schedules the time it reaches its target
+// level, and the load of the CS is kept as the sum of the constant rates, so an advance without
+// any event costs O(1) plus the sessions in the tapering stage of their curves and those with custom
+// correction functions, which are evaluated every time.
+class ChargeSessions {
+private:
+	struct Session {
+		double t0; // Time the battery was last written back, s
+		double pc; // Nominal charging power, kWh/s
+		double target; // Battery level at which the session ends, kWh
+		double rate; // Constant charging rate counted in rate, kWh/s, or 0 if the rate varies
+		double next; // Time of the pending event, or infinity
+		unsigned seq; // Sequence number of the pending event
+		bool knee; // Whether the pending event is entering the tapering stage rather than the end
+	};
+	using Event = tuple<double, unsigned, int>; // time, seq, vid
+
+	EVMap* mp = nullptr;
+	unordered_map<int, Session> sess;
+	priority_queue<Event, vector<Event>, greater<>> events; // Entries of restarted or ended sessions are stale
+	unordered_set<int> varying; // Sessions without a constant rate
+	double rate = 0.0; // Total constant charging rate, kWh/s
+	double price = 0.0; // Price of the electricity charged, $/kWh
+	unsigned seq = 0;
+
+	// Battery level of a session at time t without writing it back
+	double elecAt(const EV& ev, const Session& s, double t) const {
+		return min(ev.BattCap(), ev.ElecAfter(ev.BattElec(), t - s.t0, s.pc));
+	}
+	// Plan the next event of a session from the current battery level
+	void schedule(EV& ev, int vid, Session& s);
+	// Write a session back at time t
+	double settle(EV& ev, Session& s, double t);
+	// Drop a session without writing it back
+	void drop(int vid, Session& s);
+public:
+	size_t size() const { return sess.size(); }
+	bool contains(int vid) const { return sess.contains(vid); }
+
+	double Price() const { return price; }
+	// Set the price of the electricity charged after time t. The sessions are settled at t if it changes.
+	void SetPrice(double p, double t);
+
+	// Start charging an EV at time t towards target (kWh), replacing its current session if any
+	void Start(EVMap& mp, int vid, double t, double pc_nominal, double target);
+	// Nominal power of the session of an EV, or -1 if it is not charging
+	double PcNominal(int vid) const {
+		auto it = sess.find(vid);
+		return it == sess.end() ? -1 : it->second.pc;
+	}
+	// Write the battery of an EV back at time t. Return false if it is not charging.
+	bool Sync(int vid, double t);
+	// Write the battery of an EV back at time t and end its session. Return false if it is not charging.
+	bool Stop(int vid, double t);
+	// Write all the batteries back at time t
+	void SyncAll(double t);
+	// Write all the batteries back at time t and end all the sessions
+	void StopAll(double t);
+
+	// Charge from t0 to t1, where t0 is not earlier than the start of any session.
+	// The EVs reaching their targets are appended to ended in order of time and their sessions end.
+	// Return the electricity charged (kWh).
+	double Advance(double t0, double t1, vector<int>& ended);
+
+	// The earliest time after ctime at which a session may end, or INT_MAX
+	int NextEvent(int ctime);
+};
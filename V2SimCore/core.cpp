@@ -1,56 +1,141 @@
 #include "inst.h"
 
 void V2SimCore::assignCSPos() {
-	if (!fcs.TreeInitialized()) {
-		for (auto& cs : fcs) {
-			if (isinf(cs.X) || isinf(cs.Y)) {
-				auto& pos = getEdgePos(cs.Edge);
-				cs.X = pos.x;
-				cs.Y = pos.y;
+	size_t n = fcs.size();
+	for (size_t i = 0; i < n; ++i) {
+		auto& cs = fcs[i];
+		if (isinf(cs.X) || isinf(cs.Y)) {
+			auto pos = getEdgePos(fcs_edges[i], cs.Edge);
+			fcs.SetPos(i, pos.x, pos.y);
+		}
+	}
+	n = scs.size();
+	for (size_t i = 0; i < n; ++i) {
+		auto& cs = scs[i];
+		if (isinf(cs.X) || isinf(cs.Y)) {
+			auto pos = getEdgePos(cs.Edge);
+			scs.SetPos(i, pos.x, pos.y);
+		}
+	}
+	// Most CS get their positions here, so index them in one rebuild
+	fcs.CompactTree();
+	scs.CompactTree();
+}
+
+void V2SimCore::loadNet() {
+	router.reset();
+	fcs_edges.clear();
+	if (!net || net->FileName() != roadnet_path) {
+		net = make_unique<RoadNet>(roadnet_path);
+	}
+	fcs_edges.reserve(fcs.size());
+	for (auto& cs : fcs) {
+		fcs_edges.push_back(net->IndexOf(cs.Edge));
+	}
+	auto& trips = evs.Trips();
+	for (size_t k = 0; k < trips.size(); ++k) {
+		auto& trip = trips[k];
+		trip.FromEdgeIdx = net->IndexOf(trip.FromEdge());
+		trip.ToEdgeIdx = net->IndexOf(trip.ToEdge());
+	}
+	if (native_routing) {
+		router = make_unique<Router>(*net);
+		buildRouteHierarchy();
+		refreshTravelTimes();
+	}
+}
+
+void V2SimCore::buildRouteHierarchy() {
+	route_ch = RouteHierarchy();
+	if (!route_hierarchy) {
+		return;
+	}
+	if (route_hierarchy_cache) {
+		string cache = roadnet_path + ".cch";
+		uint64_t key = FileHash(roadnet_path);
+		if (!route_ch.Load(cache, key, *net)) {
+			route_ch.Build(*net);
+			if (!route_ch.Save(cache, key)) {
+				cerr << std::format("Fail to write the route hierarchy cache {}, continuing without it.", cache) << endl;
 			}
 		}
-		fcs.UpdateTree();
 	}
-	if (!scs.TreeInitialized()) {
-		for (auto& cs : scs) {
-			if (isinf(cs.X) || isinf(cs.Y)) {
-				auto& pos = getEdgePos(cs.Edge);
-				cs.X = pos.x;
-				cs.Y = pos.y;
+	else {
+		route_ch.Build(*net);
+	}
+	route_ch.SetTargets(fcs_edges);
+}
+
+void V2SimCore::buildNetIndex() {
+	if (net_index_k <= 0) {
+		return;
+	}
+	if (net_index_cache) {
+		string cache = roadnet_path + ".fcsidx";
+		uint64_t key = NearestCSIndexKey(roadnet_path, fcs_edges, net_index_k);
+		if (!fcs_index.Load(cache, key, net->size(), net_index_k)) {
+			fcs_index.Build(*net, fcs_edges, net_index_k);
+			// The cache only saves time at the next start, so a read-only case directory is not an error
+			if (!fcs_index.Save(cache, key)) {
+				cerr << std::format("Fail to write the network index cache {}, continuing without it.", cache) << endl;
 			}
 		}
-		scs.UpdateTree();
 	}
+	else {
+		fcs_index.Build(*net, fcs_edges, net_index_k);
+	}
+}
+
+// Weight of the previous travel time of an edge at a refresh
+constexpr double ROUTE_SMOOTHING = 0.5;
+
+void V2SimCore::refreshTravelTimes() {
+	size_t n = net->size();
+	for (size_t i = 0; i < n; ++i) {
+		double t = libsumo::Edge::getTraveltime(net->EdgeID((int)i));
+		router->SetTravelTime((int)i, ROUTE_SMOOTHING * router->TravelTime((int)i) + (1 - ROUTE_SMOOTHING) * t);
+	}
+	if (route_ch.size() > 0) {
+		route_ch.Customize(*net, router->TravelTimes());
+	}
+	route_refreshed = ctime;
 }
 
-bool V2SimCore::startTrip(int vid) {
+bool V2SimCore::startTrip(int vid, const int* near_cs) {
 	auto& ev = evs[vid];
 	auto& trip = ev.CurrentTrip();
 	if (ev.SoC() >= ev.KFast) {
-		ev.TargetCS = -1;
+		ev.TargetCS() = -1;
 		addVeh(ev, trip.FromEdge(), trip.ToEdge());
 	} else {
 		auto& e = trip.FromEdge();
-		auto& pos = getEdgePos(e);
-		int best_cs = getBestCS(ev, e, pos.x, pos.y);
+		int best_cs;
+		if (near_cs) {
+			best_cs = getBestCS(ev, trip.FromEdgeIdx, e, near_cs, BEST_CS_CANDIDATES);
+		}
+		else {
+			best_cs = getBestCS(ev, trip.FromEdgeIdx, e);
+		}
 		if (best_cs == -1) {
 			return false;
 		}
-		ev.TargetCS = best_cs;
+		ev.TargetCS() = best_cs;
 		addVeh(ev, e, fcs[best_cs].Edge);
 	}
 	scs.PopVeh(vid);
 	ev.ClearPc();
-	ev.Status = VehStatus::Pending;
+	ev.Status() = VehStatus::Pending;
 	return true;
 }
 
 void V2SimCore::endTrip(int vid) {
 	auto& ev = evs[vid];
-	ev.Status = VehStatus::Parking;
+	ev.Status() = VehStatus::Parking;
 	auto arr_sta = TripsLogger::ARRIVAL_NO_CHARGE;
 	if (ev.SoC() < ev.KSlow) {
-		if (scs.AddVeh(vid, ev.CurrentTrip().ToEdge())) {
+		// An SCS has the ID of its edge
+		int cs_idx = scs.Find(ev.CurrentTrip().ToEdgeSym());
+		if (cs_idx >= 0 && scs.AddVeh(vid, cs_idx)) {
 			arr_sta = TripsLogger::ARRIVAL_CHARGE_SUCCESSFULLY;
 		}
 		else {
@@ -60,169 +145,432 @@ void V2SimCore::endTrip(int vid) {
 	if (tlog) {
 		tlog->arrive(ctime, ev, arr_sta);
 		if (arr_sta == TripsLogger::ARRIVAL_CHARGE_SUCCESSFULLY) {
-			tlog->join_SCS(ctime, ev, scs[ev.TargetCS].ID);
+			tlog->join_SCS(ctime, ev, scs[ev.TargetCS()].ID);
 		}
 	}
 	int tid = ev.NextTrip();
 	if (tid != -1) {
-		dq.push(make_pair(ev.CurrentTrip().DepartTime, vid));
+		dq.Push(ev.CurrentTrip().DepartTime, vid);
 	}
 }
 
 void V2SimCore::batchDepart() {
-	while (!dq.empty() && dq.top().first <= ctime) {
-		pair<int,int> top = dq.top(); // ׼const auto& !
-		int dtime = top.first;
-		int vid = top.second;
-		dq.pop();
-		auto& ev = evs[vid];
-		auto& trip = ev.CurrentTrip();
-		if (ev.Status != VehStatus::Charging && ev.Status != VehStatus::Parking) {
-			throw V2SimError(std::format("You cannot depart EV {} @ {}, which is neither charging nor parking.", ev.ID, ctime));
-		}
-		if (startTrip(vid)) {
-			int depart_delay = max(0, ctime - dtime);
-			string csname = ev.TargetCS < 0 ? "None" : fcs[ev.TargetCS].ID;
-			if (tlog) tlog->depart(ctime, ev, depart_delay, csname);
-		}
-		else{
-			if (scs.IsCharging(vid)) {
-				if (tlog) tlog->depart_delay(ctime, ev, -1, 60 * 15);
-				dq.push({ dtime + 60 * 15, vid }); // Delay 15min and try to re-depart
+	// The SoC of EVs leaving the SCS must be up to date
+	if (dq.NextTime() <= ctime) {
+		flushSCS();
+		Sync();
+	}
+	// Departures re-scheduled within this call may be due again, so handle them in rounds
+	while (true) {
+		dep_due.clear();
+		dep_slot.clear();
+		dep_pts.clear();
+		dep_range.clear();
+		if (dq.PopDue(ctime, dep_due) == 0) {
+			break;
+		}
+
+		// Search candidate FCS for all the EVs that must charge before departure at once
+		for (auto& [dtime, vid] : dep_due) {
+			scs.SyncVeh(vid);
+			auto& ev = evs[vid];
+			auto& trip = ev.CurrentTrip();
+			// EVs starting on an indexed edge look up their candidates in the network index instead
+			if (ev.SoC() < ev.KFast && !(fcs_index.Built() && trip.FromEdgeIdx >= 0)) {
+				auto pos = getEdgePos(trip.FromEdgeIdx, trip.FromEdge());
+				dep_slot.push_back((int)dep_pts.size());
+				dep_pts.emplace_back(pos.x, pos.y, 0);
+				dep_range.push_back(ev.MaxMileage());
 			}
 			else {
-				if (tlog) tlog->depart_failed(ctime, ev, -1, "Not supported", -1);
-				setDepleted2(ev, vid, trip.FromEdge());
+				dep_slot.push_back(-1);
 			}
 		}
+		dep_near.resize(dep_pts.size() * BEST_CS_CANDIDATES);
+		// The straight-line distance never exceeds the route length, so farther FCS are unreachable
+		bool has_near = !dep_pts.empty() && fcs.SelectNearBatchIf(dep_pts, BEST_CS_CANDIDATES, dep_near,
+			[this](int i) { return fcs[i].IsOnline(ctime); }, dep_range, query_threads);
+
+		size_t n = dep_due.size();
+		for (size_t i = 0; i < n; ++i) {
+			int dtime = dep_due[i].first;
+			int vid = dep_due[i].second;
+			auto& ev = evs[vid];
+			auto& trip = ev.CurrentTrip();
+			if (ev.Status() != VehStatus::Charging && ev.Status() != VehStatus::Parking) {
+				throw V2SimError(std::format("You cannot depart EV {} @ {}, which is neither charging nor parking.", ev.ID, ctime));
+			}
+			const int* near_cs = has_near && dep_slot[i] >= 0 ? &dep_near[dep_slot[i] * BEST_CS_CANDIDATES] : nullptr;
+			if (startTrip(vid, near_cs)) {
+				int depart_delay = max(0, ctime - dtime);
+				string csname = ev.TargetCS() < 0 ? "None" : fcs[ev.TargetCS()].ID;
+				if (tlog) tlog->depart(ctime, ev, depart_delay, csname);
+			}
+			else{
+				if (scs.IsCharging(vid)) {
+					if (tlog) tlog->depart_delay(ctime, ev, -1, 60 * 15);
+					dq.Push(dtime + 60 * 15, vid); // Delay 15min and try to re-depart
+				}
+				else {
+					if (tlog) tlog->depart_failed(ctime, ev, -1, "Not supported", -1);
+					setDepleted2(ev, vid, trip.FromEdge());
+				}
+			}
+		}
+	}
+}
+
+const vector<string>& V2SimCore::cachedRoute(const string& from, const string& to) {
+	int bucket = routeBucket();
+	if (auto route = route_cache.FindRoute(from, to, bucket)) {
+		return *route;
+	}
+	auto stage = libsumo::Simulation::findRoute(from, to, "", -1.0, libsumo::ROUTING_MODE_AGGREGATED);
+	return route_cache.PutRoute(from, to, bucket, { stage.length, stage.travelTime }, std::move(stage.edges));
+}
+
+int V2SimCore::getBestCS(EV& ev, int e, const string& edge) {
+	if (e >= 0 && fcs_index.Built()) {
+		auto near_cs = fcs_index.Nearest(e);
+		auto dist = fcs_index.Distances(e);
+		cand_buf.clear();
+		for (int i = 0; i < fcs_index.K(); ++i) {
+			if (near_cs[i] >= 0 && dist[i] <= ev.MaxMileage()) {
+				cand_buf.push_back(near_cs[i]);
+			}
+		}
+		int best_cs = getBestCS(ev, e, edge, cand_buf.data(), (int)cand_buf.size());
+		if (best_cs >= 0) {
+			return best_cs;
+		}
+	}
+	auto pos = getEdgePos(e, edge);
+	return getBestCS(ev, e, edge, pos.x, pos.y);
+}
+
+int V2SimCore::getBestCS(EV& ev, int e, const string& edge, double x, double y) {
+	auto near_cs = fcs.SelectNearIf(x, y, BEST_CS_CANDIDATES, 
+		[this](int i) { return fcs[i].IsOnline(ctime); }, ev.MaxMileage());
+	if (!near_cs.has_value()) {
+		return getBestCS(ev, e, edge, nullptr, 0);
 	}
+	int cands[BEST_CS_CANDIDATES];
+	int n = 0;
+	for (auto& p : near_cs.value()) {
+		cands[n++] = p.label;
+	}
+	return getBestCS(ev, e, edge, cands, n);
 }
 
-int V2SimCore::getBestCS(EV& ev, const string& edge, double x, double y) {
-	auto near_cs = fcs.SelectNear(x, y, 10);
+int V2SimCore::getBestCS(EV& ev, int e, const string& edge, const int* cands, int n) {
 	double min_weight = 1e10;
 	int best_cs = -1;
-	if (near_cs.has_value()) {
-		for (auto& p : near_cs.value()) {
-			auto& cs = fcs[p.label];
-			if (!cs.IsOnline(ctime)) continue;
-			auto stage = libsumo::Simulation::findRoute(edge, cs.Edge, "", -1.0, libsumo::ROUTING_MODE_AGGREGATED);
-			if (stage.length > ev.MaxMileage()) continue;
-			double t_drive = stage.travelTime / 60;
-			double t_wait = max(0, (int)cs.VehCount() - cs.Slots) * 30;
-			double weight = ev.Omega * (t_drive + t_wait) + (ev.BattCap - ev.BattElec) * cs.PriceBuy(ctime);
-			if (weight < min_weight) {
-				min_weight = weight;
-				best_cs = p.label;
+	if (cands == nullptr) {
+		n = (int)fcs.size();
+	}
+	route_cs.clear();
+	for (int i = 0; i < n; ++i) {
+		int label = cands ? cands[i] : i;
+		if (label < 0) continue;
+		if (!fcs[label].IsOnline(ctime)) continue;
+		route_cs.push_back(label);
+	}
+	size_t m = route_cs.size();
+	route_cost.resize(m);
+	route_hit.assign(m, 0);
+	size_t misses = m;
+	int bucket = routeBucket();
+	if (ev.CacheRoute) {
+		for (size_t j = 0; j < m; ++j) {
+			if (auto c = route_cache.FindCost(edge, fcs[route_cs[j]].Edge, bucket)) {
+				route_cost[j] = *c;
+				route_hit[j] = 1;
+				--misses;
 			}
 		}
 	}
-	else {
-		int i = 0;
-		for (auto& cs : fcs) {
-			if (!cs.IsOnline(ctime)) continue;
-			auto stage = libsumo::Simulation::findRoute(edge, cs.Edge, "", -1.0, libsumo::ROUTING_MODE_AGGREGATED);
-			if (stage.length > ev.MaxMileage()) continue;
-			double t_drive = stage.travelTime / 60;
-			double t_wait = max(0, (int)cs.VehCount() - cs.Slots) * 30;
-			double weight = ev.Omega * (t_drive + t_wait) + (ev.BattCap - ev.BattElec) * cs.PriceBuy(ctime);
-			if (weight < min_weight) {
-				min_weight = weight;
-				best_cs = i;
+	// One search from the origin reaches all the candidates. Those outside the parsed network are left to SUMO.
+	int from = router && misses > 0 ? e : -1;
+	if (from >= 0) {
+		route_to.resize(m);
+		for (size_t j = 0; j < m; ++j) {
+			route_to[j] = route_hit[j] ? -1 : fcs_edges[route_cs[j]];
+		}
+		if (route_ch.Built()) {
+			route_all.resize(fcs.size());
+			route_ch.Query(from, route_all);
+			for (size_t j = 0; j < m; ++j) {
+				if (route_to[j] >= 0) route_cost[j] = route_all[route_cs[j]];
+			}
+		}
+		else {
+			route_all.resize(m);
+			router->OneToMany(from, route_to, route_all);
+			for (size_t j = 0; j < m; ++j) {
+				if (route_to[j] >= 0) route_cost[j] = route_all[j];
 			}
-			++i;
+		}
+	}
+	for (size_t j = 0; j < m; ++j) {
+		if (route_hit[j]) continue;
+		auto& cs_edge = fcs[route_cs[j]].Edge;
+		if (from < 0 || route_to[j] < 0) {
+			auto stage = libsumo::Simulation::findRoute(edge, cs_edge, "", -1.0, libsumo::ROUTING_MODE_AGGREGATED);
+			route_cost[j] = { stage.length, stage.travelTime };
+		}
+		if (ev.CacheRoute) {
+			route_cache.PutCost(edge, cs_edge, bucket, route_cost[j]);
+		}
+	}
+	for (size_t j = 0; j < m; ++j) {
+		int label = route_cs[j];
+		auto& cs = fcs[label];
+		if (route_cost[j].length > ev.MaxMileage()) continue;
+		double t_drive = route_cost[j].travelTime / 60;
+		double t_wait = max(0, (int)cs.VehCount() - cs.Slots) * 30;
+		double weight = ev.Omega * (t_drive + t_wait) + (ev.BattCap() - ev.BattElec()) * cs.PriceBuy(ctime);
+		if (weight < min_weight) {
+			min_weight = weight;
+			best_cs = label;
 		}
 	}
 	return best_cs;
 }
 
+void V2SimCore::syncVehicles() {
+	// One bulk read of the variables subscribed in AddVehToSUMO. Vehicles waiting for insertion 
+	// or teleporting have no road and are skipped in this step.
+	auto res = libsumo::Vehicle::getAllSubscriptionResults();
+	veh_running.clear();
+	veh_dist.clear();
+	for (auto& [vname, vars] : res) {
+		auto road = vars.find(libsumo::VAR_ROAD_ID);
+		if (road == vars.end()) continue;
+		size_t vid = evs.IndexOf(vname);
+		auto& st = veh_state[vid];
+		const string& edge = static_cast<libsumo::TraCIString*>(road->second.get())->value;
+		// A vehicle stays on an edge for several steps, so the edge is only looked up when it changes
+		if (edge != st.road) {
+			st.road = edge;
+			st.road_idx = edge.empty() ? -1 : net->IndexOf(edge);
+		}
+		if (st.road.empty()) continue;
+		st.distance = static_cast<libsumo::TraCIDouble*>(vars.at(libsumo::VAR_DISTANCE).get())->value;
+		auto pos = static_cast<libsumo::TraCIPosition*>(vars.at(libsumo::VAR_POSITION).get());
+		st.x = pos->x;
+		st.y = pos->y;
+		veh_running.push_back((int)vid);
+		veh_dist.push_back(st.distance);
+	}
+}
+
 void V2SimCore::Start() {
 	libsumo::Simulation::start({ "sumo", "-n", roadnet_path, "-b", to_string(start), "-e", to_string(end) });
 	ctime = (int)libsumo::Simulation::getTime();
 	size_t n = evs.size();
-	while (!dq.empty()) {
-		dq.pop();
-	}
+	dep_due.clear();
 	for (int i = 0; i < n; ++i) {
-		int t = evs[i].CurrentTrip().DepartTime;
-		dq.push(make_pair(t, i));
+		dep_due.emplace_back(evs[i].CurrentTrip().DepartTime, i);
 	}
+	dq.Assign(ctime, dep_due);
+	fq.Reset(ctime);
+	veh_state.assign(n, VehState{ 0, "", -1, 0, 0 });
+	fcs.ReserveVehs(n);
+	scs.ReserveVehs(n);
+	pc_max = 0;
+	for (auto& ev : evs) {
+		pc_max = max({ pc_max, ev.PcFast, ev.PcSlow });
+	}
+	arrival_rate = 0;
+	last_len = step;
+	// The CS may be members of a derived class, so they only get the pool once constructed
+	fcs.SetPool(pool);
+	scs.SetPool(pool);
+	resizePool();
+	loadNet();
 	assignCSPos();
+	buildNetIndex();
 	batchDepart();
 }
+// Time constant of the smoothed arrival rate, s
+constexpr double ARRIVAL_RATE_WINDOW = 900;
+
+int V2SimCore::adaptiveLength() const {
+	double len = step_max;
+	double k = arrival_rate * pc_max;
+	if (k > 0) {
+		len = min(len, sqrt(2 * step_tol / k));
+	}
+	// Grow gradually, so a rising peak is noticed before the steps get long
+	len = min(len, 2.0 * max(last_len, step));
+	return max(step, (int)len);
+}
+
+int V2SimCore::skipLength() {
+	int cap = step;
+	if (time_skip > step && libsumo::Simulation::getMinExpectedNumber() == 0) {
+		cap = time_skip;
+	}
+	if (step_max > step) {
+		cap = max(cap, adaptiveLength());
+	}
+	if (cap <= step) {
+		return step;
+	}
+	long long next = numeric_limits<int>::max();
+	next = min(next, (long long)dq.NextTime());
+	next = min(next, (long long)fq.NextTime());
+	next = min(next, (long long)fcs.NextEvent(evs, ctime));
+	auto steps = [&] {
+		// Stop at the last step boundary before the next event, so the event is handled by a normal step
+		long long n = min((next - ctime - 1) / step, (long long)min(cap, end - ctime) / step);
+		if (stat_interval > 0) {
+			// Land on the next statistics sample rather than stop before it
+			long long sample = start + ((ctime - start) / stat_interval + 1) * (long long)stat_interval;
+			n = min(n, (sample - ctime) / step);
+		}
+		return n;
+	};
+	// The SCS can only shorten the step, so their background update is only waited for when it matters
+	if (steps() < 2) {
+		return step;
+	}
+	Sync();
+	next = min(next, (long long)scs.NextEvent(evs, ctime));
+	long long n = steps();
+	return n >= 2 ? (int)n * step : step;
+}
+
 void V2SimCore::Step(int len) {
-	if (len == -1) {
-		len = step;
+	if (len <= 0) {
+		len = skipLength();
 	}
-	libsumo::Simulation::step(ctime + step);
+	libsumo::Simulation::step(ctime + len);
+	// The pipelined work of the last step ran along with SUMO
+	Sync();
 	int new_time = (int)libsumo::Simulation::getTime();
 	int dt = new_time - ctime;
 	ctime = new_time;
+	last_len = dt;
 
-	auto cur_vehs = libsumo::Vehicle::getIDList();
 	auto arr_vehs = libsumo::Simulation::getArrivedIDList();
+	if (dt > 0) {
+		double w = 1 - exp(-dt / ARRIVAL_RATE_WINDOW);
+		arrival_rate += w * (arr_vehs.size() / (double)dt - arrival_rate);
+	}
 
 	for (auto& vname : arr_vehs) {
 		size_t vid = evs.IndexOf(vname);
-		auto& ev = evs.Get(vname);
-		if (ev.TargetCS == -1) {
+		auto& ev = evs[vid];
+		if (ev.TargetCS() == -1) {
 			endTrip((int)vid);
 		}
 		else {
-			ev.Status = VehStatus::Charging;
-			fcs.AddVeh((int)vid, ev.TargetCS);
-			if (tlog) tlog->arrive_FCS(ctime, ev, fcs[ev.TargetCS].ID);
+			ev.Status() = VehStatus::Charging;
+			fcs.AddVeh((int)vid, ev.TargetCS());
+			if (tlog) tlog->arrive_FCS(ctime, ev, fcs[ev.TargetCS()].ID);
 		}
 	}
-	for (auto& vname : cur_vehs) {
-		size_t vid = evs.IndexOf(vname);
-		auto& ev = evs.Get(vname);
-		ev.Drive(libsumo::Vehicle::getDistance(vname), ctime);
-		if (ev.BattElec <= 0) {
-			setDepleted(ev, (int)vid, vname);
+	syncVehicles();
+	evs.DriveBatch(veh_running, veh_dist, ctime);
+	for (int vid : veh_running) {
+		auto& ev = evs[vid];
+		auto& st = veh_state[vid];
+		const string& vname = ev.ID;
+		if (ev.BattElec() <= 0) {
+			setDepleted(ev, vid, st.x, st.y);
 			libsumo::Vehicle::remove(vname);
 			if (tlog) tlog->fault_deplete(ctime, ev, "Not supported", -1);
 			continue;
 		}
-		if (ev.Status == VehStatus::Pending) {
-			ev.Status = VehStatus::Driving;
+		if (ev.Status() == VehStatus::Pending) {
+			ev.Status() = VehStatus::Driving;
 		}
-		if (ev.Status == VehStatus::Driving) {
-			if (ev.TargetCS != -1 && !fcs[ev.TargetCS].IsOnline(ctime)) {
-				const string& edge = libsumo::Vehicle::getRoadID(vname);
-				auto& pos = getEdgePos(edge);
-				int cs_id = getBestCS(ev, libsumo::Vehicle::getRoadID(vname), pos.x, pos.y);
-				auto cs_name = ev.TargetCS >= 0 ? fcs[ev.TargetCS].ID : "None";
+		if (ev.Status() == VehStatus::Driving) {
+			if (ev.TargetCS() != -1 && !fcs[ev.TargetCS()].IsOnline(ctime)) {
+				const string& edge = st.road;
+				int cs_id = getBestCS(ev, st.road_idx, edge);
+				auto cs_name = ev.TargetCS() >= 0 ? fcs[ev.TargetCS()].ID : "None";
 				if (cs_id == -1) {
-					setDepleted(ev, (int)vid, vname);
+					setDepleted(ev, vid, st.x, st.y);
 					libsumo::Vehicle::remove(vname);
 					if (tlog) tlog->fault_nocharge(ctime, ev, cs_name);
 				}
 				else {
-					ev.TargetCS = cs_id;
-					libsumo::Vehicle::changeTarget(vname, fcs[cs_id].Edge);
+					ev.TargetCS() = cs_id;
+					// A cached route must start on a normal edge, not inside a junction
+					const vector<string>* route = nullptr;
+					if (ev.CacheRoute && !edge.empty() && edge[0] != ':') {
+						route = &cachedRoute(edge, fcs[cs_id].Edge);
+					}
+					if (route && !route->empty()) {
+						libsumo::Vehicle::setRoute(vname, *route);
+					}
+					else {
+						libsumo::Vehicle::changeTarget(vname, fcs[cs_id].Edge);
+					}
 					if (tlog) tlog->fault_redirect(ctime, ev, cs_name, fcs[cs_id].ID);
 				}
 			}
 		}
 		else {
-			throw V2SimError(std::format("SUMO vehicles is not synchoronous with V2Sim for vehicle {} (Status: {}) at time {}", vname, (int)ev.Status, ctime));
+			throw V2SimError(std::format("SUMO vehicles is not synchoronous with V2Sim for vehicle {} (Status: {}) at time {}", vname, (int)ev.Status(), ctime));
 		}
 	}
 	fcs.Update(evs, dt, ctime, tlog);
-	scs.Update(evs, dt, ctime, tlog);
+	if (pipeline) {
+		pipe_dt = dt;
+	}
+	else {
+		scs.Update(evs, dt, ctime, tlog);
+	}
+	if (router && route_refresh > 0 && ctime / route_refresh != route_refreshed / route_refresh) {
+		refreshTravelTimes();
+	}
 	batchDepart();
-	while (!fq.empty() && fq.top().first <= ctime) {
-		int vid = fq.top().second;
-		fq.pop();
+	fq_due.clear();
+	fq.PopDue(ctime, fq_due);
+	for (auto& [ftime, vid] : fq_due) {
 		auto& ev = evs[vid];
-		ev.Status = VehStatus::Charging;
-		if (!fcs.AddVeh(vid, ev.TargetCS)) {
+		ev.Status() = VehStatus::Charging;
+		if (!fcs.AddVeh(vid, ev.TargetCS())) {
 			if (tlog) tlog->fault_nocharge(ctime, ev, "Cannot add depeleted EV to given CS");
-			ev.BattElec = ev.BattCap * 0.5;
+			ev.BattElec() = ev.BattCap() * 0.5;
 		}
 		else {
-			if (tlog) tlog->arrive_FCS(ctime, ev, fcs[ev.TargetCS].ID);
+			if (tlog) tlog->arrive_FCS(ctime, ev, fcs[ev.TargetCS()].ID);
 		}
 	}
+	if (pipe_dt >= 0) {
+		// Nothing else touches the SCS or the EVs in them until the next SUMO step ends
+		int sec = pipe_dt;
+		pipe_dt = -1;
+		pipe_commit = true;
+		pipe = pool->Submit([this, sec] { scs.Charge(evs, sec, ctime); });
+	}
+}
+
+void V2SimCore::pipelined(function<void()> work) {
+	if (!pipe.valid()) {
+		work();
+		return;
+	}
+	// Tasks start in order, so prev is running or done when this one starts
+	pipe = pool->Submit([prev = std::move(pipe), work = std::move(work)]() mutable {
+		prev.get();
+		work();
+	});
+}
+
+void V2SimCore::Sync() const {
+	if (!pipe.valid()) {
+		return;
+	}
+	bool commit = pipe_commit;
+	pipe_commit = false;
+	waitPipe();
+	pipe.get();
+	if (commit) {
+		scs.Commit(evs, ctime, tlog);
+	}
 }
\ No newline at end of file
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <memory>
+#include <future>
 #include <libsumo/libsumo.h>
 #include "triplogger.h"
 #include "cslist.h"
+#include "csindex.h"
+#include "hierarchy.h"
+#include "routecache.h"
+#include "timewheel.h"
 
 class V2SimCore {
 private:
@@ -13,45 +19,168 @@ private:
 	EVMap& evs;
 	FastCSMap& fcs;
 	SlowCSMap& scs;
-    priority_queue<pair<int, int>, vector<pair<int, int>>, greater<>> dq; // time, vid
-	priority_queue<pair<int, int>, vector<pair<int, int>>, greater<>> fq; // time, vid
+	TimingWheel dq; // Departures by vid
+	TimingWheel fq; // Recoveries of depleted EVs by vid
+	vector<pair<int, int>> fq_due; // Recoveries handled in the current step: time, vid
+
+	// Number of nearest FCS considered when choosing where to charge
+	static constexpr int BEST_CS_CANDIDATES = 10;
+	int query_threads = 1;
+	int time_skip = 0; // Longest step when no vehicle is in SUMO, s. Disabled if not longer than step.
+	int step_max = 0; // Longest adaptive step, s. Disabled if not longer than step.
+	int stat_interval = 0; // Interval of the statistics samples from the start time, s. 0 to sample every step.
+	double step_tol = 0.5; // Energy error allowed per station in an adaptive step, kWh
+	double arrival_rate = 0.0; // Smoothed rate of vehicle arrivals, 1/s
+	double pc_max = 0.0; // Highest nominal charging power of all the EVs, kWh/s
+	int last_len = 0; // Length of the last step, s
+	bool pipeline = false;
+	int pipe_dt = -1; // Length of the step whose SCS update has not started, -1 if none
+	mutable future<void> pipe; // SCS update of the last step and the work chained after it
+	// Workers of the CS updates, shared by the CS from Start(), plus one running pipe while pipelining
+	shared_ptr<ThreadPool> pool = make_shared<ThreadPool>();
+	void resizePool() {
+		pool->Resize(fcs.Threads() - 1 + (pipeline ? 1 : 0));
+	}
+	mutable bool pipe_commit = false; // Whether the SCS update in pipe is committed when it ends
+	static inline function<void(const function<void()>&)> wait_hook;
+	void waitPipe() const {
+		if (wait_hook) {
+			wait_hook([this] { pipe.wait(); });
+		}
+		else {
+			pipe.wait();
+		}
+	}
+	// Update the SCS now if their update in this step has not started
+	void flushSCS() {
+		if (pipe_dt >= 0) {
+			scs.Update(evs, pipe_dt, ctime, tlog);
+			pipe_dt = -1;
+		}
+	}
+	vector<pair<int, int>> dep_due; // Departures handled in the current batch: time, vid
+	vector<int> dep_slot; // Index of each departure in dep_pts, -1 if no query is needed
+	vector<Point> dep_pts; // Origin positions of the EVs that must charge before departure
+	vector<double> dep_range; // Remaining driving range of the EVs in dep_pts
+	vector<int> dep_near; // Candidate FCS of dep_pts, BEST_CS_CANDIDATES per point
+
+	// State of a running vehicle read from its libsumo subscription
+	struct VehState {
+		double distance; // Odometer, m
+		string road; // Current edge, empty if the vehicle is not on the road
+		int road_idx; // Index of road in net, -1 for internal edges
+		double x, y;
+	};
+	vector<VehState> veh_state; // Indexed by vid
+	vector<int> veh_running; // vids of the vehicles on the road in the current step
+	vector<double> veh_dist; // Odometers of veh_running in the same order, m
+	void syncVehicles();
+
+	unique_ptr<RoadNet> net; // Edge table, loaded at Start()
+	vector<int> fcs_edges; // Index of the edge of each FCS in net, -1 if not found
+	unique_ptr<Router> router; // Routes to candidate FCS, null to ask SUMO for each route
+	bool native_routing = true;
+	RouteHierarchy route_ch; // Answers the routes of router faster on large networks
+	bool route_hierarchy = false;
+	bool route_hierarchy_cache = false; // Whether route_ch is persisted next to the roadnet file
+	int route_refresh = 300; // Interval between refreshes of the router's travel times from SUMO, s
+	int route_refreshed = 0; // Time of the last refresh
+	vector<int> route_cs, route_to; // Online candidates of getBestCS and their edges in net
+	vector<RouteCost> route_cost, route_all; // route_all: costs from route_ch or router before merging
+	vector<unsigned char> route_hit; // Whether each cost in route_cost came from route_cache
+	RouteCache route_cache; // Routes of the EVs with CacheRoute set
+
+	// Time-of-day bucket of the route cache, aligned to the travel time refreshes
+	int routeBucket() const {
+		return route_refresh > 0 ? (ctime % 86400) / route_refresh : 0;
+	}
+	// Edges of the route from one edge to another, from route_cache if possible. Empty if there is no route.
+	const vector<string>& cachedRoute(const string& from, const string& to);
+	NearestCSIndex fcs_index; // Nearest FCS of each edge by network distance
+	int net_index_k = BEST_CS_CANDIDATES; // Row size of fcs_index, 0 to disable it
+	bool net_index_cache = false; // Whether fcs_index is persisted next to the roadnet file
+	vector<int> cand_buf;
 
 	void addVeh(EV& ev, const string& from, const string& to) {
-		ev.Distance = 0;
+		ev.Distance() = 0;
+		if (ev.CacheRoute) {
+			auto& route = cachedRoute(from, to);
+			if (!route.empty()) {
+				AddVehToSUMO(ev.ID, route);
+				return;
+			}
+		}
 		AddVehToSUMO(ev.ID, from, to);
 	}
 
-	int getBestCS(EV& ev, const string& edge, double x, double y);
-	auto& getEdgePos(const string& edge) {
-		return libsumo::Lane::getShape(edge + "_0").value[0];
+	// Choose the best CS from the network index of the edge, falling back to a spatial search.
+	// e is the index of the edge in net, or -1 if it is not there.
+	int getBestCS(EV& ev, int e, const string& edge);
+	int getBestCS(EV& ev, int e, const string& edge, double x, double y);
+	// Choose the best CS among n candidates. All the FCS are considered if cands is nullptr.
+	int getBestCS(EV& ev, int e, const string& edge, const int* cands, int n);
+
+	// Start of the first lane of an edge. Only edges missing from the edge table, such as 
+	// internal edges, are queried from SUMO.
+	Point getEdgePos(int e, const string& edge) const {
+		if (e >= 0) {
+			return Point(net->X(e), net->Y(e));
+		}
+		auto shape = libsumo::Lane::getShape(edge + "_0");
+		return Point(shape.value[0].x, shape.value[0].y);
+	}
+	Point getEdgePos(const string& edge) const {
+		return getEdgePos(net->IndexOf(edge), edge);
 	}
 
 	void assignCSPos();
-	bool startTrip(int vid);
+	void loadNet();
+	void buildNetIndex();
+	void buildRouteHierarchy();
+	void refreshTravelTimes();
+	bool startTrip(int vid, const int* near_cs = nullptr);
 	void endTrip(int vid);
 
 	Point getNearestFCS(const string& edge) {
-		auto& pos = getEdgePos(edge);
+		auto pos = getEdgePos(edge);
 		return fcs.FindNearestCS(pos.x, pos.y);
 	}
 	void batchDepart();
+	// Length of the next step: longer than step only when SUMO is empty or the adaptive steps allow it,
+	// and nothing happens in between
+	int skipLength();
+	// Longest adaptive step whose energy error stays within step_tol at the current arrival rate
+	int adaptiveLength() const;
 
 	void setDepleted2(EV& ev, int vid, const string& edge) {
-		ev.Status = VehStatus::Depleted;
-		ev.TargetCS = getNearestFCS(edge).label;
-		fq.push({ ctime + 3600, vid }); // Drag to nearest CS after an hour.
-		if(tlog) tlog->fault_deplete(ctime, ev, ev.TargetCS >= 0 ? fcs[ev.TargetCS].ID : "None", -1);
+		auto pos = getEdgePos(edge);
+		setDepleted(ev, vid, pos.x, pos.y);
 	}
-	void setDepleted(EV& ev, int vid, const string& vname) {
-		const string& edge = libsumo::Vehicle::getRoadID(vname);
-		setDepleted2(ev, vid, edge);
+	void setDepleted(EV& ev, int vid, double x, double y) {
+		ev.Status() = VehStatus::Depleted;
+		ev.TargetCS() = fcs.FindNearestCS(x, y).label;
+		fq.Push(ctime + 3600, vid); // Drag to nearest CS after an hour.
+		if(tlog) tlog->fault_deplete(ctime, ev, ev.TargetCS() >= 0 ? fcs[ev.TargetCS()].ID : "None", -1);
 	}
 	V2SimCore(V2SimCore&) = delete;
 	V2SimCore& operator=(V2SimCore&) = delete;
+protected:
+	// Whether a step from time prev to t reaches a statistics sample
+	bool statDue(int prev, int t) const {
+		return stat_interval <= 0 || (t - start) / stat_interval != (prev - start) / stat_interval;
+	}
+	// Run work after the SCS update of the last step: in the background while pipelining, otherwise now
+	void pipelined(function<void()> work);
 public:
 	V2SimCore(int start_time, int end_time, int step_length, const string& roadnet, EVMap& evs, FastCSMap& fcs, SlowCSMap& scs, TripsLogger* tlog) :
 		start(start_time), ctime(start_time), end(end_time), step(step_length), roadnet_path(roadnet), evs(evs), fcs(fcs), scs(scs), tlog(tlog) {
 	}
+	~V2SimCore() {
+		// The pipelined work refers to this core
+		if (pipe.valid()) {
+			waitPipe();
+		}
+	}
 	EVMap& EVs() { return evs; }
 	FastCSMap& FCSs() { return fcs; }
 	SlowCSMap& SCSs() { return scs; }
@@ -62,12 +191,83 @@ public:
 	int getStartTime() const { return start; }
 	int getEndTime() const { return end; }
 	int getStepLength() const { return step; }
+	int getQueryThreads() const { return query_threads; }
+	// Set the number of threads used to search candidate FCS for departing EVs
+	void setQueryThreads(int n) { query_threads = max(n, 1); }
+	int getUpdateThreads() const { return fcs.Threads(); }
+	// Set the number of threads charging the EVs at the CS. The results do not depend on it.
+	void setUpdateThreads(int n) { Sync(); fcs.SetThreads(n); scs.SetThreads(n); resizePool(); }
+	int getNetIndexK() const { return net_index_k; }
+	// Set the number of nearest FCS stored for each edge by network distance, 0 to disable the index.
+	// It takes effect at Start().
+	void setNetIndexK(int k) { net_index_k = max(k, 0); }
+	bool getNetIndexCache() const { return net_index_cache; }
+	// Set whether the network index is saved to and loaded from "<roadnet>.fcsidx"
+	void setNetIndexCache(bool b) { net_index_cache = b; }
+	bool getNativeRouting() const { return native_routing; }
+	// Set whether routes to candidate FCS are computed in-process rather than by SUMO's findRoute.
+	// It takes effect at Start().
+	void setNativeRouting(bool b) { native_routing = b; }
+	bool getRouteHierarchy() const { return route_hierarchy; }
+	// Set whether the native router uses a contraction hierarchy. It takes effect at Start().
+	void setRouteHierarchy(bool b) { route_hierarchy = b; }
+	bool getRouteHierarchyCache() const { return route_hierarchy_cache; }
+	// Set whether the contraction hierarchy is saved to and loaded from "<roadnet>.cch". A stale cache is rebuilt.
+	void setRouteHierarchyCache(bool b) { route_hierarchy_cache = b; }
+	size_t getRouteCacheSize() const { return route_cache.Capacity(); }
+	// Set the maximum number of routes cached for the EVs with CacheRoute set, 0 to disable the cache
+	void setRouteCacheSize(size_t n) { route_cache.SetCapacity(n); }
+	size_t getRouteCacheHits() const { return route_cache.Hits(); }
+	size_t getRouteCacheMisses() const { return route_cache.Misses(); }
+	int getRouteRefresh() const { return route_refresh; }
+	// Set the interval in seconds between refreshes of the native router's travel times from SUMO, 0 to never refresh.
+	// It is also the length of the time-of-day buckets of the route cache. libsumo only reports the current
+	// travel time of an edge, so each refresh moves the router's time halfway towards it, a moving average
+	// standing in for the smoothed edge weights of SUMO's rerouting device.
+	void setRouteRefresh(int sec) { route_refresh = max(sec, 0); }
+
+	int getTimeSkip() const { return time_skip; }
+	// Let a step jump up to sec seconds ahead when no vehicle is in SUMO, stopping before the next
+	// departure, charge completion or price/availability breakpoint, and at the next statistics sample.
+	// 0 disables skipping.
+	void setTimeSkip(int sec) { time_skip = max(sec, 0); }
+
+	int getStepMax() const { return step_max; }
+	// Let steps grow up to sec seconds while arrivals are sparse, stopping before the next departure,
+	// charge completion or price/availability breakpoint, and at the next statistics sample.
+	// 0 disables adaptive steps.
+	void setStepMax(int sec) { step_max = max(sec, 0); }
+
+	int getStatInterval() const { return stat_interval; }
+	// Set the interval in seconds between the statistics samples, counted from the start time.
+	// 0 samples after every step. Skipped and adaptive steps end at every sample time, so the
+	// recorded series keep their grid as long as sec is a multiple of the step length.
+	void setStatInterval(int sec) { stat_interval = max(sec, 0); }
+	double getStepTolerance() const { return step_tol; }
+	// Set the charging energy that may be misplaced at one station in an adaptive step, kWh.
+	// An EV arriving within a step charges from its beginning, so a step of length L errs by about
+	// (arrival rate) * L * (charging power) * L / 2.
+	void setStepTolerance(double kWh) { step_tol = max(kWh, 0.0); }
+
+	bool getPipeline() const { return pipeline; }
+	// Let the SCS of a step be updated in the background while SUMO runs the next step.
+	// Departures wait for the update when they are due. Call Sync() before accessing the SCS
+	// or the EVs in them from outside between steps. A step that time skipping or adaptive steps
+	// could lengthen also waits for it before SUMO runs, since the SCS events bound its length.
+	void setPipeline(bool b) { Sync(); pipeline = b; resizePool(); }
+	// Wait for the background work of the last step and commit its SCS update
+	void Sync() const;
+	// Wrap every wait for the background work with hook(wait). The work may call back into an
+	// embedding interpreter, e.g. Python correction functions taking the GIL, which the hook
+	// must then release while waiting.
+	static void SetWaitHook(function<void(const function<void()>&)> hook) { wait_hook = std::move(hook); }
 
 	void Start();
 
 	void Step(int len = -1);
 
 	void Stop() {
+		Sync();
 		libsumo::Simulation::close("V2Sim completed.");
 	}
 };
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <numeric>
 #include "cs.h"
 
 inline static double _dattrp(const tinyxml2::XMLElement* e, const char* attr, const char* desc, const char* cid, double def = -1) {
@@ -61,59 +62,229 @@ EVCS::EVCS(tinyxml2::XMLElement* e):
 	psell = SegFunc(e->FirstChildElement("psell"), true, "item", "btime", "price");
 
 	const char* pdalloc = e->Attribute("pd_alloc");
-	PdAlloc = V2GAllocPool::Get(pdalloc ? pdalloc : "Average");
+	PdAlloc = V2GAllocPool::GetInto(pdalloc ? pdalloc : "Average");
 }
 
-unordered_map<string, V2GAlloc> V2GAllocPool::_mp = {
-	{"", [](EVMap& mp, vector<int>& vids, double cap, int ctime, double ratio)->vector<double> {
+// Capacity PdV2G * EtaD of each EV in vids into buf.cap, return the total
+static double v2gCaps(EVMap& mp, span<const int> vids, V2GScratch& buf) {
+	buf.cap.resize(vids.size());
+	double tot = 0;
+	for (size_t k = 0; k < vids.size(); ++k) {
+		auto& ev = mp[vids[k]];
+		buf.cap[k] = ev.PdV2G * ev.EtaD;
+		tot += buf.cap[k];
+	}
+	return tot;
+}
+
+// Water-filling: out[k] = min(1, lambda * w[k]) with sum(out[k] * c[k]) = ratio * sum(c[k]).
+// Each pass clamps the EVs reaching 1 and solves lambda again for the others, so there are at most
+// as many passes as EVs, usually one or two, and each pass is a plain loop.
+static void v2gFill(span<const double> w, span<const double> c, double tot, double ratio, span<double> out) {
+	const size_t n = w.size();
+	if (ratio >= 1) {
+		fill(out.begin(), out.end(), 1.0);
+		return;
+	}
+	double rem = ratio * tot, wc = 0;
+	for (size_t k = 0; k < n; ++k) {
+		wc += w[k] * c[k];
+	}
+	if (!(wc > 0)) {
+		fill(out.begin(), out.end(), ratio);
+		return;
+	}
+	fill(out.begin(), out.end(), 0.0); // 1 marks the clamped EVs
+	while (true) {
+		double lam = rem / wc;
+		size_t hits = 0;
+		for (size_t k = 0; k < n; ++k) {
+			bool hit = out[k] == 0 && lam * w[k] >= 1;
+			out[k] = hit ? 1.0 : out[k];
+			rem -= hit ? c[k] : 0.0;
+			wc -= hit ? w[k] * c[k] : 0.0;
+			hits += hit;
+		}
+		if (hits == 0 || !(wc > 0) || !(rem > 0)) {
+			break;
+		}
+	}
+	double lam = wc > 0 && rem > 0 ? rem / wc : 0;
+	for (size_t k = 0; k < n; ++k) {
+		out[k] = out[k] == 1 ? 1.0 : min(1.0, lam * w[k]);
+	}
+}
+
+static void v2gAverage(EVMap& mp, span<const int> vids, double cap, int ctime, double ratio, span<double> out, V2GScratch& buf) {
+	fill(out.begin(), out.end(), ratio);
+}
+
+static void v2gSoC(EVMap& mp, span<const int> vids, double cap, int ctime, double ratio, span<double> out, V2GScratch& buf) {
+	double tot = v2gCaps(mp, vids, buf);
+	const double* elec = mp.States().BattElec.data();
+	const double* bcap = mp.States().BattCap.data();
+	buf.w.resize(vids.size());
+	for (size_t k = 0; k < vids.size(); ++k) {
+		buf.w[k] = elec[vids[k]] / bcap[vids[k]];
+	}
+	v2gFill(buf.w, buf.cap, tot, ratio, out);
+}
+
+static void v2gHeadroom(EVMap& mp, span<const int> vids, double cap, int ctime, double ratio, span<double> out, V2GScratch& buf) {
+	double tot = v2gCaps(mp, vids, buf);
+	buf.w.resize(vids.size());
+	for (size_t k = 0; k < vids.size(); ++k) {
+		auto& ev = mp[vids[k]];
+		buf.w[k] = max(0.0, ev.BattElec() - ev.BattCap() * ev.KV2G);
+	}
+	v2gFill(buf.w, buf.cap, tot, ratio, out);
+}
+
+// The EVs asking the least revenue discharge fully first, and those asking the same share the rest
+static void v2gPrice(EVMap& mp, span<const int> vids, double cap, int ctime, double ratio, span<double> out, V2GScratch& buf) {
+	const size_t n = vids.size();
+	double rem = ratio * v2gCaps(mp, vids, buf);
+	buf.w.resize(n);
+	for (size_t k = 0; k < n; ++k) {
+		buf.w[k] = mp[vids[k]].MinV2GRevenue;
+	}
+	buf.order.resize(n);
+	iota(buf.order.begin(), buf.order.end(), 0);
+	stable_sort(buf.order.begin(), buf.order.end(), [&](int a, int b) { return buf.w[a] < buf.w[b]; });
+	for (size_t j0 = 0; j0 < n; ) {
+		size_t j1 = j0;
+		double gc = 0;
+		while (j1 < n && buf.w[buf.order[j1]] == buf.w[buf.order[j0]]) {
+			gc += buf.cap[buf.order[j1++]];
+		}
+		double r = rem >= gc ? 1.0 : rem > 0 ? rem / gc : 0.0;
+		rem -= gc;
+		for (size_t j = j0; j < j1; ++j) {
+			out[buf.order[j]] = r;
+		}
+		j0 = j1;
+	}
+}
+
+static V2GAllocInto v2gInto(V2GAlloc f) {
+	return [f](EVMap& mp, span<const int> vids, double cap, int ctime, double ratio, span<double> out, V2GScratch& buf) {
+		vector<int> v(vids.begin(), vids.end());
+		auto res = f(mp, v, cap, ctime, ratio);
+		if (res.size() != vids.size()) {
+			throw V2SimError(std::format("PdAlloc do not return a vector with propoer size: {}", vids.size()));
+		}
+		copy(res.begin(), res.end(), out.begin());
+	};
+}
+
+static V2GAlloc v2gVec(V2GAllocInto f) {
+	return [f](EVMap& mp, vector<int>& vids, double cap, int ctime, double ratio)->vector<double> {
+		vector<double> out(vids.size());
+		V2GScratch buf;
+		f(mp, vids, cap, ctime, ratio, out, buf);
+		return out;
+	};
+}
+
+unordered_map<string, V2GAllocPool::Entry> V2GAllocPool::_mp = [] {
+	unordered_map<string, Entry> mp;
+	V2GAlloc none = [](EVMap& mp, vector<int>& vids, double cap, int ctime, double ratio)->vector<double> {
 		throw V2SimError("Empty V2GAlloc function is only a placeholder that cannot be really called.");
-	}},
-	{"Average", [](EVMap& mp, vector<int>& vids, double cap, int ctime, double ratio)->vector<double> {
-		return vector<double>(vids.size(), ratio);
-	}}
-};
+	};
+	mp[""] = { none, v2gInto(none) };
+	mp["Average"] = { v2gVec(v2gAverage), v2gAverage };
+	mp["SoC"] = { v2gVec(v2gSoC), v2gSoC };
+	mp["Headroom"] = { v2gVec(v2gHeadroom), v2gHeadroom };
+	mp["Price"] = { v2gVec(v2gPrice), v2gPrice };
+	return mp;
+}();
+
+void V2GAllocPool::Add(const string& id, V2GAlloc v2galloc) noexcept {
+	V2GAllocPool::_mp[id] = { v2galloc, v2gInto(v2galloc) };
+}
+
+void V2GAllocPool::AddInto(const string& id, V2GAllocInto v2galloc) noexcept {
+	V2GAllocPool::_mp[id] = { v2gVec(v2galloc), v2galloc };
+}
+
+void SlowCS::start(EVMap& mp, int vid, int i, int prev, int ctime) {
+	auto& ev = mp[vid];
+	replan_at = min(replan_at, ev.SlowChargeTime.NextChange(ctime));
+	if (ev.CanSlowCharge(ctime, sess.Price())) {
+		// Charging stops at KSlow, and if V2G discharge is in progress, it doesn't charge to full
+		auto k = v2g_on ? min(1.0, ev.KV2G) : 1;
+		sess.Start(mp, vid, prev, min(SinglePcLimit[i], ev.PcSlow), ev.BattCap() * min(k, ev.KSlow));
+	}
+	v2g_dirty.push_back(vid);
+}
 
 vector<int> SlowCS::Update(EVMap& mp, int sec, int ctime, double v2g_k) {
-	double Wcharge = 0;
 	double Wdischarge = 0;
+	int prev = ctime - sec;
 	if (not IsOnline(ctime)) {
 		// Do nothing when the charging station fails
+		sess.StopAll(prev);
+		replan = true;
+		tupdate = ctime;
 		cload = dload = 0;
 		return vector<int>();
 	}
-	int i = 0;
+	// The willingness to charge depends on the price, the time and whether V2G is in progress
+	double pb = pbuyAt(ctime);
+	bool v2g = v2g_k > 0;
+	if (pb != sess.Price() || v2g != v2g_on || ctime >= replan_at) {
+		replan = true;
+	}
+	sess.SetPrice(pb, prev);
+	v2g_on = v2g;
+	if (replan) {
+		sess.StopAll(prev);
+		replan_at = numeric_limits<int>::max();
+		int i = 0;
+		for (auto it = chi.begin(); it != chi.end(); ++it, ++i) {
+			start(mp, *it, i, prev, ctime);
+		}
+	}
+	else {
+		int i = (int)(chi.size() - pending.size());
+		for (int vid : pending) {
+			start(mp, vid, i++, prev, ctime);
+		}
+	}
+	pending.clear();
+	replan = false;
+
 	vector<int> ret;
-	for (auto it = chi.begin(); it != chi.end(); ++it, ++i) {
-		int vid = *it;
+	double Wcharge = sess.Advance(prev, ctime, ret);
+	tupdate = ctime;
+	for (int vid : ret) {
+		// An EV stopped at KSlow keeps its charger
 		auto& ev = mp[vid];
-		auto pb = pbuy(ctime);
-		if (ev.CanSlowCharge(ctime, pb)) {
-			// If V2G discharge is in progress, don't charge to full
-			Wcharge += ev.Charge(sec, pb, min(SinglePcLimit[i], ev.PcSlow));
-			auto k = v2g_k > 0 ? min(1.0, ev.KV2G) : 1;
-			if (ev.BattElec >= ev.BattCap * k) {
-				chi.erase(vid);
-				free.insert(vid);
-			}
+		auto k = v2g_on ? min(1.0, ev.KV2G) : 1;
+		if (ev.BattElec() >= ev.BattCap() * k) {
+			chi.erase(vid);
+			free.insert(vid);
+			mark(vid, CSVehState::Idle);
+			replan = true;
 		}
 	}
+	ret.clear();
 	if (v2g_k > 0) {
-		auto ps = psell(ctime);
-		vector<int> v2g_vehs;
+		auto ps = psellAt(ctime);
+		v2g_vehs.clear();
 		for (auto& vid : free) {
 			auto& ev = mp[vid];
 			if (ev.CanV2G(ctime, ps)) {
 				v2g_vehs.push_back(vid);
 			}
 		}
-		SinglePdActual = PdAlloc(mp, v2g_vehs, v2g_cap, ctime, v2g_k);
-		if (SinglePdActual.size() != v2g_vehs.size()) {
-			throw V2SimError(std::format("PdAlloc do not return a vector with propoer size: {}", v2g_vehs.size()));
-		}
+		SinglePdActual.resize(v2g_vehs.size());
+		PdAlloc(mp, v2g_vehs, v2g_cap, ctime, v2g_k, SinglePdActual, v2g_buf);
 		int i = 0;
 		for (auto& vid : v2g_vehs) {
 			auto& ev = mp[vid];
 			Wdischarge += ev.Discharge(v2g_k * SinglePdActual[i], sec, ps);
+			v2g_dirty.push_back(vid);
 			++i;
 		}
 	}
@@ -122,33 +293,126 @@ vector<int> SlowCS::Update(EVMap& mp, int sec, int ctime, double v2g_k) {
 	return vector<int>();
 }
 
+void SlowCS::v2gCheck(EVMap& mp, int vid, int ctime, double ps) {
+	bool charging = chi.contains(vid);
+	if (!charging && !free.contains(vid)) {
+		auto it = v2g_ent.find(vid);
+		if (it != v2g_ent.end()) {
+			v2g_sum -= it->second.cap;
+			v2g_ent.erase(it);
+		}
+		return;
+	}
+	if (charging) {
+		sess.Sync(vid, tupdate);
+	}
+	auto& ev = mp[vid];
+	auto& e = v2g_ent[vid];
+	double c = ev.CanV2G(ctime, ps) ? ev.PdV2G * ev.EtaD : 0.0;
+	v2g_sum += c - e.cap;
+	e.cap = c;
+	int next = ev.V2GTime.NextChange(ctime);
+	double pcn = charging ? sess.PcNominal(vid) : -1;
+	if (pcn > 0 && ev.SoC() <= ev.KV2G) {
+		// Charging may lift it over KV2G. Custom correction functions are checked every time.
+		long long dt = ev.AnalyticCharge() ? ev.ChargeTimeTo(ev.BattCap() * ev.KV2G, pcn) : 0;
+		if (dt < numeric_limits<int>::max()) {
+			next = (int)min<long long>(next, max<long long>(ctime + 1, tupdate + dt));
+		}
+	}
+	// An unchanged time keeps the pending event valid
+	if (next != e.next) {
+		e.next = next;
+		if (next != numeric_limits<int>::max()) {
+			v2g_events.emplace(next, vid);
+		}
+	}
+}
+
 double SlowCS::V2GCapacity(EVMap& mp, int ctime) {
 	if (!IsOnline(ctime)) {
 		return 0.0;
 	}
-	double tot_rate_ava = 0.0;
 	// Do not check if psell is None due to performance considerations
-	double v2gp = psell(ctime);
-	for (auto& vid : chi) {
-		auto& ev = mp[vid];
-		if (ev.CanV2G(ctime, v2gp)) {
-			tot_rate_ava += ev.PdV2G * ev.EtaD;
+	double ps = psellAt(ctime);
+	if (v2g_reset || ps != v2g_ps || ctime < v2g_time) {
+		v2g_ent.clear();
+		v2g_events = {};
+		v2g_dirty.clear();
+		v2g_sum = 0;
+		for (auto& vid : chi) {
+			v2gCheck(mp, vid, ctime, ps);
 		}
+		for (auto& vid : free) {
+			v2gCheck(mp, vid, ctime, ps);
+		}
+		v2g_reset = false;
+		v2g_ps = ps;
 	}
-	for (auto& vid : free) {
-		auto& ev = mp[vid];
-		if (ev.CanV2G(ctime, v2gp)) {
-			tot_rate_ava += ev.PdV2G * ev.EtaD;
+	else {
+		while (!v2g_events.empty() && v2g_events.top().first <= ctime) {
+			auto [t, vid] = v2g_events.top();
+			v2g_events.pop();
+			auto it = v2g_ent.find(vid);
+			if (it != v2g_ent.end() && it->second.next == t) {
+				it->second.next = numeric_limits<int>::max();
+				v2gCheck(mp, vid, ctime, ps);
+			}
+		}
+		for (int vid : v2g_dirty) {
+			v2gCheck(mp, vid, ctime, ps);
 		}
+		v2g_dirty.clear();
+	}
+	v2g_time = ctime;
+	if (v2g_ent.empty()) {
+		v2g_sum = 0; // No rounding left over
 	}
-	v2g_cap = tot_rate_ava;
-	return tot_rate_ava;
+	v2g_cap = v2g_sum;
+	return v2g_cap;
 }
+
+int SlowCS::NextEvent(EVMap& mp, int ctime) {
+	int t = nextChange(ctime);
+	if (!IsOnline(ctime)) {
+		return t;
+	}
+	if (replan || !pending.empty()) {
+		return ctime + 1;
+	}
+	t = min({ t, replan_at, sess.NextEvent(ctime) });
+	if (SupportV2G()) {
+		for (auto& vid : free) {
+			auto& ev = mp[vid];
+			t = min(t, ev.V2GTime.NextChange(ctime));
+			if (ev.PdV2G > 0 && ev.SoC() > ev.KV2G) {
+				t = min(t, ctime + (int)ceil((ev.BattElec() - ev.BattCap() * ev.KV2G) / ev.PdV2G));
+			}
+		}
+	}
+	return t;
+}
+
+int FastCS::NextEvent(EVMap& mp, int ctime) {
+	int t = nextChange(ctime);
+	if (!IsOnline(ctime)) {
+		return t;
+	}
+	if (replan || !pending.empty()) {
+		return ctime + 1;
+	}
+	return min(t, sess.NextEvent(ctime));
+}
+
 vector<int> FastCS::Update(EVMap& mp, int sec, int ctime, double v2g_k) {
-	double Wcharge = 0;
 	vector<int> ret;
+	int prev = ctime - sec;
 	if (not IsOnline(ctime)) {
 		// Do nothing when the charging station fails
+		sess.StopAll(prev);
+		pending.clear();
+		replan = false;
+		tupdate = ctime;
 		cload = 0;
 		for (auto& e : chi) {
 			ret.push_back(e);
@@ -160,20 +424,36 @@ vector<int> FastCS::Update(EVMap& mp, int sec, int ctime, double v2g_k) {
 		buf.clear();
 		return ret;
 	}
-	int i = 0;
-	for (auto it = chi.begin(); it != chi.end(); ++it, ++i) {
-		int vid = *it;
-		auto& ev = mp[vid];
-		Wcharge += ev.Charge(sec, pbuy(ctime), min(SinglePcLimit[i], ev.PcFast));
-		if (ev.BattElec >= ev.BattCap) {
-			ret.push_back(vid);
+	sess.SetPrice(pbuyAt(ctime), prev);
+	if (replan) {
+		// Keep the sessions whose charger power is unchanged
+		int i = 0;
+		for (auto it = chi.begin(); it != chi.end(); ++it, ++i) {
+			int vid = *it;
+			auto& ev = mp[vid];
+			if (sess.PcNominal(vid) != min(SinglePcLimit[i], ev.PcFast)) {
+				start(mp, vid, i, prev);
+			}
 		}
 	}
+	else {
+		int i = (int)(chi.size() - pending.size());
+		for (int vid : pending) {
+			start(mp, vid, i++, prev);
+		}
+	}
+	pending.clear();
+	replan = false;
+
+	double Wcharge = sess.Advance(prev, ctime, ret);
+	tupdate = ctime;
 	for (auto& vid : ret) {
 		PopVeh(vid);
 		auto t = buf.pop();
 		if (t.has_value()) {
 			chi.insert(t.value());
+			pending.push_back(t.value());
+			mark(t.value(), CSVehState::Charging);
 		}
 	}
 	cload = Wcharge / sec;
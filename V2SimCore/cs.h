@@ -2,25 +2,45 @@
 
 #include<unordered_set>
 #include<ranges>
-#include "ev.h"
+#include "charging.h"
+#include "vehloc.h"
 
 // EVMap, Vehicle Names, min(V2G_Capacity, MaxPdLimit), Current_Time, ActualRatio
 using V2GAlloc = function<vector<double>(EVMap&, vector<int>&, double, int, double)>;
 
+// Buffers of a CS reused by its V2G allocations, so that a step allocates nothing once they have grown
+struct V2GScratch {
+	vector<double> w, cap; // Per EV
+	vector<int> order;
+};
+
+// EVMap, Vehicle Names, min(V2G_Capacity, MaxPdLimit), Current_Time, ActualRatio, 
+// Output ratios (one per vehicle), Scratch space of the CS
+using V2GAllocInto = function<void(EVMap&, span<const int>, double, int, double, span<double>, V2GScratch&)>;
+
+// Named V2G allocations. Each is available through both interfaces: one added as V2GAlloc is wrapped
+// for V2GAllocInto, and the other way round. Built in are "Average", which gives every EV the same ratio,
+// and "SoC", "Headroom" and "Price", which keep the total of "Average" but share it by SoC, by energy
+// above KV2G, or by MinV2GRevenue from the lowest up, with no ratio above 1.
 class V2GAllocPool {
 private:
-	static unordered_map<string, V2GAlloc> _mp;
-public:
-	static void Add(const string& id, V2GAlloc v2galloc) noexcept {
-		V2GAllocPool::_mp[id] = v2galloc;
-	}
-	static V2GAlloc& Get(const string& id) {
+	struct Entry {
+		V2GAlloc vec;
+		V2GAllocInto into;
+	};
+	static unordered_map<string, Entry> _mp;
+	static const Entry& find(const string& id) {
 		const auto it = V2GAllocPool::_mp.find(id);
 		if (it == V2GAllocPool::_mp.end()) {
 			throw V2SimError(std::format("V2G allocation function not found: {}", id));
 		}
 		return it->second;
 	}
+public:
+	static void Add(const string& id, V2GAlloc v2galloc) noexcept;
+	static void AddInto(const string& id, V2GAllocInto v2galloc) noexcept;
+	static const V2GAlloc& Get(const string& id) { return find(id).vec; }
+	static const V2GAllocInto& GetInto(const string& id) { return find(id).into; }
 };
 
 class EVCS {
@@ -31,6 +51,37 @@ protected:
 	double cload = 0.0;
 	double dload = 0.0;
 	double v2g_cap = 0.0;
+	V2GScratch v2g_buf; // Scratch space of PdAlloc
+
+	// Prices at step_t handed over by the CS map, valid while the schedules are unchanged and not overridden
+	int step_t = -1;
+	double step_pb = 0.0, step_ps = 0.0;
+	uint64_t step_vb = 0, step_vs = 0;
+	double pbuyAt(int t) const {
+		return t == step_t && step_vb == pbuy.Version() && !pbuy.Overridden() ? step_pb : pbuy(t);
+	}
+	double psellAt(int t) const {
+		return t == step_t && step_vs == psell.Version() && !psell.Overridden() ? step_ps : psell(t);
+	}
+
+	ChargeSessions sess; // Charging of the EVs in the chargers, written back lazily
+	int tupdate = 0; // Time of the last update
+	bool replan = true; // Whether the sessions must be planned again at the next update
+	vector<int> pending; // EVs that took a charger since the last update, to start at the next update
+	VehLocTable* loc = nullptr; // Locations of the CS map this CS belongs to
+	int loc_idx = -1; // Index of this CS in the map
+
+	void mark(int vid, CSVehState s) {
+		if (loc) loc->Set(vid, loc_idx, s);
+	}
+	void unmark(int vid) {
+		if (loc) loc->Clear(vid, loc_idx);
+	}
+
+	// The first time after ctime at which the online state or a price may change
+	int nextChange(int ctime) const {
+		return min({ offline.NextChange(ctime), pbuy.NextChange(ctime), psell.NextChange(ctime) });
+	}
 
 public:
 	string ID;
@@ -51,12 +102,20 @@ public:
 	// Total Pd limit for all the chargers, kWh/s
 	double TotalPdLimit;
 
-	V2GAlloc PdAlloc;
+	V2GAllocInto PdAlloc;
 
 	SegFunc& PriceBuy() { return pbuy; }
-	double PriceBuy(int t) const { return pbuy(t); }
+	double PriceBuy(int t) const { return pbuyAt(t); }
 	SegFunc& PriceSell() { return psell; }
-	double PriceSell(int t) const { return psell(t); }
+	double PriceSell(int t) const { return psellAt(t); }
+	// Take the prices of the schedules at time t, evaluated by the CS map
+	void SetStepPrices(int t, double pb, double ps) {
+		step_t = t;
+		step_pb = pb;
+		step_ps = ps;
+		step_vb = pbuy.Version();
+		step_vs = psell.Version();
+	}
 	bool SupportV2G() const { return psell.size() > 0; }
 	bool IsOnline(int t) const { return !offline.Contains(t); }
 	void ForceShutdown() { offline.SetForce(true); }
@@ -83,12 +142,35 @@ public:
 	virtual vector<int> Update(EVMap& mp, int sec, int ctime, double v2g_k) = 0;
 	virtual double V2GCapacity(EVMap& mp, int ctime) = 0;
 	virtual double V2GCapBuffer() const = 0;
+	// The earliest time after ctime at which the state of this CS or of an EV in it may change
+	// other than by charging at the current power, such as a price breakpoint or a full battery
+	virtual int NextEvent(EVMap& mp, int ctime) = 0;
+
+	// Write the charging of an EV back up to the last update. Return false if it is not charging here.
+	bool SyncVeh(int vid) { return sess.Sync(vid, tupdate); }
+	// Write the charging of all the EVs back up to the last update
+	void SyncAll() { sess.SyncAll(tupdate); }
+	// Write the charging of an EV back and plan it again at the next update, 
+	// after its battery or charging parameters are modified. Return false if it is not in a charger here.
+	bool TouchVeh(int vid) {
+		if (!IsCharging(vid)) return false;
+		sess.Stop(vid, tupdate);
+		replan = true;
+		return true;
+	}
+	// Plan the charging again at the next update, after SinglePcLimit is modified
+	void LimitsChanged() { replan = true; }
+	// Record the vehicles of this CS in table as CS index
+	void AttachLocations(VehLocTable* table, int index) {
+		loc = table;
+		loc_idx = index;
+	}
 
 	EVCS(const string& id, const string& edge, int slots, const string& bus, double x, double y, const RangeList& offline,
 		double tot_max_pc, double tot_max_pd, const SegFunc& pbuy, const SegFunc& psell, const string& v2g_alloc) :
 		ID(id), Edge(edge), Slots(slots), Bus(bus), X(x), Y(y), offline(offline), SinglePcLimit(slots, tot_max_pc / slots), SinglePdActual(slots, 0.0),
 		TotalPcLimit(tot_max_pc), TotalPdLimit(tot_max_pd), pbuy(pbuy), psell(psell) {
-		PdAlloc = V2GAllocPool::Get(v2g_alloc);
+		PdAlloc = V2GAllocPool::GetInto(v2g_alloc);
 	}
 
 	EVCS(tinyxml2::XMLElement* e);
@@ -97,7 +179,30 @@ public:
 class SlowCS : public EVCS {
 protected:
 	OrderedHashSet<int> chi;
-	unordered_set<int> free;
+	OrderedHashSet<int> free; // EVs parked after charging
+	bool v2g_on = false; // Whether V2G was in progress at the last update
+	vector<int> v2g_vehs; // EVs joining V2G at the last update
+	int replan_at = numeric_limits<int>::max(); // Next change of the slow charging time of the EVs in chi
+
+	// V2G capacity kept incrementally: the contribution PdV2G * EtaD of each EV is counted while it can join V2G.
+	// An EV is checked again when it plugs in or out, is touched, starts charging or discharges, and at the time
+	// its V2G window changes or its charging may lift it over KV2G. A change of the selling price checks all.
+	struct V2GEntry {
+		double cap = 0; // Contribution counted in v2g_sum
+		int next = numeric_limits<int>::max(); // Time of the pending check
+	};
+	unordered_map<int, V2GEntry> v2g_ent;
+	priority_queue<pair<int, int>, vector<pair<int, int>>, greater<>> v2g_events; // (time, vid), stale if time is not next of the entry
+	vector<int> v2g_dirty; // EVs to check at the next query
+	double v2g_sum = 0.0;
+	double v2g_ps = 0.0; // Selling price of the last query
+	int v2g_time = -1; // Time of the last query
+	bool v2g_reset = true; // Whether all the EVs are checked at the next query
+
+	// Start charging the EV at position i of chi from prev if it is willing to at ctime
+	void start(EVMap& mp, int vid, int i, int prev, int ctime);
+	// Count the V2G contribution of an EV at ctime under selling price ps and plan its next check
+	void v2gCheck(EVMap& mp, int vid, int ctime, double ps);
 public:
 	SlowCS(const string& id, const string& edge, int slots, const string& bus, double x, double y, const RangeList& offline,
 		double tot_max_pc, double tot_max_pd, const SegFunc& pbuy, const SegFunc& psell, const string& v2g_alloc) :
@@ -112,13 +217,37 @@ public:
 		}
 		if (size() < Slots) {
 			chi.insert(vid);
+			pending.push_back(vid);
+			mark(vid, CSVehState::Charging);
+			v2g_dirty.push_back(vid);
 			return true;
 		}
 		return false;
 	}
 	virtual bool PopVeh(int vid) {
-		return free.erase(vid) || chi.erase(vid);
+		if (free.erase(vid)) {
+			unmark(vid);
+			v2g_dirty.push_back(vid);
+			return true;
+		}
+		if (chi.erase(vid)) {
+			unmark(vid);
+			sess.Stop(vid, tupdate);
+			replan = true;
+			v2g_dirty.push_back(vid);
+			return true;
+		}
+		return false;
+	}
+	// As EVCS::TouchVeh, and also count the V2G contribution of the EV again, even if it is parked
+	bool TouchVeh(int vid) {
+		if (HasVeh(vid)) {
+			v2g_dirty.push_back(vid);
+		}
+		return EVCS::TouchVeh(vid);
 	}
+	// Check all the EVs at the next V2G capacity query
+	void ResetV2G() { v2g_reset = true; }
 	virtual bool HasVeh(int vid) const {
 		return chi.contains(vid) || free.contains(vid);
 	}
@@ -137,10 +266,18 @@ public:
 	virtual double V2GCapacity(EVMap& mp, int ctime);
 
 	virtual double V2GCapBuffer() const { return v2g_cap; }
+
+	virtual int NextEvent(EVMap& mp, int ctime);
 };
 
 class FastCS : public EVCS {
 	OrderedHashSet<int> chi, buf;
+
+	// Start charging the EV at position i of chi from t
+	void start(EVMap& mp, int vid, int i, int t) {
+		auto& ev = mp[vid];
+		sess.Start(mp, vid, t, min(SinglePcLimit[i], ev.PcFast), ev.BattCap());
+	}
 public:
 	FastCS(const string& id, const string& edge, int slots, const string& bus, double x, double y, const RangeList& offline, double tot_max_pc, const SegFunc& pbuy) :
 		EVCS(id, edge, slots, bus, x, y, offline, tot_max_pc, 0, pbuy, SegFunc(), "") { }
@@ -152,13 +289,27 @@ public:
 		}
 		if (chi.size() < Slots) {
 			chi.insert(vid);
+			pending.push_back(vid);
+			mark(vid, CSVehState::Charging);
 		}else{
 			buf.insert(vid);
+			mark(vid, CSVehState::Waiting);
 		}
 		return true;
 	}
 	virtual bool PopVeh(int vid) {
-		return chi.erase(vid) || buf.erase(vid);
+		if (chi.erase(vid)) {
+			unmark(vid);
+			// The chargers of the EVs behind it change
+			sess.Stop(vid, tupdate);
+			replan = true;
+			return true;
+		}
+		if (buf.erase(vid)) {
+			unmark(vid);
+			return true;
+		}
+		return false;
 	}
 	virtual bool HasVeh(int vid) const {
 		return chi.contains(vid) || buf.contains(vid);
@@ -178,4 +329,6 @@ public:
 	virtual double V2GCapacity(EVMap& mp, int ctime) { return 0.0; }
 
 	virtual double V2GCapBuffer() const { return 0.0; }
+
+	virtual int NextEvent(EVMap& mp, int ctime);
 };
\ No newline at end of file
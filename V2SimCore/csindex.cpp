@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <tuple>
+#include "csindex.h"
+
+constexpr uint32_t CSINDEX_MAGIC = 0x32444943; // "CID2": links follow the lane permissions
+
+void NearestCSIndex::Build(const RoadNet& net, const vector<int>& cs_edges, int k) {
+	this->k = k;
+	n_edges = net.size();
+	cs.assign(n_edges * k, -1);
+	dist.assign(n_edges * k, numeric_limits<float>::infinity());
+	vector<int> cnt(n_edges, 0);
+
+	// Each edge is settled at most k times, once for each of its k nearest CS
+	using Label = tuple<double, int, int>; // distance, edge, CS
+	priority_queue<Label, vector<Label>, greater<>> pq;
+	int n = (int)cs_edges.size();
+	for (int i = 0; i < n; ++i) {
+		if (cs_edges[i] >= 0) {
+			pq.emplace(0.0, cs_edges[i], i);
+		}
+	}
+	while (!pq.empty()) {
+		auto [d, e, c] = pq.top();
+		pq.pop();
+		int& m = cnt[e];
+		if (m >= k) continue;
+		int* row = cs.data() + (size_t)e * k;
+		if (find(row, row + m, c) != row + m) continue;
+		row[m] = c;
+		dist[(size_t)e * k + m] = (float)d;
+		++m;
+		// The distance from a predecessor passes through the whole current edge
+		double nd = d + net.Length(e);
+		for (int p : net.Predecessors(e)) {
+			if (cnt[p] < k) {
+				pq.emplace(nd, p, c);
+			}
+		}
+	}
+}
+
+bool NearestCSIndex::Load(const string& filename, uint64_t key, size_t n_edges, int k) {
+	FILE* fh = nullptr;
+	if (fopen_s(&fh, filename.c_str(), "rb") != 0) {
+		return false;
+	}
+	uint32_t magic = 0;
+	uint64_t fkey = 0, fn = 0;
+	int32_t fk = 0;
+	bool ok = fread(&magic, sizeof(magic), 1, fh) == 1 && magic == CSINDEX_MAGIC &&
+		fread(&fkey, sizeof(fkey), 1, fh) == 1 && fkey == key &&
+		fread(&fn, sizeof(fn), 1, fh) == 1 && fn == n_edges &&
+		fread(&fk, sizeof(fk), 1, fh) == 1 && fk == k;
+	if (ok) {
+		cs.resize(n_edges * k);
+		dist.resize(n_edges * k);
+		ok = fread(cs.data(), sizeof(int), cs.size(), fh) == cs.size() &&
+			fread(dist.data(), sizeof(float), dist.size(), fh) == dist.size();
+	}
+	fclose(fh);
+	if (ok) {
+		this->k = k;
+		this->n_edges = n_edges;
+	}
+	else {
+		this->k = 0;
+		this->n_edges = 0;
+		cs.clear();
+		dist.clear();
+	}
+	return ok;
+}
+
+bool NearestCSIndex::Save(const string& filename, uint64_t key) const {
+	FILE* fh = nullptr;
+	if (fopen_s(&fh, filename.c_str(), "wb") != 0) {
+		return false;
+	}
+	uint64_t fn = n_edges;
+	int32_t fk = k;
+	bool ok = fwrite(&CSINDEX_MAGIC, sizeof(CSINDEX_MAGIC), 1, fh) == 1 &&
+		fwrite(&key, sizeof(key), 1, fh) == 1 &&
+		fwrite(&fn, sizeof(fn), 1, fh) == 1 &&
+		fwrite(&fk, sizeof(fk), 1, fh) == 1 &&
+		fwrite(cs.data(), sizeof(int), cs.size(), fh) == cs.size() &&
+		fwrite(dist.data(), sizeof(float), dist.size(), fh) == dist.size();
+	ok = fclose(fh) == 0 && ok;
+	if (!ok) {
+		// A truncated cache would only be rejected by Load, so do not leave it behind
+		remove(filename.c_str());
+	}
+	return ok;
+}
+
+uint64_t NearestCSIndexKey(const string& roadnet, const vector<int>& cs_edges, int k) {
+	uint64_t h = FileHash(roadnet);
+	auto mix = [&h](uint64_t v) {
+		for (int i = 0; i < 8; ++i) {
+			h = (h ^ ((v >> (i * 8)) & 0xff)) * 1099511628211ull;
+		}
+	};
+	for (int e : cs_edges) {
+		mix((uint64_t)(int64_t)e);
+	}
+	mix((uint64_t)k);
+	return h;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "roadnet.h"
+
+// Network-distance index of the nearest CS of every edge.
+// Row e lists the k CS closest to edge e along the road network in ascending order of the 
+// distance from the end of edge e to the end of the CS edge, padded with -1.
+// It is built by a reverse Dijkstra search from all the CS edges at once.
+class NearestCSIndex {
+private:
+	int k = 0;
+	size_t n_edges = 0;
+	vector<int> cs; // n_edges * k CS indices
+	vector<float> dist; // n_edges * k distances, m
+public:
+	NearestCSIndex() {}
+
+	bool Built() const { return k > 0; }
+	int K() const { return k; }
+
+	// cs_edges[i] is the edge index of CS i in net, or -1 if the CS is not on the network
+	void Build(const RoadNet& net, const vector<int>& cs_edges, int k);
+
+	// Load the index from a binary cache. Return false if the file is missing or stale.
+	bool Load(const string& filename, uint64_t key, size_t n_edges, int k);
+
+	// Save the index to a binary cache. Return false, leaving no file, if it cannot be written.
+	bool Save(const string& filename, uint64_t key) const;
+
+	span<const int> Nearest(int edge) const {
+		return span<const int>(cs.data() + (size_t)edge * k, k);
+	}
+	span<const float> Distances(int edge) const {
+		return span<const float>(dist.data() + (size_t)edge * k, k);
+	}
+};
+
+// Key of a NearestCSIndex cache: the roadnet file content, the CS edges and k
+uint64_t NearestCSIndexKey(const string& roadnet, const vector<int>& cs_edges, int k);
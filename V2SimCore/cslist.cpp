@@ -2,19 +2,29 @@
 
 
 void FastCSMap::Update(EVMap& mp, int sec, int ctime, TripsLogger* tlog) {
-	for (auto& c : cs) {
-		auto ret = c.Update(mp, sec, ctime, 0);
-		for (auto& vid : ret) {
+	// Each CS only touches the EVs in it, so they are charged in parallel. 
+	// The departures are then committed in CS order.
+	size_t n = cs.size();
+	StepPrices(ctime);
+	done.resize(n);
+	ParallelFor(*pool, n, threads, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			done[i] = cs[i].Update(mp, sec, ctime, 0);
+		}
+	});
+	for (size_t i = 0; i < n; ++i) {
+		auto& c = cs[i];
+		for (auto& vid : done[i]) {
 			PopVeh(vid);
 			auto& ev = mp[vid];
-			if (ev.TargetCS == -1) {
+			if (ev.TargetCS() == -1) {
 				throw V2SimError("An EV without target CS ends charging at FCS.");
 			}
 			auto& trip = ev.CurrentTrip();
-			ev.Distance = 0;
-			AddVehToSUMO(ev.ID, cs[ev.TargetCS].Edge, ev.CurrentTrip().ToEdge());
-			ev.TargetCS = -1;
-			ev.Status = VehStatus::Pending;
+			ev.Distance() = 0;
+			AddVehToSUMO(ev.ID, cs[ev.TargetCS()].Edge, ev.CurrentTrip().ToEdge());
+			ev.TargetCS() = -1;
+			ev.Status() = VehStatus::Pending;
 			ev.ClearPc();
 			if (tlog) {
 				tlog->depart_FCS(ctime, ev, c.ID);
@@ -25,10 +35,11 @@ void FastCSMap::Update(EVMap& mp, int sec, int ctime, TripsLogger* tlog) {
 
 void SlowCSMap::UpdateV2GCapacities(EVMap& mp, int t) {
 	if (t == v2g_cap_res_time) return;
-	size_t n = cs.size();
-	for (size_t i = 0; i < n; ++i) {
-		v2g_cap_res[i] = cs[i].V2GCapacity(mp, t);
-	}
+	ParallelFor(*pool, cs.size(), threads, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			v2g_cap_res[i] = cs[i].V2GCapacity(mp, t);
+		}
+	});
 }
 
 void SlowCSMap::ClearV2GDemand() {
@@ -39,7 +50,13 @@ void SlowCSMap::ClearV2GDemand() {
 }
 
 void SlowCSMap::Update(EVMap& mp, int sec, int ctime, TripsLogger *tlog) {
+	Charge(mp, sec, ctime);
+	Commit(mp, ctime, tlog);
+}
+
+void SlowCSMap::Charge(EVMap& mp, int sec, int ctime) {
 	size_t n = v2g_k.size();
+	StepPrices(ctime);
 	UpdateV2GCapacities(mp, ctime);
 	for (size_t i = 0; i < n; ++i) {
 		if (v2g_cap_res[i] > 0.0) {
@@ -49,13 +66,23 @@ void SlowCSMap::Update(EVMap& mp, int sec, int ctime, TripsLogger *tlog) {
 			v2g_k[i] = 0.0;
 		}
 	}
+	done.resize(n);
+	ParallelFor(*pool, n, threads, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			done[i] = cs[i].Update(mp, sec, ctime, v2g_k[i]);
+		}
+	});
+}
+
+void SlowCSMap::Commit(EVMap& mp, int ctime, TripsLogger* tlog) {
+	size_t n = done.size();
 	for (size_t i = 0; i < n; ++i) {
-		auto ret = cs[i].Update(mp, sec, ctime, v2g_k[i]);
-		for (auto& vid : ret) {
+		for (auto& vid : done[i]) {
 			PopVeh(vid);
 			if (tlog) {
 				tlog->leave_SCS(ctime, mp[vid], cs[i].ID);
 			}
 		}
+		done[i].clear();
 	}
 }
\ No newline at end of file
@@ -9,34 +9,116 @@ class CSMap {
 protected:
 	vector<T> cs;
 	vector<string> cs_names;
-	unordered_map<string, size_t> csmp; // CS ID -> CS index at the vector
-	unordered_map<int, size_t> vmp; // Vehicle index -> CS index
+	unordered_map<Sym, int> csmp; // Symbol of the CS ID -> CS index at the vector
+	VehLocTable locs; // Vehicle index -> CS index and state
 	KDTree tr;
+	int threads = 1; // Threads updating the CS in parallel
+	shared_ptr<ThreadPool> pool = make_shared<ThreadPool>(); // Workers of the parallel updates, possibly shared
+	vector<vector<int>> done; // EVs leaving each CS in the current update, committed in CS order
+	SegFuncTable pbuy_tab, psell_tab; // Distinct price schedules of the CS
 	CSMap(CSMap<T>&) = delete;
 	CSMap<T>& operator=(CSMap<T>&) = delete;
 	
 	void create_map() {
 		int i = 0;
 		for (auto& c : cs) {
-			csmp[c.ID] = i;
+			csmp[Symbols::Intern(c.ID)] = i;
 			cs_names.push_back(c.ID);
+			c.AttachLocations(&locs, i);
 			++i;
 		}
 	}
 public:
+	// Evaluate the prices of all the CS at time t, each distinct schedule once, and hand them to the CS,
+	// so that their price reads at t cost O(1)
+	void StepPrices(int t) {
+		size_t n = cs.size();
+		for (size_t i = 0; i < n; ++i) {
+			pbuy_tab.Set(i, cs[i].PriceBuy());
+			psell_tab.Set(i, cs[i].PriceSell());
+		}
+		pbuy_tab.Eval(t);
+		psell_tab.Eval(t);
+		for (size_t i = 0; i < n; ++i) {
+			cs[i].SetStepPrices(t, pbuy_tab[i], psell_tab[i]);
+		}
+	}
+	// Number of distinct buying and selling price schedules at the last StepPrices
+	pair<size_t, size_t> DistinctPriceSchedules() const {
+		return { pbuy_tab.Distinct(), psell_tab.Distinct() };
+	}
+	int Threads() const { return threads; }
+	// Set the number of threads updating the CS. The results do not depend on it.
+	void SetThreads(int n) {
+		threads = max(n, 1);
+		pool->Reserve(threads - 1);
+	}
+	ThreadPool& Pool() { return *pool; }
+	// Run the parallel updates on the workers of another pool, such as one shared with other maps
+	void SetPool(shared_ptr<ThreadPool> p) {
+		pool = std::move(p);
+		pool->Reserve(threads - 1);
+	}
 	bool TreeInitialized() const {
 		return tr.Initialized();
 	}
+	// Rebuild the spatial index from scratch. CS without a position yet are left out.
 	void UpdateTree() {
 		int i = 0;
 		vector<Point> pts;
 		pts.reserve(cs.size());
 		for (auto& c : cs) {
-			pts.emplace_back(Point(c.X, c.Y, i));
+			if (!isinf(c.X) && !isinf(c.Y)) {
+				pts.emplace_back(Point(c.X, c.Y, i));
+			}
 			++i;
 		}
 		tr.Init(std::move(pts));
 	}
+	// Fold the CS indexed or moved one by one since the last rebuild into the spatial index,
+	// so that the searches no longer scan them linearly
+	void CompactTree() {
+		tr.Compact();
+	}
+	// Whether a CS is found by the nearest CS searches
+	bool IsIndexed(size_t idx) const {
+		return tr.Contains((int)idx);
+	}
+	// Include or exclude a CS in the nearest CS searches without changing any CS index.
+	// A CS without a position cannot be included. Return whether the CS is indexed afterwards.
+	bool SetIndexed(size_t idx, bool indexed) {
+		auto& c = (*this)[idx];
+		if (!indexed) {
+			tr.Remove((int)idx);
+		}
+		else if (!isinf(c.X) && !isinf(c.Y)) {
+			tr.Insert(Point(c.X, c.Y, (int)idx));
+		}
+		return tr.Contains((int)idx);
+	}
+	// Move a CS to a new position and update the spatial index incrementally
+	void SetPos(size_t idx, double x, double y) {
+		auto& c = (*this)[idx];
+		c.X = x;
+		c.Y = y;
+		if (!tr.Relocate((int)idx, x, y)) {
+			tr.Insert(Point(x, y, (int)idx));
+		}
+	}
+	// Append a new CS and add it to the spatial index if it has a position. Return its index.
+	virtual size_t AddCS(T&& c) {
+		Sym k = Symbols::Intern(c.ID);
+		if (csmp.contains(k)) {
+			throw V2SimError(std::format("EVCS {} already exists.", c.ID));
+		}
+		size_t idx = cs.size();
+		csmp[k] = (int)idx;
+		cs_names.push_back(c.ID);
+		cs.emplace_back(std::move(c));
+		cs.back().AttachLocations(&locs, (int)idx);
+		SetIndexed(idx, true);
+		return idx;
+	}
 	auto begin() { return cs.begin(); }
 	auto end() { return cs.end(); }
 
@@ -44,31 +126,20 @@ public:
 	auto end() const { return cs.end(); }
 
 	CSMap(const char* filename, const char* tag) {
-		bool has_inf = false;
 		tinyxml2::XMLDocument doc;
 		if (doc.LoadFile(filename) != tinyxml2::XML_SUCCESS) {
 			throw V2SimError(std::format("Fail to load CS xml {}.", filename));
 		}
 		auto* root = doc.RootElement();
 		for (tinyxml2::XMLElement* e = root->FirstChildElement(tag); e; e = e->NextSiblingElement(tag)) {
-			T c0 = T(e);
-			if (isinf(c0.X) || isinf(c0.Y)) {
-				has_inf = true;
-			}
-			cs.emplace_back(std::move(c0));
+			cs.emplace_back(T(e));
 		}
 		create_map();
-		if(!has_inf) UpdateTree();
+		UpdateTree();
 	}
 	CSMap(vector<T>&& cs_list):cs(cs_list) {
-		bool has_inf = false;
-		for (auto& c : cs) {
-			if (isinf(c.X) || isinf(c.Y)) {
-				has_inf = true;
-			}
-		}
 		create_map();
-		if (!has_inf) UpdateTree();
+		UpdateTree();
 	}
 	T& operator[](size_t idx) {
 		try {
@@ -94,12 +165,44 @@ public:
 		}
 		return tr.findKNearestNeighbors(Point(x, y, 0), n);
 	}
-	int IndexOf(const string& ID) const {
-		auto it = csmp.find(ID);
-		if (it == csmp.end()) {
-			return -1;
+	// Select the n nearest CS of every point in pts. The CS indices of pts[i] are written to
+	// out[i * n, i * n + n) in ascending order of distance. 
+	// The queries run on up to threads threads, sharing the workers of the update pool.
+	// Return false under the same conditions where SelectNear returns nullopt.
+	bool SelectNearBatch(std::span<const Point> pts, int n, std::span<int> out, int threads = 1) const {
+		if (n == -1 || n >= cs.size() || !tr.Initialized()) {
+			return false;
+		}
+		tr.findKNearestNeighborsBatch(pts, n, out, threads, pool.get());
+		return true;
+	}
+	// Select the n nearest CS within max_dist metres whose indices are accepted by pred, 
+	// such as online CS or CS with free slots. Return nullopt if the tree is not built.
+	template <typename Pred>
+	std::optional<vector<Point>> SelectNearIf(double x, double y, int n, Pred pred, 
+		double max_dist = numeric_limits<double>::infinity()) const {
+		if (!tr.Initialized()) {
+			return std::nullopt;
+		}
+		return tr.findKNearestNeighborsIf(Point(x, y, 0), n, pred, max_dist);
+	}
+	// Batched version of SelectNearIf. max_dists holds the radius of each point, or is empty for no limit.
+	template <typename Pred>
+	bool SelectNearBatchIf(std::span<const Point> pts, int n, std::span<int> out, Pred pred,
+		std::span<const double> max_dists = {}, int threads = 1) const {
+		if (!tr.Initialized()) {
+			return false;
 		}
-		return (int)it->second;
+		tr.findKNearestNeighborsBatchIf(pts, n, out, pred, max_dists, threads, pool.get());
+		return true;
+	}
+	int IndexOf(const string& ID) const {
+		return Find(Symbols::Find(ID));
+	}
+	// Index of the CS whose ID has the given symbol, or -1 if none
+	int Find(Sym s) const {
+		auto it = csmp.find(s);
+		return it == csmp.end() ? -1 : it->second;
 	}
 	T& Get(const string& ID) {
 		int i = IndexOf(ID);
@@ -114,30 +217,53 @@ public:
 		return AddVeh(vid, i);
 	}
 	virtual bool AddVeh(int vid, int csID) {
-		T& cs = this->cs.at(csID);
-		if (cs.AddVeh(vid)) {
-			vmp[vid] = csID;
-			return true;
-		}
-		return false;
+		// The CS records the vehicle in locs
+		return this->cs.at(csID).AddVeh(vid);
 	}
 	bool HasVeh(int vid) const {
-		return vmp.contains(vid);
+		return locs.State(vid) != CSVehState::None;
 	}
 	virtual bool PopVeh(int vid) {
-		auto pos = vmp.find(vid);
-		if (pos != vmp.end()) {
-			cs[pos->second].PopVeh(vid);
-			vmp.erase(pos);
-			return true;
+		int c = locs.CS(vid);
+		if (c < 0) {
+			return false;
 		}
-		return false;
+		cs[c].PopVeh(vid);
+		locs.Clear(vid, c);
+		return true;
+	}
+	// Write the charging of an EV back up to the last update. Return false if it is not charging.
+	bool SyncVeh(int vid) {
+		return locs.State(vid) == CSVehState::Charging && cs[locs.CS(vid)].SyncVeh(vid);
+	}
+	// Write the charging of all the EVs back up to the last update, such as before reading every battery
+	void SyncAll() {
+		ParallelFor(*pool, cs.size(), threads, [this](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) cs[i].SyncAll();
+		});
+	}
+	// Write the charging of an EV back and plan it again at the next update, after the EV is modified.
+	// Return false if it is not charging.
+	bool TouchVeh(int vid) {
+		return locs.State(vid) != CSVehState::None && cs[locs.CS(vid)].TouchVeh(vid);
 	}
 	virtual bool IsCharging(int vid) {
-		if (vmp.contains(vid)) {
-			return cs[vmp[vid]].IsCharging(vid);
-		}
-		return false;
+		return locs.State(vid) == CSVehState::Charging;
+	}
+	// State of a vehicle among the CS
+	CSVehState VehState(int vid) const {
+		return locs.State(vid);
+	}
+	// CS index of a vehicle, or -1 if it is at no CS
+	int VehCS(int vid) const {
+		return locs.CS(vid);
+	}
+	const VehLocTable& Locations() const {
+		return locs;
+	}
+	// Size the location table for n vehicles, so that the parallel updates never grow it
+	void ReserveVehs(size_t n) {
+		locs.Reserve(n);
 	}
 	size_t size() const noexcept{
 		return cs.size();
@@ -148,6 +274,18 @@ public:
 		}
 		return tr.findNearestNeighbor({ x,y,0 }).label;
 	}
+	// Select all the indexed CS within d metres, in no particular order
+	vector<Point> SelectWithin(double x, double y, double d) const {
+		return tr.findWithinRadius(Point(x, y, 0), d);
+	}
+	// The earliest next event of all the CS
+	int NextEvent(EVMap& mp, int ctime) {
+		int t = numeric_limits<int>::max();
+		for (auto& c : cs) {
+			t = min(t, c.NextEvent(mp, ctime));
+		}
+		return t;
+	}
 	vector<size_t> VehCounts() const {
 		vector<size_t> ret;
 		ret.reserve(cs.size());
@@ -188,6 +326,14 @@ public:
 		CSMap<SlowCS>(filename, tag) {
 		init();
 	}
+	virtual size_t AddCS(SlowCS&& c) {
+		size_t idx = CSMap<SlowCS>::AddCS(std::move(c));
+		v2g_cap_res.push_back(0);
+		v2g_demand.push_back(0);
+		v2g_k.push_back(0);
+		v2g_cap_res_time = -1;
+		return idx;
+	}
 	void UpdateV2GCapacities(EVMap& mp, int t);
 	vector<double>& V2GCapacities(EVMap& mp, int t) {
 		UpdateV2GCapacities(mp, t);
@@ -198,4 +344,8 @@ public:
 	}
 	void ClearV2GDemand();
 	void Update(EVMap& mp, int sec, int ctime, TripsLogger* tlog);
+	// Charge the EVs at all the SCS. Only the SCS and the EVs in them are touched.
+	void Charge(EVMap& mp, int sec, int ctime);
+	// Remove the EVs that ended charging in the last Charge() from the SCS
+	void Commit(EVMap& mp, int ctime, TripsLogger* tlog);
 };
\ No newline at end of file
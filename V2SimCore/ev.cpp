@@ -1,31 +1,32 @@
 #pragma once
 
 #include <format>
+#include <numeric>
 #include "tinyxml2.h"
 #include "ev.h"
 
-void Stringsplit(const string& str, const char split, vector<string>& res)
-{
-	if (str == "")	return;
-	size_t pos = -1;
-	size_t pos2 = str.find(split);
-
-	while (pos2 != str.npos)
-	{
-		if (pos2 - pos > 1) {
-			res.push_back(str.substr(pos + 1, pos2 - pos - 1));
+// Split str by split and intern the parts
+static void InternSplit(string_view str, const char split, vector<Sym>& res) {
+	size_t pos = 0;
+	while (pos < str.size()) {
+		size_t end = str.find(split, pos);
+		if (end == str.npos) {
+			end = str.size();
 		}
-		pos = pos2;
-		pos2 = str.find(split, pos + 1);
-	}
-	if (pos != str.size() - 1) {
-		res.push_back(str.substr(pos + 1));
+		if (end > pos) {
+			res.push_back(Symbols::Intern(str.substr(pos, end - pos)));
+		}
+		pos = end + 1;
 	}
 }
 
 Trip::Trip(const string& id, int dpt_time, const string& fTAZ, const string& tTAZ, 
 	const vector<string>& route, bool auto_detect_fixed_route, bool fixed_route) noexcept :
-	ID(id), DepartTime(dpt_time), FromTAZ(fTAZ), ToTAZ(tTAZ), route(route) {
+	ID(id), DepartTime(dpt_time), from_taz(Symbols::Intern(fTAZ)), to_taz(Symbols::Intern(tTAZ)) {
+	this->route.reserve(route.size());
+	for (auto& e : route) {
+		this->route.push_back(Symbols::Intern(e));
+	}
 	if (auto_detect_fixed_route) {
 		FixedRoute = route.size() > 2;
 	}
@@ -36,8 +37,8 @@ Trip::Trip(const string& id, int dpt_time, const string& fTAZ, const string& tTA
 
 Trip::Trip(const string& id, int dpt_time, const string& fTAZ, const string& tTAZ, 
 	const string& route, bool auto_detect_fixed_route, bool fixed_route) :
-	ID(id), DepartTime(dpt_time), FromTAZ(fTAZ), ToTAZ(tTAZ) {
-	Stringsplit(route, ' ', this->route);
+	ID(id), DepartTime(dpt_time), from_taz(Symbols::Intern(fTAZ)), to_taz(Symbols::Intern(tTAZ)) {
+	InternSplit(route, ' ', this->route);
 	if (auto_detect_fixed_route) {
 		FixedRoute = route.size() > 2;
 	}
@@ -61,44 +62,137 @@ static string strlower(const char* s) {
 	return ret;
 }
 
-Trip::Trip(const tinyxml2::XMLElement* e) : ID(strattr(e, "id")), DepartTime(e->IntAttribute("depart", -1)),
-	FromTAZ(strattr(e, "fromTaz")), ToTAZ(strattr(e, "toTaz")) {
-	if (ID.empty()) {
+// Check a trip element and append its edges to route. Return whether the route is fixed.
+static bool parseTrip(const tinyxml2::XMLElement* e, const char* id, vector<Sym>& route) {
+	if (*id == 0) {
 		throw V2SimError(std::format("Trip ID must be specified. It cannot be empty string. Line {}", e->GetLineNum()));
 	}
-	const char* route = e->Attribute("route_edges");
-	if (route == NULL) {
+	const char* edges = e->Attribute("route_edges");
+	if (edges == NULL) {
 		throw V2SimError(std::format("Trip ID must be specified. It cannot be empty string. Line {}", e->GetLineNum()));
 	}
-	Stringsplit(route, ' ', this->route);
-	if (this->route.size() < 2) {
+	size_t n0 = route.size();
+	InternSplit(edges, ' ', route);
+	size_t n = route.size() - n0;
+	if (n < 2) {
+		route.resize(n0);
 		throw V2SimError(std::format("The route of a trip must contain 2 edges at least. Line {}", e->GetLineNum()));
 	}
 	const char* fixed_route = e->Attribute("fixed_route");
 	if (fixed_route == NULL || strlower(fixed_route) == "none") {
-		FixedRoute = this->route.size() > 2;
+		return n > 2;
 	} else if (strlower(fixed_route) == "true") {
-		FixedRoute = true;
+		return true;
 	} else if (strlower(fixed_route) == "false") {
-		FixedRoute = false;
-	} else {
-		throw V2SimError(std::format("Invalid value for 'fixed_route' attribute in trip '{}'. It must be 'True', 'False', or 'None' in any case. Line {}", ID, e->GetLineNum()));
+		return false;
+	}
+	route.resize(n0);
+	throw V2SimError(std::format("Invalid value for 'fixed_route' attribute in trip '{}'. It must be 'True', 'False', or 'None' in any case. Line {}", id, e->GetLineNum()));
+}
+
+Trip::Trip(const tinyxml2::XMLElement* e) : ID(strattr(e, "id")), DepartTime(e->IntAttribute("depart", -1)),
+	from_taz(Symbols::Intern(strattr(e, "fromTaz"))), to_taz(Symbols::Intern(strattr(e, "toTaz"))) {
+	FixedRoute = parseTrip(e, ID.c_str(), route);
+}
+
+Trip::Trip(const TripStore& store, size_t k) : from_taz(store[k].from_taz), to_taz(store[k].to_taz), ID(store.ID(k)), 
+	DepartTime(store[k].DepartTime), FixedRoute(store[k].FixedRoute) {
+	auto r = store.Route(k);
+	route.assign(r.begin(), r.end());
+}
+
+size_t TripStore::push(const TripRec& r, string_view id, span<const Sym> route) {
+	recs.push_back(r);
+	edges.insert(edges.end(), route.begin(), route.end());
+	edge0.push_back((uint32_t)edges.size());
+	ids.insert(ids.end(), id.begin(), id.end());
+	id0.push_back((uint32_t)ids.size());
+	return recs.size() - 1;
+}
+
+size_t TripStore::Add(const Trip& t) {
+	auto& route = t.RouteSyms();
+	Sym none = Symbols::Intern("");
+	TripRec r;
+	r.from_taz = t.from_taz;
+	r.to_taz = t.to_taz;
+	r.from_edge = route.empty() ? none : route.front();
+	r.to_edge = route.empty() ? none : route.back();
+	r.DepartTime = t.DepartTime;
+	r.FixedRoute = t.FixedRoute;
+	return push(r, t.ID, route);
+}
+
+size_t TripStore::Add(const TripStore& src, size_t k) {
+	return push(src.recs[k], src.ID(k), src.Route(k));
+}
+
+size_t TripStore::Add(const tinyxml2::XMLElement* e) {
+	const char* id = strattr(e, "id");
+	TripRec r;
+	r.FixedRoute = parseTrip(e, id, edges);
+	r.from_taz = Symbols::Intern(strattr(e, "fromTaz"));
+	r.to_taz = Symbols::Intern(strattr(e, "toTaz"));
+	r.from_edge = edges[edge0.back()];
+	r.to_edge = edges.back();
+	r.DepartTime = e->IntAttribute("depart", -1);
+	recs.push_back(r);
+	edge0.push_back((uint32_t)edges.size());
+	ids.insert(ids.end(), id, id + strlen(id));
+	id0.push_back((uint32_t)ids.size());
+	return recs.size() - 1;
+}
+
+void TripStore::Reserve(size_t trips, size_t edges) {
+	recs.reserve(trips);
+	edge0.reserve(trips + 1);
+	this->edges.reserve(edges);
+	id0.reserve(trips + 1);
+}
+
+void TripStore::Clear() {
+	recs.clear();
+	edge0.assign(1, 0);
+	edges.clear();
+	id0.assign(1, 0);
+	ids.clear();
+}
+
+vector<string> Trip::Route() const {
+	vector<string> ret;
+	ret.reserve(route.size());
+	for (Sym e : route) {
+		ret.push_back(Symbols::Name(e));
 	}
+	return ret;
 }
 
-unordered_map<string, BattCorrFunc> BattCorrFuncPool::_mp = {
-	{"Equal", [](double p, double c, double soc) -> double { return p; } },
-	{"Linear", [](double p, double c, double soc) -> double { return soc <= 0.8 ? p : p * (3.4 - 3 * soc); }}
-};
+double EV::ConstRateLimit() const {
+	return model().ConstRateLimit(BattCap());
+}
+
+double EV::ElecAfter(double elec, double t, double pc_nominal_kWhps) const {
+	return model().ElecAfter(elec, t, pc_nominal_kWhps * EtaC(), BattCap());
+}
+
+double EV::TimeBetween(double elec, double target, double pc_nominal_kWhps) const {
+	return model().TimeBetween(elec, target, pc_nominal_kWhps * EtaC(), BattCap());
+}
 
 EV::EV(const string& id, const vector<Trip>& trips, double eta_c, double eta_d, double cap_kWh, double soc,
 	double range_km, double pc_fast_kW, double pc_slow_kW, double pd_v2g, double omega, double k_rel, double k_fast, double k_slow,
 	double k_v2g, const string& rmod, const RangeList& sc_time, double max_sc_cost, const RangeList& v2g_time,
-	double min_v2g_revenue, bool cache_route) : ID(id), EtaC(eta_c), EtaD(eta_d), BattCap(cap_kWh), BattElec(soc * cap_kWh), 
-	Consumption(cap_kWh / (range_km * 1e3)), PcFast(pc_fast_kW / 3.6e3), PcSlow(pc_slow_kW / 3.6e3), PdV2G(pd_v2g / 3.6e3), 
-	Omega(omega), KRel(k_rel), KFast(k_fast), KSlow(k_slow), KV2G(k_v2g), SlowChargeTime(sc_time), MaxSlowChargeCost(max_sc_cost),
-	V2GTime(v2g_time), MinV2GRevenue(min_v2g_revenue), CacheRoute(cache_route) {
-	this->rmod = BattCorrFuncPool::Get(rmod);
+	double min_v2g_revenue, bool cache_route) : ID(id), EtaD(eta_d), PcFast(pc_fast_kW / 3.6e3), PcSlow(pc_slow_kW / 3.6e3), 
+	PdV2G(pd_v2g / 3.6e3), Omega(omega), KRel(k_rel), KFast(k_fast), KSlow(k_slow), KV2G(k_v2g), SlowChargeTime(sc_time), 
+	MaxSlowChargeCost(max_sc_cost), V2GTime(v2g_time), MinV2GRevenue(min_v2g_revenue), CacheRoute(cache_route) {
+	for (auto& t : trips) {
+		this->trips.Add(t);
+	}
+	EtaC() = eta_c;
+	BattCap() = cap_kWh;
+	BattElec() = soc * cap_kWh;
+	Consumption() = cap_kWh / (range_km * 1e3);
+	slot.st->Model[slot.i] = BattCorrFuncPool::Find(rmod);
 }
 
 inline static double _dattrp(const tinyxml2::XMLElement* e, const char* attr, const char* desc, const char* vid, double def = -1) {
@@ -118,16 +212,24 @@ inline static double _dattr01(const tinyxml2::XMLElement* e, const char* attr, c
 }
 
 EV::EV(tinyxml2::XMLElement* cur) {
+	load(cur);
+}
+
+EV::EV(tinyxml2::XMLElement* cur, EVStateStore* st, TripStore* ts) : trips(ts), slot(st) {
+	load(cur);
+}
+
+void EV::load(tinyxml2::XMLElement* cur) {
 	const char* vid = cur->Attribute("id");
 	if (!vid ) {
 		throw V2SimError(std::format("Vehicle ID is not defined on line{}!", cur->GetLineNum()));
 	}
 	ID = vid;
-	EtaC = _dattr01(cur, "eta_c", "Charging efficiency", vid, 0.9);
+	EtaC() = _dattr01(cur, "eta_c", "Charging efficiency", vid, 0.9);
 	EtaD = _dattr01(cur, "eta_d", "Discharging efficiency", vid, 0.9);
-	BattCap = _dattrp(cur, "bcap", "Battery capcity", vid);
-	BattElec = BattCap * _dattr01(cur, "soc", "SoC", vid, 0.9);
-	Consumption = _dattrp(cur, "c", "Energy used per meter", vid) / 1e3; // convert from Wh/m to kWh/m
+	BattCap() = _dattrp(cur, "bcap", "Battery capcity", vid);
+	BattElec() = BattCap() * _dattr01(cur, "soc", "SoC", vid, 0.9);
+	Consumption() = _dattrp(cur, "c", "Energy used per meter", vid) / 1e3; // convert from Wh/m to kWh/m
 	PcFast = _dattrp(cur, "rf", "Fast charging power", vid) / 3.6e3; // convert from kW to kWh/s
 	PcSlow = _dattrp(cur, "rs", "Slow charing power", vid) / 3.6e3; // convert from kW to kWh/s
 	PdV2G = _dattrp(cur, "rv", "V2G discharging power", vid) / 3.6e3; // convert from kW to kWh/s
@@ -144,7 +246,7 @@ EV::EV(tinyxml2::XMLElement* cur) {
 	if (!rmod) {
 		rmod = "Linear";
 	}
-	this->rmod = BattCorrFuncPool::Get(rmod);
+	slot.st->Model[slot.i] = BattCorrFuncPool::Find(rmod);
 	const char* cache_route = cur->Attribute("cache_route");
 	if (!cache_route || strlower(cache_route) != "true") {
 		CacheRoute = false;
@@ -154,7 +256,7 @@ EV::EV(tinyxml2::XMLElement* cur) {
 	}
 	tinyxml2::XMLElement* tr = cur->FirstChildElement("trip");
 	while (tr != NULL) {
-		this->trips.emplace_back(Trip(tr));
+		this->trips.Add(tr);
 		tr = tr->NextSiblingElement("trip");
 	}
 }
@@ -170,9 +272,190 @@ void EVMap::load(const char* fn) {
 	if (!root) {
 		throw V2SimError(std::format("Fail to load '{}'. Root element not found!", string(fn)));
 	}
+	// Charging models defined along with the vehicles
+	BattCorrFuncPool::Load(root);
 	XMLElement* cur = root->FirstChildElement("vehicle");
 	while (cur != NULL) {
-		this->Add(EV(cur));
+		// Built in place, so that neither its state nor its trips are copied
+		this->Add(EV(cur, &st, &trips));
 		cur = cur->NextSiblingElement("vehicle");
 	}
+}
+
+size_t EVStateStore::Push() {
+	BattElec.push_back(0.0);
+	BattCap.push_back(0.0);
+	Consumption.push_back(0.0);
+	EtaC.push_back(0.0);
+	Distance.push_back(0.0);
+	Cost.push_back(0.0);
+	Pc.push_back(0.0);
+	Status.push_back(VehStatus::Parking);
+	TargetCS.push_back(-1);
+	DriveTime.push_back(-1);
+	Model.push_back(0);
+	return size() - 1;
+}
+
+void EVStateStore::CopySlot(size_t i, const EVStateStore& src, size_t j) {
+	BattElec[i] = src.BattElec[j];
+	BattCap[i] = src.BattCap[j];
+	Consumption[i] = src.Consumption[j];
+	EtaC[i] = src.EtaC[j];
+	Distance[i] = src.Distance[j];
+	Cost[i] = src.Cost[j];
+	Pc[i] = src.Pc[j];
+	Status[i] = src.Status[j];
+	TargetCS[i] = src.TargetCS[j];
+	DriveTime[i] = src.DriveTime[j];
+	Model[i] = src.Model[j];
+}
+
+void EVStateStore::Reserve(size_t n) {
+	BattElec.reserve(n);
+	BattCap.reserve(n);
+	Consumption.reserve(n);
+	EtaC.reserve(n);
+	Distance.reserve(n);
+	Cost.reserve(n);
+	Pc.reserve(n);
+	Status.reserve(n);
+	TargetCS.reserve(n);
+	DriveTime.reserve(n);
+	Model.reserve(n);
+}
+
+void EVStateStore::Clear() {
+	BattElec.clear();
+	BattCap.clear();
+	Consumption.clear();
+	EtaC.clear();
+	Distance.clear();
+	Cost.clear();
+	Pc.clear();
+	Status.clear();
+	TargetCS.clear();
+	DriveTime.clear();
+	Model.clear();
+}
+
+void EVMap::Add(EV&& v) {
+	size_t idx = evs.size();
+	Sym k = Symbols::Intern(v.ID);
+	if (k >= bysym.size()) {
+		bysym.resize((size_t)k + 1, -1);
+	}
+	bysym[k] = (int)idx;
+	if (v.slot.st != &st) {
+		st.Push();
+		v.slot.Bind(&st, idx);
+	}
+	v.trips.Bind(&trips);
+	trip0.push_back(v.trips.first);
+	const EV* old = evs.data();
+	evs.push_back(std::move(v));
+	if (evs.data() != old) {
+		// The EVs were relocated, and copies have left the stores if EV could not be moved
+		for (size_t i = 0; i < evs.size(); ++i) {
+			evs[i].slot.Bind(&st, i);
+			evs[i].trips.Attach(&trips, trip0[i]);
+		}
+	}
+}
+
+void EVMap::DriveBatch(span<const int> vids, span<const double> dist, int ctime) {
+	if (dist.size() != vids.size()) {
+		throw V2SimError(std::format("DriveBatch: {} vehicles but {} distances", vids.size(), dist.size()));
+	}
+	const size_t n = vids.size();
+	const int* v = vids.data();
+	const double* nd = dist.data();
+	double* elec = st.BattElec.data();
+	double* d = st.Distance.data();
+	const double* c = st.Consumption.data();
+	int* lt = st.DriveTime.data();
+	bool bad = false;
+	for (size_t k = 0; k < n; ++k) {
+		bad |= nd[k] < d[v[k]] - 1;
+	}
+	if (bad) {
+		for (size_t k = 0; k < n; ++k) {
+			if (nd[k] < d[v[k]] - 1) {
+				evs[v[k]].Drive(nd[k], ctime); // Throws
+			}
+		}
+	}
+	// No calls or branches, so the loop vectorizes with gathers and scatters where the target has them
+	for (size_t k = 0; k < n; ++k) {
+		int i = v[k];
+		elec[i] -= (nd[k] - d[i]) * c[i];
+		d[i] = nd[k];
+		lt[i] = ctime;
+	}
+}
+
+// Charge the EVs at positions pos[0..m) of a batch, or at 0..m-1 if pos is null, all under curve c,
+// by its closed form as EV::ChargeExact does. The curve is inlined, so the loop has no indirect calls.
+template<typename C>
+static void chargeGroup(const C& c, EVStateStore& st, const int* v, const int* pos, size_t m, int t,
+	const double* pn, const double* uc, double* de) {
+	double* elec = st.BattElec.data();
+	const double* cap = st.BattCap.data();
+	const double* eta = st.EtaC.data();
+	double* cost = st.Cost.data();
+	double* pc = st.Pc.data();
+	for (size_t j = 0; j < m; ++j) {
+		int k = pos ? pos[j] : (int)j;
+		int i = v[k];
+		double e0 = elec[i];
+		double d_e = min(c.ElecAfter(e0, t, pn[k] * eta[i], cap[i]), cap[i]) - e0;
+		elec[i] = e0 + d_e;
+		pc[i] = c.Pc(pn[k], cap[i], elec[i] / cap[i]);
+		cost[i] += (d_e / eta[i]) * uc[k];
+		de[k] = d_e;
+	}
+}
+
+void EVMap::ChargeBatch(span<const int> vids, int t, span<const double> pc_nominal, span<const double> unit_cost, span<double> d_elec) {
+	if (pc_nominal.size() != vids.size() || unit_cost.size() != vids.size() || d_elec.size() != vids.size()) {
+		throw V2SimError(std::format("ChargeBatch: {} vehicles but {} powers, {} costs and {} outputs", 
+			vids.size(), pc_nominal.size(), unit_cost.size(), d_elec.size()));
+	}
+	const size_t n = vids.size();
+	const int* v = vids.data();
+	const double* pn = pc_nominal.data();
+	const double* uc = unit_cost.data();
+	double* de = d_elec.data();
+	const int* model = st.Model.data();
+	bool mixed = false;
+	for (size_t k = 1; k < n; ++k) {
+		mixed |= model[v[k]] != model[v[0]];
+	}
+	// Group the EVs by model, keeping their order within each group
+	vector<int> pos;
+	if (mixed) {
+		pos.resize(n);
+		iota(pos.begin(), pos.end(), 0);
+		stable_sort(pos.begin(), pos.end(), [&](int a, int b) { return model[v[a]] < model[v[b]]; });
+	}
+	auto at = [&](size_t j) { return mixed ? pos[j] : (int)j; };
+	for (size_t j0 = 0; j0 < n; ) {
+		int m = model[v[at(j0)]];
+		size_t j1 = mixed ? j0 + 1 : n;
+		while (j1 < n && model[v[at(j1)]] == m) {
+			++j1;
+		}
+		visit([&](const auto& c) {
+			if constexpr (decay_t<decltype(c)>::Analytic) {
+				chargeGroup(c, st, v, mixed ? pos.data() + j0 : nullptr, j1 - j0, t, pn, uc, de);
+			}
+			else {
+				for (size_t j = j0; j < j1; ++j) {
+					int k = at(j);
+					de[k] = evs[v[k]].Charge(t, uc[k], pn[k]);
+				}
+			}
+		}, BattCorrFuncPool::Model(m).v);
+		j0 = j1;
+	}
 }
\ No newline at end of file
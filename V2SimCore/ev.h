@@ -3,8 +3,12 @@
 #include<string>
 #include<vector>
 #include<functional>
+#include<memory>
+#include<span>
 #include<xutility>
 #include "utils.h"
+#include "symbols.h"
+#include "chargemodel.h"
 using namespace std;
 
 enum class VehStatus {
@@ -15,9 +19,13 @@ enum class VehStatus {
 	Depleted = 4,
 };
 
+class TripStore;
+
 class Trip {
 private:
-	vector<string> route;
+	friend class TripStore;
+	vector<Sym> route; // Interned edges
+	Sym from_taz, to_taz;
 public:
 	// ID of the trip
 	string ID; 
@@ -26,70 +34,231 @@ public:
 	int DepartTime; 
 
 	// TAZ of the origin
-	string FromTAZ; 
+	const string& FromTAZ() const noexcept { return Symbols::Name(from_taz); }
+	void SetFromTAZ(const string& taz) { from_taz = Symbols::Intern(taz); }
 
 	// TAZ of the destination
-	string ToTAZ;	
+	const string& ToTAZ() const noexcept { return Symbols::Name(to_taz); }
+	void SetToTAZ(const string& taz) { to_taz = Symbols::Intern(taz); }
 
 	// Edges covered in the trip. 
 	// It is possible that only origin edge and destination edge instead of all the edges passed throguh are included.
-	vector<string>& Route() noexcept { return route; }
+	vector<string> Route() const;
+	const vector<Sym>& RouteSyms() const noexcept { return route; }
+
+	const string& FromEdge() const noexcept { return Symbols::Name(route.front()); }
+	Sym FromEdgeSym() const noexcept { return route.front(); }
 
-	const string& FromEdge() const noexcept { return route.front(); }
+	const string& ToEdge() const noexcept { return Symbols::Name(route.back()); }
+	Sym ToEdgeSym() const noexcept { return route.back(); }
 
-	const string& ToEdge() const noexcept { return route.back(); }
 	// Whether the route is fixed. Do not fix the route if it only contains the origin edge and destination edge.
 	bool FixedRoute;
 
 	Trip(const string& id, int dpt_time, const string& fTAZ, const string& tTAZ, const vector<string>& route, bool auto_detect_fixed_route = true, bool fixed_route = false) noexcept;
 	Trip(const string& id, int dpt_time, const string& fTAZ, const string& tTAZ, const string& route, bool auto_detect_fixed_route = true, bool fixed_route = false);
 	Trip(const tinyxml2::XMLElement* e);
+	// Copy of trip k of a store
+	Trip(const TripStore& store, size_t k);
+
+	const string __repr__() const {
+		return std::format("{}->{}@{}", ToEdge(), FromEdge(), DepartTime);
+	}
+};
+
+// Record of a trip in a TripStore. The ID and the route are kept by the store.
+struct TripRec {
+	Sym from_taz, to_taz, from_edge, to_edge; // Interned ids
+
+	// Time of departure
+	int DepartTime;
+
+	// Index of the origin and destination edges in the roadnet, -1 if not found. Set by V2SimCore::Start().
+	int FromEdgeIdx = -1, ToEdgeIdx = -1;
+
+	// Whether the route is fixed
+	bool FixedRoute;
+
+	const string& FromTAZ() const noexcept { return Symbols::Name(from_taz); }
+	const string& ToTAZ() const noexcept { return Symbols::Name(to_taz); }
+	const string& FromEdge() const noexcept { return Symbols::Name(from_edge); }
+	Sym FromEdgeSym() const noexcept { return from_edge; }
+	const string& ToEdge() const noexcept { return Symbols::Name(to_edge); }
+	Sym ToEdgeSym() const noexcept { return to_edge; }
 
 	const string __repr__() const {
 		return std::format("{}->{}@{}", ToEdge(), FromEdge(), DepartTime);
 	}
 };
 
-// PcNominal, BattCap, SoC -> RealPc
-using BattCorrFunc = function<double(double, double, double)>;
+// Trips of a fleet in flat arrays: one record per trip, and the edges of all the routes in one
+// array indexed by offsets (CSR), so that loading allocates nothing per trip.
+class TripStore {
+private:
+	vector<TripRec> recs;
+	vector<uint32_t> edge0 = { 0 }; // Route of trip k is edges[edge0[k] .. edge0[k + 1])
+	vector<Sym> edges;
+	vector<uint32_t> id0 = { 0 }; // ID of trip k is ids[id0[k] .. id0[k + 1]). IDs are unique, so they are not interned.
+	vector<char> ids;
+
+	size_t push(const TripRec& r, string_view id, span<const Sym> route);
+public:
+	size_t size() const { return recs.size(); }
+	TripRec& operator[](size_t k) { return recs[k]; }
+	const TripRec& operator[](size_t k) const { return recs[k]; }
+	span<const Sym> Route(size_t k) const {
+		return span<const Sym>(edges.data() + edge0[k], edges.data() + edge0[k + 1]);
+	}
+	string_view ID(size_t k) const {
+		return string_view(ids.data() + id0[k], id0[k + 1] - id0[k]);
+	}
+
+	// Append a trip and return its index
+	size_t Add(const Trip& t);
+	// Append trip k of src and return its index
+	size_t Add(const TripStore& src, size_t k);
+	// Parse a trip element, append it and return its index
+	size_t Add(const tinyxml2::XMLElement* e);
+	void Reserve(size_t trips, size_t edges);
+	void Clear();
+};
 
-class BattCorrFuncPool {
+// Fields of EVs updated in every step, kept as a structure of arrays so that the batch kernels
+// of EVMap stream through contiguous memory. Slot i holds the fields of one EV.
+struct EVStateStore {
+	vector<double> BattElec, BattCap, Consumption, EtaC, Distance, Cost;
+	vector<double> Pc; // Real charging power, kWh/s
+	vector<VehStatus> Status;
+	vector<int> TargetCS;
+	vector<int> DriveTime; // Time of the last drive
+	vector<int> Model; // Index in BattCorrFuncPool
+
+	size_t size() const { return BattElec.size(); }
+	// Append a slot with the default values and return its index
+	size_t Push();
+	// Copy slot j of src to slot i
+	void CopySlot(size_t i, const EVStateStore& src, size_t j);
+	void Reserve(size_t n);
+	void Clear();
+};
+
+// Slot of an EV in a state store. A standalone EV owns a store of one slot, which is dropped
+// when an EVMap binds the EV to its own store. A copy gets a store of its own, while a move keeps the slot.
+class EVSlot {
 private:
-	static unordered_map<string, BattCorrFunc> _mp;
+	unique_ptr<EVStateStore> own;
 public:
-	static void Add(const string& id, BattCorrFunc bcf) noexcept {
-		BattCorrFuncPool::_mp[id] = bcf;
-	}
-	static BattCorrFunc& Get(const string& id) {
-		const auto it = BattCorrFuncPool::_mp.find(id);
-		if (it == BattCorrFuncPool::_mp.end()) {
-			throw V2SimError(std::format("Battery correction function not found: {}", id));
-		}
-		return it->second;
+	EVStateStore* st;
+	size_t i;
+
+	EVSlot() : own(make_unique<EVStateStore>()), st(own.get()), i(own->Push()) {}
+	// New slot at the end of store
+	EVSlot(EVStateStore* store) : st(store), i(store->Push()) {}
+	EVSlot(const EVSlot& o) : EVSlot() { st->CopySlot(i, *o.st, o.i); }
+	EVSlot(EVSlot&& o) noexcept = default;
+	// Assigning copies the fields into the current slot
+	EVSlot& operator=(const EVSlot& o) {
+		if (st != o.st || i != o.i) st->CopySlot(i, *o.st, o.i);
+		return *this;
+	}
+	EVSlot& operator=(EVSlot&& o) noexcept = default;
+	// Move the fields to slot idx of store, which must exist
+	void Bind(EVStateStore* store, size_t idx) {
+		if (store != st || idx != i) store->CopySlot(idx, *st, i);
+		st = store;
+		i = idx;
+		own.reset();
 	}
 };
 
+// Trips of an EV, a range of a trip store. Like EVSlot, a standalone EV owns a store of its own trips,
+// which are appended to the store of an EVMap when it is added there.
+class EVTrips {
+private:
+	unique_ptr<TripStore> own;
+public:
+	TripStore* st;
+	uint32_t first = 0, count = 0;
+
+	EVTrips() : own(make_unique<TripStore>()), st(own.get()) {}
+	// Trips to be appended to the end of store
+	EVTrips(TripStore* store) : st(store), first((uint32_t)store->size()) {}
+	EVTrips(const EVTrips& o) : EVTrips() { 
+		for (uint32_t k = 0; k < o.count; ++k) st->Add(*o.st, o.first + k);
+		count = o.count;
+	}
+	EVTrips(EVTrips&& o) noexcept = default;
+	EVTrips& operator=(const EVTrips& o) {
+		if (this != &o) *this = EVTrips(o);
+		return *this;
+	}
+	EVTrips& operator=(EVTrips&& o) noexcept = default;
+
+	// Append a trip, which must go to the end of the store
+	void Add(const Trip& t) {
+		st->Add(t);
+		++count;
+	}
+	void Add(const tinyxml2::XMLElement* e) {
+		st->Add(e);
+		++count;
+	}
+	// Append the trips to store if they are not there
+	void Bind(TripStore* store) {
+		if (store == st) return;
+		uint32_t k0 = (uint32_t)store->size();
+		for (uint32_t k = 0; k < count; ++k) store->Add(*st, first + k);
+		Attach(store, k0);
+	}
+	// Take the trips at first of store, which hold the same trips
+	void Attach(TripStore* store, uint32_t first) {
+		st = store;
+		this->first = first;
+		own.reset();
+	}
+};
 
 class EV {
 private:
+	friend class EVMap;
 	int trip_idx = 0;
-	vector<Trip> trips;
-	double pc = 0.0; //kWh/s
-	BattCorrFunc rmod;
-	int lastTime = -1;
+	EVTrips trips;
+	EVSlot slot;
+
+	// Real charging power, kWh/s
+	double& pc() { return slot.st->Pc[slot.i]; }
+	double pc() const { return slot.st->Pc[slot.i]; }
+	const ChargeModel& model() const { return BattCorrFuncPool::Model(slot.st->Model[slot.i]); }
+
+	// Read the attributes and trips of a vehicle element
+	void load(tinyxml2::XMLElement* e);
+
+	// Set the battery level to elec capped by BattCap and pay for the difference
+	double chargeTo(double elec, double unit_cost, double pc_nominal_kWhps) {
+		double d_elec = min(elec, BattCap()) - BattElec();
+		BattElec() += d_elec;
+		pc() = model().Pc(pc_nominal_kWhps, BattCap(), SoC());
+		Cost() += (d_elec / EtaC()) * unit_cost;
+		return d_elec;
+	}
 
 public:
 	string ID;
-	VehStatus Status = VehStatus::Parking;
-	int TargetCS = -1;
-	double Cost = 0.0;
+	VehStatus& Status() { return slot.st->Status[slot.i]; }
+	VehStatus Status() const { return slot.st->Status[slot.i]; }
+	int& TargetCS() { return slot.st->TargetCS[slot.i]; }
+	int TargetCS() const { return slot.st->TargetCS[slot.i]; }
+	double& Cost() { return slot.st->Cost[slot.i]; }
+	double Cost() const { return slot.st->Cost[slot.i]; }
 	double Revenue = 0.0;
 
 	//Battery capacity, kWh
-	double BattCap;
+	double& BattCap() { return slot.st->BattCap[slot.i]; }
+	double BattCap() const { return slot.st->BattCap[slot.i]; }
 
 	//Current electricity in the battery, kWh
-	double BattElec;
+	double& BattElec() { return slot.st->BattElec[slot.i]; }
+	double BattElec() const { return slot.st->BattElec[slot.i]; }
 
 	//Fast charging power, kWh/s
 	double PcFast;			
@@ -100,7 +269,8 @@ public:
 	double PcSlow_kW() const { return PcSlow * 3.6e3; }
 
 	//Charging efficiency
-	double EtaC;
+	double& EtaC() { return slot.st->EtaC[slot.i]; }
+	double EtaC() const { return slot.st->EtaC[slot.i]; }
 
 	//V2G discharging power, kWh/s
 	double PdV2G;			
@@ -110,14 +280,17 @@ public:
 	double EtaD;
 
 	//Electricity consumed for each meter driven, kWh/m
-	double Consumption;
+	double& Consumption() { return slot.st->Consumption[slot.i]; }
+	double Consumption() const { return slot.st->Consumption[slot.i]; }
 
 	double Omega;
 	double KRel;
 	double KFast;
 	double KSlow;
 	double KV2G;
-	double Distance = 0.0;	//Distance drived since the beginning of the trip.
+	//Distance drived since the beginning of the trip.
+	double& Distance() { return slot.st->Distance[slot.i]; }
+	double Distance() const { return slot.st->Distance[slot.i]; }
 	RangeList SlowChargeTime;
 	double MaxSlowChargeCost;
 	RangeList V2GTime;
@@ -130,25 +303,24 @@ public:
 		double min_v2g_revenue, bool cache_route);
 
 	EV(tinyxml2::XMLElement* e);
+	// Load an EV into the slot at the end of st, appending its trips to ts
+	EV(tinyxml2::XMLElement* e, EVStateStore* st, TripStore* ts);
 	
-	void ClearPc() { pc = 0.0; }
-
-	// Trips
-	vector<Trip>& Trips() { return trips; }
+	void ClearPc() { pc() = 0.0; }
 
 	// State of charge
-	double SoC() const { return BattElec / BattCap; }
+	double SoC() const { return BattElec() / BattCap(); }
 
 	// Current Real Pc
-	double Pc() const { return pc; }
+	double Pc() const { return pc(); }
 
 	// Current Real Pc in kW
-	double Pc_kW() const { return pc * 3600.0; }
+	double Pc_kW() const { return pc() * 3600.0; }
 
 	// Time required to complete charging at the current charge level, target charge level and charging rate
 	double EstChargeTime() const {
-		if (pc > 0) {
-			return max((BattCap - BattElec) / pc, 0.0);
+		if (pc() > 0) {
+			return max((BattCap() - BattElec()) / pc(), 0.0);
 		}
 		else {
 			return -1;
@@ -157,35 +329,86 @@ public:
 
 	// Drive till the new distance (m)
 	void Drive(double new_dist, int ctime) {
-		if (new_dist < Distance - 1) {
-			throw V2SimError(std::format("EV {}: Current distance {} @ {} > new distance {} @ {}, cur_trip = {}", ID, Distance, lastTime, new_dist, ctime, TripID()));
+		if (new_dist < Distance() - 1) {
+			throw V2SimError(std::format("EV {}: Current distance {} @ {} > new distance {} @ {}, cur_trip = {}", ID, Distance(), slot.st->DriveTime[slot.i], new_dist, ctime, TripID()));
 		}
-		BattElec -= (new_dist - Distance) * Consumption;
-		Distance = new_dist;
-		lastTime = ctime;
+		BattElec() -= (new_dist - Distance()) * Consumption();
+		Distance() = new_dist;
+		slot.st->DriveTime[slot.i] = ctime;
 	}
 	
+	// Longest period charged at one corrected power. Longer charges follow the SoC in sub-steps.
+	static constexpr int CHARGE_SUBSTEP = 60;
+
+	// Whether the battery level under a constant nominal power follows a closed form
+	bool AnalyticCharge() const { return model().Analytic(); }
+
+	// Battery level (kWh) after charging from elec for t seconds at the given nominal power, 
+	// not capped by BattCap. Only valid if AnalyticCharge().
+	double ElecAfter(double elec, double t, double pc_nominal_kWhps) const;
+
+	// Battery level (kWh) up to which the charging rate stays at the nominal power. Only valid if AnalyticCharge().
+	double ConstRateLimit() const;
+
+	// Seconds to charge from elec to target (kWh) at the given nominal power, 0 if it is already there,
+	// or infinity if it never will. Only valid if AnalyticCharge().
+	double TimeBetween(double elec, double target, double pc_nominal_kWhps) const;
+
+	// Charge for t seconds by the closed form of the correction function, return electricity charged (kWh).
+	// Only valid if AnalyticCharge().
+	double ChargeExact(double t, double unit_cost, double pc_nominal_kWhps) {
+		return chargeTo(ElecAfter(BattElec(), t, pc_nominal_kWhps), unit_cost, pc_nominal_kWhps);
+	}
+
+	// Charge to at least elec (kWh), capped by BattCap, return electricity charged (kWh)
+	double ChargeUntil(double elec, double unit_cost, double pc_nominal_kWhps) {
+		return chargeTo(max(BattElec(), elec), unit_cost, pc_nominal_kWhps);
+	}
+
 	//Charge for t seconds, return electricity charged (kWh)
 	double Charge(int t, double unit_cost, double pc_nominal_kWhps) {
-		double elec = BattElec;
-		pc = rmod(pc_nominal_kWhps, BattCap, SoC());
-		BattElec += pc * t * EtaC;
-		if (BattElec > BattCap) {
-			BattElec = BattCap;
+		if (AnalyticCharge()) {
+			return ChargeExact(t, unit_cost, pc_nominal_kWhps);
+		}
+		double elec = BattElec();
+		int left = t;
+		do {
+			int dt = min(left, CHARGE_SUBSTEP);
+			pc() = model().Pc(pc_nominal_kWhps, BattCap(), SoC());
+			BattElec() += pc() * dt * EtaC();
+			left -= dt;
+		} while (left > 0 && BattElec() < BattCap());
+		if (BattElec() > BattCap()) {
+			BattElec() = BattCap();
 		}
-		double d_elec = BattElec - elec;
-		Cost += (d_elec / EtaC) * unit_cost;
+		double d_elec = BattElec() - elec;
+		Cost() += (d_elec / EtaC()) * unit_cost;
 		return d_elec;
 	}
 
+	// Seconds until the battery reaches elec (kWh) when charged at the given nominal power at the current SoC,
+	// 0 if it is already there, or INT_MAX if it never will
+	int ChargeTimeTo(double elec, double pc_nominal_kWhps) const {
+		if (BattElec() >= elec) return 0;
+		double t;
+		if (AnalyticCharge()) {
+			t = ceil(TimeBetween(BattElec(), elec, pc_nominal_kWhps));
+		}
+		else {
+			double rate = model().Pc(pc_nominal_kWhps, BattCap(), SoC()) * EtaC();
+			t = rate > 0 ? ceil((elec - BattElec()) / rate) : INFINITY;
+		}
+		return t < numeric_limits<int>::max() ? (int)t : numeric_limits<int>::max();
+	}
+
 	//Discharge for t seconds
 	double Discharge(double k, int t, double unit_revenue) {
-		double elec = BattElec;
-		BattElec -= PdV2G * t * k;
+		double elec = BattElec();
+		BattElec() -= PdV2G * t * k;
 		if (SoC() <= KV2G) {
-			BattElec = BattCap * KV2G;
+			BattElec() = BattCap() * KV2G;
 		}
-		double d_elec = (elec - BattElec) * EtaD;
+		double d_elec = (elec - BattElec()) * EtaD;
 		Revenue += d_elec * unit_revenue;
 		return d_elec;
 	}
@@ -200,16 +423,31 @@ public:
 		return SoC() < KSlow && cost <= MaxSlowChargeCost && SlowChargeTime.Contains(t);
 	}
 
-	const Trip& CurrentTrip() const {
-		return trips.at(trip_idx);
+	const TripRec& CurrentTrip() const {
+		return TripAt(trip_idx);
+	}
+
+	const TripRec& TripAt(int idx) const {
+		if (idx < 0 || (uint32_t)idx >= trips.count) {
+			throw out_of_range(std::format("EV {}: trip {} out of range", ID, idx));
+		}
+		return (*trips.st)[trips.first + idx];
+	}
+
+	// Edges of the route of a trip
+	span<const Sym> TripRoute(int idx) const {
+		TripAt(idx);
+		return trips.st->Route(trips.first + idx);
 	}
 
-	const Trip& TripAt(int idx) const {
-		return trips.at(idx);
+	// Standalone copy of a trip
+	Trip TripCopy(int idx) const {
+		TripAt(idx);
+		return Trip(*trips.st, trips.first + idx);
 	}
 
 	const size_t TripsCount() const {
-		return trips.size();
+		return trips.count;
 	}
 
 	const int TripID() const {
@@ -217,14 +455,14 @@ public:
 	}
 
 	int NextTrip() {
-		if (trip_idx == trips.size() - 1) {
+		if (trip_idx == (int)trips.count - 1) {
 			return -1;
 		}
 		return ++trip_idx;
 	}
 
 	double MaxMileage() const {
-		return BattElec / Consumption;
+		return BattElec() / Consumption();
 	}
 
 	bool IsBattEnough(double dist) const {
@@ -238,7 +476,10 @@ public:
 
 class EVMap {
 	vector<EV> evs;
-	unordered_map<string, size_t> mp;
+	EVStateStore st;
+	TripStore trips;
+	vector<uint32_t> trip0; // First trip of each vid in trips
+	vector<int> bysym; // Symbol of the vehicle ID -> vid, -1 if none
 	EVMap(EVMap&) = delete;
 	EVMap& operator=(EVMap&) = delete;
 	void load(const char* filename);
@@ -275,25 +516,49 @@ public:
 		return evs[IndexOf(s)];
 	}
 	size_t IndexOf(const string& s) const {
-		auto it = mp.find(s);
-		if (it == mp.end()) {
+		int i = Find(Symbols::Find(s));
+		if (i < 0) {
 			throw V2SimError(std::format("Vehicle {} not found.", s));
 		}
-		return it->second;
+		return i;
 	}
-	void Add(const EV& v) {
-		mp[v.ID] = evs.size();
-		evs.push_back(v);
+	// vid of the vehicle whose ID has the given symbol, or -1 if none
+	int Find(Sym s) const {
+		return s < bysym.size() ? bysym[s] : -1;
 	}
-	void Add(EV&& v) {
-		mp[v.ID] = evs.size();
-		evs.push_back(v);
+	void Add(const EV& v) {
+		Add(EV(v));
 	}
+	void Add(EV&& v);
 	void Clear() {
-		mp.clear();
+		bysym.clear();
 		evs.clear();
+		st.Clear();
+		trips.Clear();
+		trip0.clear();
 	}
-	size_t size() {
+	size_t size() const {
 		return evs.size();
 	}
+	// Fields of all the EVs updated in every step, indexed by vid
+	const EVStateStore& States() const {
+		return st;
+	}
+	// Trips of all the EVs, those of each EV in a contiguous range
+	TripStore& Trips() {
+		return trips;
+	}
+	const TripStore& Trips() const {
+		return trips;
+	}
+
+	// Drive the EVs in vids till the new distances dist (m), as EV::Drive does for each of them.
+	// The readings are checked before any EV is moved. vids must not repeat.
+	void DriveBatch(span<const int> vids, span<const double> dist, int ctime);
+
+	// Charge the EVs in vids for t seconds at the nominal powers pc_nominal (kWh/s) and the unit costs,
+	// as EV::Charge does for each of them, and write the electricity charged (kWh) to d_elec.
+	// The EVs are grouped by model, and each group with a built-in curve is charged in one kernel
+	// of that curve. EVs with custom functions are charged one by one. vids must not repeat.
+	void ChargeBatch(span<const int> vids, int t, span<const double> pc_nominal, span<const double> unit_cost, span<double> d_elec);
 };
\ No newline at end of file
@@ -0,0 +1,414 @@
+#include <algorithm>
+#include "hierarchy.h"
+
+constexpr uint32_t HIERARCHY_MAGIC = 0x32484843; // "CHC2": links follow the lane permissions
+
+int RouteHierarchy::arcIndex(int u, int w) const {
+	auto b = up_to.begin() + up_off[u], e = up_to.begin() + up_off[u + 1];
+	auto it = lower_bound(b, e, rank[w], [this](int x, int r) { return rank[x] < r; });
+	if (it == e || *it != w) {
+		throw V2SimError(std::format("Hierarchy has no arc between edges {} and {}.", u, w));
+	}
+	return (int)(it - up_to.begin());
+}
+
+// Nested dissection order of the nodes in part: both halves first, then the separator between them.
+// Halves are split at the thinnest middle BFS level from a pseudo-peripheral node.
+static void dissect(const vector<vector<int>>& adj, vector<int>& part, vector<int>& owner, int& next_id,
+	vector<int>& level, vector<int>& order) {
+	if (part.size() <= 32) {
+		order.insert(order.end(), part.begin(), part.end());
+		return;
+	}
+	int id = ++next_id;
+	for (int v : part) {
+		owner[v] = id;
+	}
+	vector<int> q;
+	auto bfs = [&](int s) {
+		for (int v : part) level[v] = -1;
+		q.clear();
+		q.push_back(s);
+		level[s] = 0;
+		for (size_t h = 0; h < q.size(); ++h) {
+			int v = q[h];
+			for (int w : adj[v]) {
+				if (owner[w] == id && level[w] < 0) {
+					level[w] = level[v] + 1;
+					q.push_back(w);
+				}
+			}
+		}
+	};
+	bfs(part[0]);
+	vector<int> a, b, sep;
+	if (q.size() < part.size()) {
+		// Disconnected: one component and the rest
+		for (int v : part) {
+			(level[v] >= 0 ? a : b).push_back(v);
+		}
+	}
+	else {
+		// Only the nodes of the cut level adjacent to the next level separate the halves.
+		// Both ends of a pseudo-diameter are tried as the BFS root.
+		size_t m = part.size();
+		auto choose = [&](int& cut, size_t& best) {
+			int depth = level[q.back()] + 1;
+			vector<size_t> cnt(depth, 0), bnd(depth, 0);
+			for (int v : q) {
+				++cnt[level[v]];
+				for (int w : adj[v]) {
+					if (owner[w] == id && level[w] > level[v]) {
+						++bnd[level[v]];
+						break;
+					}
+				}
+			}
+			size_t before = 0;
+			for (int l = 0; l < depth; ++l) {
+				if (before * 3 >= m && (before + cnt[l]) * 3 <= 2 * m && bnd[l] < best) {
+					best = bnd[l];
+					cut = l;
+				}
+				before += cnt[l];
+			}
+			if (cut < 0) {
+				// No level in the middle third: cut at the median level
+				before = 0;
+				for (cut = 0; before + cnt[cut] <= m / 2; ++cut) {
+					before += cnt[cut];
+				}
+				best = bnd[cut];
+			}
+		};
+		int r1 = q.back();
+		bfs(r1);
+		int r2 = q.back();
+		int cut1 = -1, cut2 = -1;
+		size_t best1 = SIZE_MAX, best2 = SIZE_MAX;
+		choose(cut1, best1);
+		bfs(r2);
+		choose(cut2, best2);
+		int cut = cut2;
+		if (best1 < best2) {
+			bfs(r1);
+			cut = cut1;
+		}
+		for (int v : part) {
+			if (level[v] < cut) {
+				a.push_back(v);
+			}
+			else if (level[v] > cut) {
+				b.push_back(v);
+			}
+			else {
+				bool boundary = false;
+				for (int w : adj[v]) {
+					if (owner[w] == id && level[w] > cut) {
+						boundary = true;
+						break;
+					}
+				}
+				(boundary ? sep : a).push_back(v);
+			}
+		}
+		if (a.empty() || b.empty()) {
+			order.insert(order.end(), part.begin(), part.end());
+			return;
+		}
+	}
+	part.clear();
+	part.shrink_to_fit();
+	dissect(adj, a, owner, next_id, level, order);
+	dissect(adj, b, owner, next_id, level, order);
+	order.insert(order.end(), sep.begin(), sep.end());
+}
+
+void RouteHierarchy::Build(const RoadNet& net) {
+	n = net.size();
+	vector<vector<int>> adj(n);
+	for (int v = 0; v < (int)n; ++v) {
+		for (int w : net.Successors(v)) {
+			if (w != v) {
+				adj[v].push_back(w);
+				adj[w].push_back(v);
+			}
+		}
+	}
+	for (auto& x : adj) {
+		sort(x.begin(), x.end());
+		x.erase(unique(x.begin(), x.end()), x.end());
+	}
+
+	vector<int> order, part(n), owner(n, 0), level(n, -1);
+	order.reserve(n);
+	for (int v = 0; v < (int)n; ++v) {
+		part[v] = v;
+	}
+	int next_id = 0;
+	dissect(adj, part, owner, next_id, level, order);
+	rank.assign(n, 0);
+	for (int i = 0; i < (int)n; ++i) {
+		rank[order[i]] = i;
+	}
+
+	// Contracting v turns its higher neighbors into a clique. The clique is passed on to the 
+	// lowest of them, which is contracted next among them.
+	vector<vector<int>> up(n);
+	for (int v = 0; v < (int)n; ++v) {
+		for (int w : adj[v]) {
+			if (rank[w] > rank[v]) up[v].push_back(w);
+		}
+	}
+	adj.clear();
+	auto by_rank = [this](int x, int y) { return rank[x] < rank[y]; };
+	for (int v : order) {
+		auto& u = up[v];
+		sort(u.begin(), u.end(), by_rank);
+		u.erase(unique(u.begin(), u.end()), u.end());
+		if (u.size() > 1) {
+			up[u[0]].insert(up[u[0]].end(), u.begin() + 1, u.end());
+		}
+	}
+
+	up_off.assign(n + 1, 0);
+	for (size_t v = 0; v < n; ++v) {
+		up_off[v + 1] = up_off[v] + (int)up[v].size();
+	}
+	up_to.resize(up_off[n]);
+	for (size_t v = 0; v < n; ++v) {
+		copy(up[v].begin(), up[v].end(), up_to.begin() + up_off[v]);
+	}
+	link();
+}
+
+void RouteHierarchy::link() {
+	parent.assign(n, -1);
+	for (size_t v = 0; v < n; ++v) {
+		if (up_off[v] < up_off[v + 1]) {
+			parent[v] = up_to[up_off[v]];
+		}
+	}
+	dt.assign(n, 0);
+	dl.assign(n, 0);
+	seen.assign(n, 0);
+	stamp = 0;
+	fw.clear();
+	bw.clear();
+	fl.clear();
+	bl.clear();
+}
+
+bool RouteHierarchy::Load(const string& filename, uint64_t key, const RoadNet& net) {
+	FILE* fh = nullptr;
+	if (fopen_s(&fh, filename.c_str(), "rb") != 0) {
+		return false;
+	}
+	uint32_t magic = 0;
+	uint64_t fkey = 0, fn = 0, fm = 0;
+	bool ok = fread(&magic, sizeof(magic), 1, fh) == 1 && magic == HIERARCHY_MAGIC &&
+		fread(&fkey, sizeof(fkey), 1, fh) == 1 && fkey == key &&
+		fread(&fn, sizeof(fn), 1, fh) == 1 && fn == net.size() &&
+		fread(&fm, sizeof(fm), 1, fh) == 1;
+	if (ok) {
+		rank.resize(fn);
+		up_off.resize(fn + 1);
+		up_to.resize(fm);
+		ok = fread(rank.data(), sizeof(int), rank.size(), fh) == rank.size() &&
+			fread(up_off.data(), sizeof(int), up_off.size(), fh) == up_off.size() &&
+			fread(up_to.data(), sizeof(int), up_to.size(), fh) == up_to.size() &&
+			up_off[fn] == (int)fm;
+	}
+	fclose(fh);
+	if (ok) {
+		n = fn;
+		link();
+	}
+	else {
+		n = 0;
+		rank.clear();
+		up_off.clear();
+		up_to.clear();
+	}
+	return ok;
+}
+
+bool RouteHierarchy::Save(const string& filename, uint64_t key) const {
+	FILE* fh = nullptr;
+	if (fopen_s(&fh, filename.c_str(), "wb") != 0) {
+		return false;
+	}
+	uint64_t fn = n, fm = up_to.size();
+	bool ok = fwrite(&HIERARCHY_MAGIC, sizeof(HIERARCHY_MAGIC), 1, fh) == 1 &&
+		fwrite(&key, sizeof(key), 1, fh) == 1 &&
+		fwrite(&fn, sizeof(fn), 1, fh) == 1 &&
+		fwrite(&fm, sizeof(fm), 1, fh) == 1 &&
+		fwrite(rank.data(), sizeof(int), rank.size(), fh) == rank.size() &&
+		fwrite(up_off.data(), sizeof(int), up_off.size(), fh) == up_off.size() &&
+		fwrite(up_to.data(), sizeof(int), up_to.size(), fh) == up_to.size();
+	ok = fclose(fh) == 0 && ok;
+	if (!ok) {
+		remove(filename.c_str());
+	}
+	return ok;
+}
+
+void RouteHierarchy::Customize(const RoadNet& net, span<const double> tt) {
+	if (n == 0) {
+		throw V2SimError("Hierarchy is not built.");
+	}
+	if (tt.size() != n) {
+		throw V2SimError(std::format("Travel time vector has {} items, but the hierarchy has {} edges.", tt.size(), n));
+	}
+	constexpr double inf = numeric_limits<double>::infinity();
+	size_t m = up_to.size();
+	fw.assign(m, inf);
+	bw.assign(m, inf);
+	fl.assign(m, inf);
+	bl.assign(m, inf);
+	node_tt.assign(tt.begin(), tt.end());
+	node_len.resize(n);
+
+	// Moving from edge v onto edge w costs the whole of edge w
+	for (int v = 0; v < (int)n; ++v) {
+		node_len[v] = net.Length(v);
+		for (int w : net.Successors(v)) {
+			if (w == v) continue;
+			if (rank[v] < rank[w]) {
+				int a = arcIndex(v, w);
+				if (tt[w] < fw[a]) {
+					fw[a] = tt[w];
+					fl[a] = net.Length(w);
+				}
+			}
+			else {
+				int a = arcIndex(w, v);
+				if (tt[w] < bw[a]) {
+					bw[a] = tt[w];
+					bl[a] = net.Length(w);
+				}
+			}
+		}
+	}
+
+	// Relax every lower triangle u - v - w with v below u and w, in ascending rank of v
+	vector<int> order(n);
+	for (int v = 0; v < (int)n; ++v) {
+		order[rank[v]] = v;
+	}
+	for (int v : order) {
+		int b = up_off[v], e = up_off[v + 1];
+		for (int i = b; i < e; ++i) {
+			int u = up_to[i];
+			// The higher neighbors of v after u are a subsequence of those of u, so one merge finds their arcs
+			int a = up_off[u];
+			for (int j = i + 1; j < e; ++j) {
+				int w = up_to[j];
+				while (up_to[a] != w) ++a;
+				// u -> v -> w and w -> v -> u
+				double t = bw[i] + fw[j];
+				if (t < fw[a]) {
+					fw[a] = t;
+					fl[a] = bl[i] + fl[j];
+				}
+				t = bw[j] + fw[i];
+				if (t < bw[a]) {
+					bw[a] = t;
+					bl[a] = bl[j] + fl[i];
+				}
+			}
+		}
+	}
+	buildBuckets();
+}
+
+unsigned RouteHierarchy::newWalk() {
+	if (++stamp == 0) {
+		fill(seen.begin(), seen.end(), 0);
+		stamp = 1;
+	}
+	return stamp;
+}
+
+void RouteHierarchy::SetTargets(span<const int> target_edges) {
+	targets.assign(target_edges.begin(), target_edges.end());
+	if (Built()) {
+		buildBuckets();
+	}
+}
+
+void RouteHierarchy::buildBuckets() {
+	// Backward upward walk from each target: the distance from each ancestor to the target
+	vector<tuple<int, int, double, double>> items; // ancestor, target index, travel time, length
+	int cnt = (int)targets.size();
+	for (int i = 0; i < cnt; ++i) {
+		int t = targets[i];
+		if (t < 0) continue;
+		unsigned s = newWalk();
+		seen[t] = s;
+		dt[t] = 0;
+		dl[t] = 0;
+		for (int v = t; v >= 0; v = parent[v]) {
+			if (seen[v] != s) continue;
+			items.emplace_back(v, i, dt[v], dl[v]);
+			for (int a = up_off[v]; a < up_off[v + 1]; ++a) {
+				int u = up_to[a];
+				double c = dt[v] + bw[a];
+				if (seen[u] != s || c < dt[u]) {
+					seen[u] = s;
+					dt[u] = c;
+					dl[u] = dl[v] + bl[a];
+				}
+			}
+		}
+	}
+	bucket_off.assign(n + 1, 0);
+	for (auto& it : items) {
+		++bucket_off[get<0>(it) + 1];
+	}
+	for (size_t v = 0; v < n; ++v) {
+		bucket_off[v + 1] += bucket_off[v];
+	}
+	bucket.resize(items.size());
+	vector<int> pos(bucket_off.begin(), bucket_off.end() - 1);
+	for (auto& [v, i, t, l] : items) {
+		bucket[pos[v]++] = { i, t, l };
+	}
+}
+
+void RouteHierarchy::Query(int from, span<RouteCost> out) {
+	if (!Built()) {
+		throw V2SimError("Hierarchy is not customized.");
+	}
+	if (from < 0 || from >= (int)n) {
+		throw V2SimError(std::format("Invalid origin edge index {}.", from));
+	}
+	if (out.size() < targets.size()) {
+		throw V2SimError(std::format("Output buffer too small: {} < {}", out.size(), targets.size()));
+	}
+	constexpr double inf = numeric_limits<double>::infinity();
+	fill(out.begin(), out.begin() + targets.size(), RouteCost{ inf, inf });
+	unsigned s = newWalk();
+	seen[from] = s;
+	dt[from] = node_tt[from];
+	dl[from] = node_len[from];
+	for (int v = from; v >= 0; v = parent[v]) {
+		if (seen[v] != s) continue;
+		for (int b = bucket_off[v]; b < bucket_off[v + 1]; ++b) {
+			auto& [i, t, l] = bucket[b];
+			double c = dt[v] + t;
+			if (c < out[i].travelTime) {
+				out[i] = { dl[v] + l, c };
+			}
+		}
+		for (int a = up_off[v]; a < up_off[v + 1]; ++a) {
+			int u = up_to[a];
+			double c = dt[v] + fw[a];
+			if (seen[u] != s || c < dt[u]) {
+				seen[u] = s;
+				dt[u] = c;
+				dl[u] = dl[v] + fl[a];
+			}
+		}
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <tuple>
+#include "router.h"
+
+// Customizable contraction hierarchy over the edges of a RoadNet, answering edge -> target queries 
+// for a fixed set of target edges (the FCS) in the time of one upward walk.
+// Preprocessing contracts the edges in a nested dissection order, splitting the network at thin BFS
+// levels and contracting the separators last, and inserts every shortcut,
+// so the hierarchy depends only on the topology and can be cached on disk keyed by the roadnet file.
+// Customize() then computes the shortcut weights for any travel times, so refreshed travel times
+// never invalidate the cache. Costs follow the same convention as Router.
+class RouteHierarchy {
+private:
+	size_t n = 0;
+	vector<int> rank; // Contraction rank of each edge
+	vector<int> up_off, up_to; // Higher neighbors of edge v are up_to[up_off[v], up_off[v + 1]), ascending by rank
+	vector<int> parent; // Lowest higher neighbor, the parent in the elimination tree, or -1
+
+	// Weights of arc a from v to up_to[a] (fw) and back (bw): travel time and length
+	vector<double> fw, bw, fl, bl;
+	vector<double> node_tt, node_len; // Cost of the origin edge itself
+
+	vector<int> targets;
+	vector<int> bucket_off; // Backward distances from the ancestors of each target, grouped by ancestor
+	vector<tuple<int, double, double>> bucket; // target index, travel time, length
+
+	vector<double> dt, dl; // Scratch distances of the upward walks
+	vector<unsigned> seen;
+	unsigned stamp = 0;
+
+	int arcIndex(int u, int w) const;
+	void link();
+	void buildBuckets();
+	unsigned newWalk();
+public:
+	RouteHierarchy() {}
+
+	bool Built() const { return n > 0 && !fw.empty(); }
+	size_t size() const { return n; }
+	// Number of arcs, including shortcuts
+	size_t ArcCount() const { return up_to.size(); }
+
+	// Contract the edges of the network. Customize() must be called before queries.
+	void Build(const RoadNet& net);
+
+	// Load the contraction from a binary cache. Return false if the file is missing or stale.
+	bool Load(const string& filename, uint64_t key, const RoadNet& net);
+
+	// Save the contraction to a binary cache. Return false, leaving no file, if it cannot be written.
+	bool Save(const string& filename, uint64_t key) const;
+
+	// Compute the arc weights for travel time tt[e] of each edge e
+	void Customize(const RoadNet& net, span<const double> tt);
+
+	// Set the target edges of Query(). Targets with index -1 are never reached.
+	void SetTargets(span<const int> target_edges);
+
+	// Fastest routes from edge `from` to every target. out[i] receives the cost of target i.
+	void Query(int from, span<RouteCost> out);
+};
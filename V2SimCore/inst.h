@@ -9,11 +9,58 @@ private:
 	SlowCSMap scs;
 	TripsLogger tlog;
 	vector<StatItem*> stats;
+
+	// An EV with the charging at its CS written back up to the last step
+	EV& syncEV(size_t vid) {
+		Sync();
+		fcs.SyncVeh((int)vid) || scs.SyncVeh((int)vid);
+		return evs[vid];
+	}
+	// An EV about to be modified, whose charging is planned again at the next step
+	EV& touchEV(size_t vid) {
+		Sync();
+		fcs.TouchVeh((int)vid) || scs.TouchVeh((int)vid);
+		return evs[vid];
+	}
+	// The SCS after the background update of the last step
+	SlowCSMap& slowCS() { Sync(); return scs; }
+	const SlowCSMap& slowCS() const { Sync(); return scs; }
 public:
 	using V2SimCore::getTime;
 	using V2SimCore::getStartTime;
 	using V2SimCore::getEndTime;
 	using V2SimCore::getStepLength;
+	using V2SimCore::getQueryThreads;
+	using V2SimCore::setQueryThreads;
+	using V2SimCore::getUpdateThreads;
+	using V2SimCore::setUpdateThreads;
+	using V2SimCore::getTimeSkip;
+	using V2SimCore::setTimeSkip;
+	using V2SimCore::getStepMax;
+	using V2SimCore::setStepMax;
+	using V2SimCore::getStatInterval;
+	using V2SimCore::setStatInterval;
+	using V2SimCore::getStepTolerance;
+	using V2SimCore::setStepTolerance;
+	using V2SimCore::getPipeline;
+	using V2SimCore::setPipeline;
+	using V2SimCore::Sync;
+	using V2SimCore::getNetIndexK;
+	using V2SimCore::setNetIndexK;
+	using V2SimCore::getNetIndexCache;
+	using V2SimCore::setNetIndexCache;
+	using V2SimCore::getNativeRouting;
+	using V2SimCore::setNativeRouting;
+	using V2SimCore::getRouteHierarchy;
+	using V2SimCore::setRouteHierarchy;
+	using V2SimCore::getRouteHierarchyCache;
+	using V2SimCore::setRouteHierarchyCache;
+	using V2SimCore::getRouteCacheSize;
+	using V2SimCore::setRouteCacheSize;
+	using V2SimCore::getRouteCacheHits;
+	using V2SimCore::getRouteCacheMisses;
+	using V2SimCore::getRouteRefresh;
+	using V2SimCore::setRouteRefresh;
 	using V2SimCore::Start;
 	using V2SimCore::Stop;
 
@@ -34,13 +81,50 @@ public:
 	}
 
 	void Step(int len = -1) {
+		int prev = getTime();
 		V2SimCore::Step(len);
-		for (StatItem* si : stats) {
-			si->recordItems(*this);
+		if (!statDue(prev, getTime())) {
+			return;
+		}
+		if (any_of(stats.begin(), stats.end(), [](StatItem* si) { return si->ReadsEVs(); })) {
+			// The SCS may still be charging in the background
+			Sync();
+			fcs.SyncAll();
+			scs.SyncAll();
+		}
+		if (!getPipeline()) {
+			for (StatItem* si : stats) {
+				si->recordItems(*this);
+			}
+			return;
 		}
+		// Items not depending on the SCS are read now and all are written in the background
+		vector<vector<double>> items(stats.size());
+		for (size_t i = 0; i < stats.size(); ++i) {
+			if (!stats[i]->ReadsSCS()) {
+				items[i] = stats[i]->getItems(*this);
+			}
+			else if (!stats[i]->ReadsInBackground()) {
+				Sync();
+				items[i] = stats[i]->getItems(*this);
+			}
+		}
+		pipelined([this, t = getTime(), items = std::move(items)]() mutable {
+			for (size_t i = 0; i < stats.size(); ++i) {
+				if (stats[i]->ReadsSCS() && stats[i]->ReadsInBackground()) {
+					items[i] = stats[i]->getItems(*this);
+				}
+				stats[i]->writeItems(t, items[i]);
+			}
+		});
 	}
 
 	~V2SimInterface() {
+		try {
+			Sync();
+		}
+		catch (...) {
+		}
 		for (StatItem* si : stats) {
 			delete si;
 		}
@@ -49,109 +133,109 @@ public:
 	size_t EV_IndexOf(const string& vname) const { return evs.IndexOf(vname); }
 	const string& EV_getName(size_t vid) const { return evs[vid].ID; }
 
-	VehStatus EV_getStatus(size_t vid) const { return evs[vid].Status; }
-	void EV_setStatus(size_t vid, VehStatus status) { evs[vid].Status = status; }
+	VehStatus EV_getStatus(size_t vid) { return syncEV(vid).Status(); }
+	void EV_setStatus(size_t vid, VehStatus status) { touchEV(vid).Status() = status; }
 
-	int EV_getTargetCSIndex(size_t vid) const { return evs[vid].TargetCS; }
-	void EV_setTargetCSIndex(size_t vid, int cs_index) { evs[vid].TargetCS = cs_index; }
+	int EV_getTargetCSIndex(size_t vid) { return syncEV(vid).TargetCS(); }
+	void EV_setTargetCSIndex(size_t vid, int cs_index) { touchEV(vid).TargetCS() = cs_index; }
 
-	double EV_getCost(size_t vid) const { return evs[vid].Cost; }
-	void EV_setCost(size_t vid, double cost) { evs[vid].Cost = cost; }
+	double EV_getCost(size_t vid) { return syncEV(vid).Cost(); }
+	void EV_setCost(size_t vid, double cost) { touchEV(vid).Cost() = cost; }
 
-	double EV_getRevenue(size_t vid) const { return evs[vid].Revenue; }
-	void EV_setRevenue(size_t vid, double revenue) { evs[vid].Revenue = revenue; }
+	double EV_getRevenue(size_t vid) { return syncEV(vid).Revenue; }
+	void EV_setRevenue(size_t vid, double revenue) { touchEV(vid).Revenue = revenue; }
 
-	double EV_getBattCap(size_t vid) const { return evs[vid].BattCap; }
-	void EV_setBattCap(size_t vid, double battcap) { evs[vid].BattCap = battcap; }
+	double EV_getBattCap(size_t vid) { return syncEV(vid).BattCap(); }
+	void EV_setBattCap(size_t vid, double battcap) { touchEV(vid).BattCap() = battcap; }
 
-	double EV_getBattElec(size_t vid) const { return evs[vid].BattElec; }
-	void EV_setBattElec(size_t vid, double battelec) { evs[vid].BattElec = battelec; }
+	double EV_getBattElec(size_t vid) { return syncEV(vid).BattElec(); }
+	void EV_setBattElec(size_t vid, double battelec) { touchEV(vid).BattElec() = battelec; }
 
-	double EV_getPcFast(size_t vid) const { return evs[vid].PcFast; }
-	void EV_setPcFast(size_t vid, double pcf) { evs[vid].PcFast = pcf; }
+	double EV_getPcFast(size_t vid) { return syncEV(vid).PcFast; }
+	void EV_setPcFast(size_t vid, double pcf) { touchEV(vid).PcFast = pcf; }
 
-	double EV_getPcFast_kW(size_t vid) const { return evs[vid].PcFast_kW(); }
-	void EV_setPcFast_kW(size_t vid, double pcf_kW) { evs[vid].PcFast = pcf_kW / 3.6e3; }
+	double EV_getPcFast_kW(size_t vid) { return syncEV(vid).PcFast_kW(); }
+	void EV_setPcFast_kW(size_t vid, double pcf_kW) { touchEV(vid).PcFast = pcf_kW / 3.6e3; }
 
-	double EV_getPcSlow(size_t vid) const { return evs[vid].PcSlow; }
-	void EV_setPcSlow(size_t vid, double pcs) { evs[vid].PcSlow = pcs; }
+	double EV_getPcSlow(size_t vid) { return syncEV(vid).PcSlow; }
+	void EV_setPcSlow(size_t vid, double pcs) { touchEV(vid).PcSlow = pcs; }
 
-	double EV_getPcSlow_kW(size_t vid) const { return evs[vid].PcSlow_kW(); }
-	void EV_setPcSlow_kW(size_t vid, double pcs_kW) { evs[vid].PcSlow = pcs_kW / 3.6e3; }
+	double EV_getPcSlow_kW(size_t vid) { return syncEV(vid).PcSlow_kW(); }
+	void EV_setPcSlow_kW(size_t vid, double pcs_kW) { touchEV(vid).PcSlow = pcs_kW / 3.6e3; }
 
-	double EV_getEtaC(size_t vid) const { return evs[vid].EtaC; }
-	void EV_setEtaC(size_t vid, double etac) { evs[vid].EtaC = etac; }
+	double EV_getEtaC(size_t vid) { return syncEV(vid).EtaC(); }
+	void EV_setEtaC(size_t vid, double etac) { touchEV(vid).EtaC() = etac; }
 
-	double EV_getPdV2G(size_t vid) const { return evs[vid].PdV2G; }
-	void EV_setPdV2G(size_t vid, double pdv2g) { evs[vid].PdV2G = pdv2g; }
+	double EV_getPdV2G(size_t vid) { return syncEV(vid).PdV2G; }
+	void EV_setPdV2G(size_t vid, double pdv2g) { touchEV(vid).PdV2G = pdv2g; }
 
-	double EV_getPdV2G_kW(size_t vid) const { return evs[vid].PdV2G_kW(); }
-	void EV_setPdV2G_kW(size_t vid, double pdv2g_kW) { evs[vid].PdV2G = pdv2g_kW / 3.6e3; }
+	double EV_getPdV2G_kW(size_t vid) { return syncEV(vid).PdV2G_kW(); }
+	void EV_setPdV2G_kW(size_t vid, double pdv2g_kW) { touchEV(vid).PdV2G = pdv2g_kW / 3.6e3; }
 
-	double EV_getEtaD(size_t vid) const { return evs[vid].EtaD; }
-	void EV_setEtaD(size_t vid, double etad) { evs[vid].EtaD = etad; }
+	double EV_getEtaD(size_t vid) { return syncEV(vid).EtaD; }
+	void EV_setEtaD(size_t vid, double etad) { touchEV(vid).EtaD = etad; }
 
-	double EV_getConsumption(size_t vid) const { return evs[vid].Consumption; }
-	void EV_setConsumption(size_t vid, double consumption) { evs[vid].Consumption = consumption; }
+	double EV_getConsumption(size_t vid) { return syncEV(vid).Consumption(); }
+	void EV_setConsumption(size_t vid, double consumption) { touchEV(vid).Consumption() = consumption; }
 
-	double EV_getOmega(size_t vid) const { return evs[vid].Omega; }
-	void EV_setOmega(size_t vid, double omega) { evs[vid].Omega = omega; }
+	double EV_getOmega(size_t vid) { return syncEV(vid).Omega; }
+	void EV_setOmega(size_t vid, double omega) { touchEV(vid).Omega = omega; }
 
-	double EV_getKRel(size_t vid) const { return evs[vid].KRel; }
-	void EV_setKRel(size_t vid, double krel) { evs[vid].KRel = krel; }
+	double EV_getKRel(size_t vid) { return syncEV(vid).KRel; }
+	void EV_setKRel(size_t vid, double krel) { touchEV(vid).KRel = krel; }
 
-	double EV_getKFast(size_t vid) const { return evs[vid].KFast; }
-	void EV_setKFast(size_t vid, double kfast) { evs[vid].KFast = kfast; }
+	double EV_getKFast(size_t vid) { return syncEV(vid).KFast; }
+	void EV_setKFast(size_t vid, double kfast) { touchEV(vid).KFast = kfast; }
 
-	double EV_getKSlow(size_t vid) const { return evs[vid].KSlow; }
-	void EV_setKSlow(size_t vid, double kslow) { evs[vid].KSlow = kslow; }
+	double EV_getKSlow(size_t vid) { return syncEV(vid).KSlow; }
+	void EV_setKSlow(size_t vid, double kslow) { touchEV(vid).KSlow = kslow; }
 
-	double EV_getKV2G(size_t vid) const { return evs[vid].KV2G; }
-	void EV_setKV2G(size_t vid, double kv2g) { evs[vid].KV2G = kv2g; }
+	double EV_getKV2G(size_t vid) { return syncEV(vid).KV2G; }
+	void EV_setKV2G(size_t vid, double kv2g) { touchEV(vid).KV2G = kv2g; }
 
-	double EV_getDistance(size_t vid) const { return evs[vid].Distance; }
-	void EV_setDistance(size_t vid, double distance) { evs[vid].Distance = distance; }
+	double EV_getDistance(size_t vid) { return syncEV(vid).Distance(); }
+	void EV_setDistance(size_t vid, double distance) { touchEV(vid).Distance() = distance; }
 
-	const RangeList& EV_getSlowChargeTime(size_t vid) const { return evs[vid].SlowChargeTime; }
-	void EV_setSlowChargeTime(size_t vid, const RangeList& sct) { evs[vid].SlowChargeTime = sct; }
+	const RangeList& EV_getSlowChargeTime(size_t vid) { return syncEV(vid).SlowChargeTime; }
+	void EV_setSlowChargeTime(size_t vid, const RangeList& sct) { touchEV(vid).SlowChargeTime = sct; }
 
-	double EV_getMaxSlowChargeCost(size_t vid) const { return evs[vid].MaxSlowChargeCost; }
-	void EV_setMaxSlowChargeCost(size_t vid, double mscc) { evs[vid].MaxSlowChargeCost = mscc; }
+	double EV_getMaxSlowChargeCost(size_t vid) { return syncEV(vid).MaxSlowChargeCost; }
+	void EV_setMaxSlowChargeCost(size_t vid, double mscc) { touchEV(vid).MaxSlowChargeCost = mscc; }
 
-	const RangeList& EV_getV2GTime(size_t vid) const { return evs[vid].V2GTime; }
-	void EV_setV2GTime(size_t vid, const RangeList& v2gt) { evs[vid].V2GTime = v2gt; }
+	const RangeList& EV_getV2GTime(size_t vid) { return syncEV(vid).V2GTime; }
+	void EV_setV2GTime(size_t vid, const RangeList& v2gt) { touchEV(vid).V2GTime = v2gt; }
 
-	double EV_getMinV2GRevenue(size_t vid) const { return evs[vid].MinV2GRevenue; }
-	void EV_setMinV2GRevenue(size_t vid, double mv2gr) { evs[vid].MinV2GRevenue = mv2gr; }
+	double EV_getMinV2GRevenue(size_t vid) { return syncEV(vid).MinV2GRevenue; }
+	void EV_setMinV2GRevenue(size_t vid, double mv2gr) { touchEV(vid).MinV2GRevenue = mv2gr; }
 
-	bool EV_getCacheRoute(size_t vid) const { return evs[vid].CacheRoute; }
-	void EV_setCacheRoute(size_t vid, bool cr) { evs[vid].CacheRoute = cr; }
+	bool EV_getCacheRoute(size_t vid) { return syncEV(vid).CacheRoute; }
+	void EV_setCacheRoute(size_t vid, bool cr) { touchEV(vid).CacheRoute = cr; }
 
-	void EV_ClearPc(size_t vid) { evs[vid].ClearPc(); }
+	void EV_ClearPc(size_t vid) { touchEV(vid).ClearPc(); }
 
-	double EV_SoC(size_t vid) const { return evs[vid].SoC(); }
-	double EV_Pc(size_t vid) const { return evs[vid].Pc(); }
-	double EV_Pc_kW(size_t vid) const { return evs[vid].Pc_kW(); }
-	double EV_EstChargeTime(size_t vid) const { return evs[vid].EstChargeTime(); }
+	double EV_SoC(size_t vid) { return syncEV(vid).SoC(); }
+	double EV_Pc(size_t vid) { return syncEV(vid).Pc(); }
+	double EV_Pc_kW(size_t vid) { return syncEV(vid).Pc_kW(); }
+	double EV_EstChargeTime(size_t vid) { return syncEV(vid).EstChargeTime(); }
 
-	void EV_Drive(size_t vid, double new_dist, int ctime) { evs[vid].Drive(new_dist, ctime); }
-	void EV_DriveNow(size_t vid, double new_dist) { evs[vid].Drive(new_dist, getTime()); }
-	double EV_Charge(size_t vid, int t, double unit_cost, double pc_nominal_kWhps) { return evs[vid].Charge(t, unit_cost, pc_nominal_kWhps); }
-	double EV_Discharge(size_t vid, double k, int t, double unit_revenue) { return evs[vid].Discharge(k, t, unit_revenue); }
+	void EV_Drive(size_t vid, double new_dist, int ctime) { touchEV(vid).Drive(new_dist, ctime); }
+	void EV_DriveNow(size_t vid, double new_dist) { touchEV(vid).Drive(new_dist, getTime()); }
+	double EV_Charge(size_t vid, int t, double unit_cost, double pc_nominal_kWhps) { return touchEV(vid).Charge(t, unit_cost, pc_nominal_kWhps); }
+	double EV_Discharge(size_t vid, double k, int t, double unit_revenue) { return touchEV(vid).Discharge(k, t, unit_revenue); }
 
-	bool EV_CanV2G(size_t vid, int t, double revenue) const { return evs[vid].CanV2G(t, revenue); }
-	bool EV_CanV2GNow(size_t vid, double revenue) const { return evs[vid].CanV2G(getTime(), revenue); }
-	bool EV_CanSlowCharge(size_t vid, int t, double cost) const { return evs[vid].CanSlowCharge(t, cost); }
-	bool EV_CanSlowChargeNow(size_t vid, double cost) const { return evs[vid].CanSlowCharge(getTime(), cost); }
+	bool EV_CanV2G(size_t vid, int t, double revenue) { return syncEV(vid).CanV2G(t, revenue); }
+	bool EV_CanV2GNow(size_t vid, double revenue) { return syncEV(vid).CanV2G(getTime(), revenue); }
+	bool EV_CanSlowCharge(size_t vid, int t, double cost) { return syncEV(vid).CanSlowCharge(t, cost); }
+	bool EV_CanSlowChargeNow(size_t vid, double cost) { return syncEV(vid).CanSlowCharge(getTime(), cost); }
 
-	const Trip& EV_CurrentTrip(size_t vid) const { return evs[vid].CurrentTrip(); }
-	const Trip& EV_TripAt(size_t vid, int idx) const { return evs[vid].TripAt(idx); }
-	size_t EV_TripsCount(size_t vid) const { return evs[vid].TripsCount(); }
-	int EV_TripID(size_t vid) const { return evs[vid].TripID(); }
-	int EV_NextTrip(size_t vid) { return evs[vid].NextTrip(); }
-	double EV_MaxMileage(size_t vid) { return evs[vid].MaxMileage(); }
-	bool EV_IsBattEnough(size_t vid, double dist) const { return evs[vid].IsBattEnough(dist); }
-	const string& EV_brief(size_t vid) const { return evs[vid].brief(); }
+	const TripRec& EV_CurrentTrip(size_t vid) { return syncEV(vid).CurrentTrip(); }
+	const TripRec& EV_TripAt(size_t vid, int idx) { return syncEV(vid).TripAt(idx); }
+	size_t EV_TripsCount(size_t vid) { return syncEV(vid).TripsCount(); }
+	int EV_TripID(size_t vid) { return syncEV(vid).TripID(); }
+	int EV_NextTrip(size_t vid) { return touchEV(vid).NextTrip(); }
+	double EV_MaxMileage(size_t vid) { return syncEV(vid).MaxMileage(); }
+	bool EV_IsBattEnough(size_t vid, double dist) { return syncEV(vid).IsBattEnough(dist); }
+	const string& EV_brief(size_t vid) { return syncEV(vid).brief(); }
 
 
 	vector<string> FCSList_Names() const { return fcs.CSIDs(); }
@@ -163,6 +247,16 @@ public:
 	bool FCSList_IsCharging(int vid) { return fcs.IsCharging(vid); }
 	size_t FCSList_size() const { return fcs.size(); }
 	vector<size_t> FCSList_VehCounts() const { return fcs.VehCounts(); }
+	// FCS index (-1 if none) and state of every EV
+	pair<vector<int>, vector<CSVehState>> FCSList_VehLocations() const {
+		pair<vector<int>, vector<CSVehState>> ret;
+		fcs.Locations().Export(evs.size(), ret.first, ret.second);
+		return ret;
+	}
+	void FCSList_SetPos(size_t cs_index, double x, double y) { fcs.SetPos(cs_index, x, y); }
+	bool FCSList_IsIndexed(size_t cs_index) const { return fcs.IsIndexed(cs_index); }
+	bool FCSList_SetIndexed(size_t cs_index, bool indexed) { return fcs.SetIndexed(cs_index, indexed); }
+	vector<Point> FCSList_SelectWithin(double x, double y, double d) const { return fcs.SelectWithin(x, y, d); }
 
 	const string& FCS_getID(size_t cs_index) const { return fcs[cs_index].ID; }
 	const string& FCS_getEdge(size_t cs_index) const { return fcs[cs_index].Edge; }
@@ -186,6 +280,7 @@ public:
 			throw V2SimError(std::format("FCS_setSinglePcLimit: slot_index {} out of bound, size is {}.", slot_index, fcs[cs_index].SinglePcLimit.size()));
 		}
 		fcs[cs_index].SinglePcLimit[slot_index] = value; 
+		fcs[cs_index].LimitsChanged();
 	}
 
 	double FCS_getTotalPcLimit(size_t cs_index) const { return fcs[cs_index].TotalPcLimit; }
@@ -252,79 +347,89 @@ public:
 	double FCS_V2GCapBuffer(size_t cs_index) const { return fcs[cs_index].V2GCapBuffer(); }
 
 
-	vector<string> SCSList_Names() const { return scs.CSIDs(); }
-	int SCSList_IndexOf(const string& csName) const { return scs.IndexOf(csName); }
-	bool SCSList_AddVeh(int vid, const string& csName) { return scs.AddVeh(vid, csName); }
-	bool SCSList_AddVeh(int vid, int cs_index) { return scs.AddVeh(vid, cs_index); }
-	bool SCSList_HasVeh(int vid) const { return scs.HasVeh(vid); }
-	bool SCSList_PopVeh(int vid) { return scs.PopVeh(vid); }
-	bool SCSList_IsCharging(int vid) { return scs.IsCharging(vid); }
-	size_t SCSList_size() const { return scs.size(); }
-	vector<size_t> SCSList_VehCounts() const { return scs.VehCounts(); }
+	vector<string> SCSList_Names() const { return slowCS().CSIDs(); }
+	int SCSList_IndexOf(const string& csName) const { return slowCS().IndexOf(csName); }
+	bool SCSList_AddVeh(int vid, const string& csName) { return slowCS().AddVeh(vid, csName); }
+	bool SCSList_AddVeh(int vid, int cs_index) { return slowCS().AddVeh(vid, cs_index); }
+	bool SCSList_HasVeh(int vid) const { return slowCS().HasVeh(vid); }
+	bool SCSList_PopVeh(int vid) { return slowCS().PopVeh(vid); }
+	bool SCSList_IsCharging(int vid) { return slowCS().IsCharging(vid); }
+	size_t SCSList_size() const { return slowCS().size(); }
+	vector<size_t> SCSList_VehCounts() const { return slowCS().VehCounts(); }
+	// SCS index (-1 if none) and state of every EV
+	pair<vector<int>, vector<CSVehState>> SCSList_VehLocations() const {
+		pair<vector<int>, vector<CSVehState>> ret;
+		slowCS().Locations().Export(evs.size(), ret.first, ret.second);
+		return ret;
+	}
+	void SCSList_SetPos(size_t cs_index, double x, double y) { slowCS().SetPos(cs_index, x, y); }
+	bool SCSList_IsIndexed(size_t cs_index) const { return slowCS().IsIndexed(cs_index); }
+	bool SCSList_SetIndexed(size_t cs_index, bool indexed) { return slowCS().SetIndexed(cs_index, indexed); }
+	vector<Point> SCSList_SelectWithin(double x, double y, double d) const { return slowCS().SelectWithin(x, y, d); }
 
-	const string& SCS_getID(size_t cs_index) const { return scs[cs_index].ID; }
-	const string& SCS_getEdge(size_t cs_index) const { return scs[cs_index].Edge; }
+	const string& SCS_getID(size_t cs_index) const { return slowCS()[cs_index].ID; }
+	const string& SCS_getEdge(size_t cs_index) const { return slowCS()[cs_index].Edge; }
 
-	double SCS_getTotalPcLimit(size_t cs_index) const { return scs[cs_index].TotalPcLimit; }
-	void SCS_setTotalPcLimit(size_t cs_index, double tot_pc) { scs[cs_index].TotalPcLimit = tot_pc; }
+	double SCS_getTotalPcLimit(size_t cs_index) const { return slowCS()[cs_index].TotalPcLimit; }
+	void SCS_setTotalPcLimit(size_t cs_index, double tot_pc) { slowCS()[cs_index].TotalPcLimit = tot_pc; }
 
-	const vector<double>& SCS_getSinglePdActual(size_t cs_index) const { return scs[cs_index].SinglePdActual; }
+	const vector<double>& SCS_getSinglePdActual(size_t cs_index) const { return slowCS()[cs_index].SinglePdActual; }
 	double SCS_getSinglePdActual(size_t cs_index, size_t slot_index) const {
-		if (slot_index >= scs[cs_index].SinglePdActual.size()) {
-			throw V2SimError(std::format("SCS_setSinglePdActual: slot_index {} out of bound, size is {}.", slot_index, scs[cs_index].SinglePdActual.size()));
+		if (slot_index >= slowCS()[cs_index].SinglePdActual.size()) {
+			throw V2SimError(std::format("SCS_setSinglePdActual: slot_index {} out of bound, size is {}.", slot_index, slowCS()[cs_index].SinglePdActual.size()));
 		}
-		return scs[cs_index].SinglePdActual[slot_index];
+		return slowCS()[cs_index].SinglePdActual[slot_index];
 	}
 	void SCS_setSinglePdActual(size_t cs_index, size_t slot_index, double value) {
-		if (slot_index >= scs[cs_index].SinglePdActual.size()) {
-			throw V2SimError(std::format("SCS_setSinglePdActual: slot_index {} out of bound, size is {}.", slot_index, scs[cs_index].SinglePdActual.size()));
+		if (slot_index >= slowCS()[cs_index].SinglePdActual.size()) {
+			throw V2SimError(std::format("SCS_setSinglePdActual: slot_index {} out of bound, size is {}.", slot_index, slowCS()[cs_index].SinglePdActual.size()));
 		}
-		scs[cs_index].SinglePdActual[slot_index] = value;
+		slowCS()[cs_index].SinglePdActual[slot_index] = value;
 	}
-	double SCS_getTotalPdLimit(size_t cs_index) const { return scs[cs_index].TotalPdLimit; }
-	void SCS_setTotalPdLimit(size_t cs_index, double tot_pd) { scs[cs_index].TotalPdLimit = tot_pd; }
+	double SCS_getTotalPdLimit(size_t cs_index) const { return slowCS()[cs_index].TotalPdLimit; }
+	void SCS_setTotalPdLimit(size_t cs_index, double tot_pd) { slowCS()[cs_index].TotalPdLimit = tot_pd; }
 
-	double SCS_PriceBuy(size_t cs_index, int t) const { return scs[cs_index].PriceBuy(t); }
-	double SCS_PriceBuyNow(size_t cs_index) const { return scs[cs_index].PriceBuy(getTime()); }
+	double SCS_PriceBuy(size_t cs_index, int t) const { return slowCS()[cs_index].PriceBuy(t); }
+	double SCS_PriceBuyNow(size_t cs_index) const { return slowCS()[cs_index].PriceBuy(getTime()); }
 
-	double SCS_PriceSell(size_t cs_index, int t) const { return scs[cs_index].PriceSell(t); }
-	double SCS_PriceSellNow(size_t cs_index) const { return scs[cs_index].PriceSell(getTime()); }
+	double SCS_PriceSell(size_t cs_index, int t) const { return slowCS()[cs_index].PriceSell(t); }
+	double SCS_PriceSellNow(size_t cs_index) const { return slowCS()[cs_index].PriceSell(getTime()); }
 
-	bool SCS_SupportV2G(size_t cs_index) const { return scs[cs_index].SupportV2G(); }
-	bool SCS_IsOnline(size_t cs_index, int t) const { return scs[cs_index].IsOnline(t); }
-	bool SCS_IsOnlineNow(size_t cs_index) const { return scs[cs_index].IsOnline(getTime()); }
+	bool SCS_SupportV2G(size_t cs_index) const { return slowCS()[cs_index].SupportV2G(); }
+	bool SCS_IsOnline(size_t cs_index, int t) const { return slowCS()[cs_index].IsOnline(t); }
+	bool SCS_IsOnlineNow(size_t cs_index) const { return slowCS()[cs_index].IsOnline(getTime()); }
 
-	void SCS_ForceShutdown(size_t cs_index) { scs[cs_index].ForceShutdown(); }
-	void SCS_ForceReopen(size_t cs_index) { scs[cs_index].ForceReopen(); }
-	void SCS_ClearForceOffline(size_t cs_index) { scs[cs_index].ClearForceOffline(); }
+	void SCS_ForceShutdown(size_t cs_index) { slowCS()[cs_index].ForceShutdown(); }
+	void SCS_ForceReopen(size_t cs_index) { slowCS()[cs_index].ForceReopen(); }
+	void SCS_ClearForceOffline(size_t cs_index) { slowCS()[cs_index].ClearForceOffline(); }
 
-	double SCS_Pc(size_t cs_index) const { return scs[cs_index].Pc(); }
-	double SCS_Pc_kW(size_t cs_index) const { return scs[cs_index].Pc_kW(); }
-	double SCS_Pc_MW(size_t cs_index) const { return scs[cs_index].Pc_MW(); }
+	double SCS_Pc(size_t cs_index) const { return slowCS()[cs_index].Pc(); }
+	double SCS_Pc_kW(size_t cs_index) const { return slowCS()[cs_index].Pc_kW(); }
+	double SCS_Pc_MW(size_t cs_index) const { return slowCS()[cs_index].Pc_MW(); }
 
-	double SCS_Pd(size_t cs_index) const { return scs[cs_index].Pd(); }
-	double SCS_Pd_kW(size_t cs_index) const { return scs[cs_index].Pd_kW(); }
-	double SCS_Pd_MW(size_t cs_index) const { return scs[cs_index].Pd_MW(); }
+	double SCS_Pd(size_t cs_index) const { return slowCS()[cs_index].Pd(); }
+	double SCS_Pd_kW(size_t cs_index) const { return slowCS()[cs_index].Pd_kW(); }
+	double SCS_Pd_MW(size_t cs_index) const { return slowCS()[cs_index].Pd_MW(); }
 
-	double SCS_Pv2g(size_t cs_index) const { return scs[cs_index].Pv2g(); }
-	double SCS_Pv2g_kW(size_t cs_index) const { return scs[cs_index].Pv2g_kW(); }
-	double SCS_Pv2g_MW(size_t cs_index) const { return scs[cs_index].Pv2g_MW(); }
+	double SCS_Pv2g(size_t cs_index) const { return slowCS()[cs_index].Pv2g(); }
+	double SCS_Pv2g_kW(size_t cs_index) const { return slowCS()[cs_index].Pv2g_kW(); }
+	double SCS_Pv2g_MW(size_t cs_index) const { return slowCS()[cs_index].Pv2g_MW(); }
 
-	bool SCS_AddVeh(int cs_index, int vid) { return scs.AddVeh(vid, cs_index); }
-	bool SCS_PopVeh(size_t cs_index, int vid) { return scs[cs_index].PopVeh(vid); }
-	bool SCS_HasVeh(size_t cs_index, int vid) const { return scs[cs_index].HasVeh(vid); }
-	bool SCS_IsCharging(size_t cs_index, int vid) const { return scs[cs_index].IsCharging(vid); }
+	bool SCS_AddVeh(int cs_index, int vid) { return slowCS().AddVeh(vid, cs_index); }
+	bool SCS_PopVeh(size_t cs_index, int vid) { return slowCS()[cs_index].PopVeh(vid); }
+	bool SCS_HasVeh(size_t cs_index, int vid) const { return slowCS()[cs_index].HasVeh(vid); }
+	bool SCS_IsCharging(size_t cs_index, int vid) const { return slowCS()[cs_index].IsCharging(vid); }
 
-	size_t SCS_size(size_t cs_index) const { return scs[cs_index].size(); }
-	size_t SCS_VehCount(size_t cs_index, bool only_charging = false) const { return scs[cs_index].VehCount(only_charging); }
+	size_t SCS_size(size_t cs_index) const { return slowCS()[cs_index].size(); }
+	size_t SCS_VehCount(size_t cs_index, bool only_charging = false) const { return slowCS()[cs_index].VehCount(only_charging); }
 
 	vector<int> SCS_Update(size_t cs_index, int sec, int ctime, double v2g_k) {
-		return scs[cs_index].Update(evs, sec, ctime, v2g_k);
+		return slowCS()[cs_index].Update(evs, sec, ctime, v2g_k);
 	}
 	vector<int> SCS_UpdateNow(size_t cs_index, int sec, double v2g_k) {
-		return scs[cs_index].Update(evs, sec, getTime(), v2g_k);
+		return slowCS()[cs_index].Update(evs, sec, getTime(), v2g_k);
 	}
-	double SCS_V2GCapacity(size_t cs_index, int ctime) { return scs[cs_index].V2GCapacity(evs, ctime); }
-	double SCS_V2GCapacityNow(size_t cs_index) { return scs[cs_index].V2GCapacity(evs, getTime()); }
-	double SCS_V2GCapBuffer(size_t cs_index) const { return scs[cs_index].V2GCapBuffer(); }
+	double SCS_V2GCapacity(size_t cs_index, int ctime) { return slowCS()[cs_index].V2GCapacity(evs, ctime); }
+	double SCS_V2GCapacityNow(size_t cs_index) { return slowCS()[cs_index].V2GCapacity(evs, getTime()); }
+	double SCS_V2GCapBuffer(size_t cs_index) const { return slowCS()[cs_index].V2GCapBuffer(); }
 };
\ No newline at end of file
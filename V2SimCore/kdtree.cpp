@@ -1,152 +1,224 @@
 #include "kdtree.h"
 #include <algorithm>
+#include <cstdint>
 
 // Comparator for sorting points based on axis
 bool compareX(const Point& a, const Point& b) { return a.x < b.x; }
 bool compareY(const Point& a, const Point& b) { return a.y < b.y; }
 
-KDNode* KDTree::buildTree(std::vector<Point>& points, int depth) {
-    if (points.empty()) return nullptr;
+// Size of the left subtree of a left-balanced tree with n nodes
+static size_t leftSubtreeSize(size_t n) {
+    if (n <= 1) return 0;
+    size_t full = 1; // Number of nodes in the last full level
+    while (2 * full <= n) full *= 2;
+    full /= 2;
+    // Nodes above the last level in the left subtree, plus its share of the last level
+    size_t last = n - (2 * full - 1);
+    return (full - 1) + std::min(last, full);
+}
+
+// Distance from the target to the splitting plane of a node
+static inline double axisDistance(const Point& target, const Point& node, int axis) {
+    return axis == 0 ? target.x - node.x : target.y - node.y;
+}
 
+void KDTree::buildTree(std::vector<Point>& points, size_t lo, size_t hi, size_t idx, int depth) {
     // Alternate between x and y axis
     int axis = depth % 2;
 
-    // Sort points based on current axis
+    // Only place the median at its position, the two halves stay unsorted
+    size_t median = lo + leftSubtreeSize(hi - lo);
+    auto first = points.begin();
     if (axis == 0) {
-        std::sort(points.begin(), points.end(), compareX);
+        std::nth_element(first + lo, first + median, first + hi, compareX);
     }
     else {
-        std::sort(points.begin(), points.end(), compareY);
+        std::nth_element(first + lo, first + median, first + hi, compareY);
     }
-
-    // Find median
-    size_t median = points.size() / 2;
-
-    // Create node
-    KDNode* node = new KDNode(points[median]);
+    nodes[idx] = points[median];
 
     // Recursively build left and right subtrees
-    std::vector<Point> leftPoints(points.begin(), points.begin() + median);
-    std::vector<Point> rightPoints(points.begin() + median + 1, points.end());
-
-    node->left = buildTree(leftPoints, depth + 1);
-    node->right = buildTree(rightPoints, depth + 1);
-
-    return node;
+    if (median > lo) buildTree(points, lo, median, 2 * idx + 1, depth + 1);
+    if (median + 1 < hi) buildTree(points, median + 1, hi, 2 * idx + 2, depth + 1);
 }
 
-void KDTree::nearestNeighbor(KDNode* node, const Point& target, int depth, KDNode*& best, double& bestDist) {
-    if (node == nullptr) return;
-
-    double dist = node->point.dist_to(target);
-    if (dist < bestDist) {
-        bestDist = dist;
-        best = node;
-    }
-
-    int axis = depth % 2;
-    KDNode* nextBranch = nullptr;
-    KDNode* otherBranch = nullptr;
-
-    if ((axis == 0 && target.x < node->point.x) || (axis == 1 && target.y < node->point.y)) {
-        nextBranch = node->left;
-        otherBranch = node->right;
-    }
-    else {
-        nextBranch = node->right;
-        otherBranch = node->left;
-    }
+void KDTree::build(std::vector<Point>& points) {
+    // Check the labels before touching the tree, so it is left unchanged on error
+    size_t n = points.size();
+    std::unordered_map<int, size_t> index;
+    index.reserve(n);
+    for (const auto& p : points) {
+        if (!index.emplace(p.label, 0).second) {
+            throw V2SimError(std::format("Duplicate label {} in the points of a KD tree", p.label));
+        }
+    }
+    nodes.resize(n);
+    if (n > 0) buildTree(points, 0, n, 0, 0);
+    alive.assign(n, 1);
+    extra.clear();
+    dead = 0;
+    for (size_t i = 0; i < n; ++i) {
+        index[nodes[i].label] = i;
+    }
+    where = std::move(index);
+}
 
-    nearestNeighbor(nextBranch, target, depth + 1, best, bestDist);
+void KDTree::maybeRebuild() {
+    size_t pending = dead + extra.size();
+    if (pending < 16 || pending * 4 < size()) return;
+    Compact();
+}
 
-    // Check if we need to search the other branch
-    double axisDist;
-    if (axis == 0) {
-        axisDist = target.x - node->point.x;
-    }
-    else {
-        axisDist = target.y - node->point.y;
+void KDTree::Compact() {
+    if (dead == 0 && extra.empty()) return;
+    std::vector<Point> points;
+    points.reserve(size());
+    size_t n = nodes.size();
+    for (size_t i = 0; i < n; ++i) {
+        if (alive[i]) points.push_back(nodes[i]);
     }
+    points.insert(points.end(), extra.begin(), extra.end());
+    build(points);
+}
 
-    if (axisDist * axisDist < bestDist) {
-        nearestNeighbor(otherBranch, target, depth + 1, best, bestDist);
+bool KDTree::Insert(const Point& p) {
+    if (where.contains(p.label)) {
+        return false;
     }
+    where[p.label] = nodes.size() + extra.size();
+    extra.push_back(p);
+    maybeRebuild();
+    return true;
 }
 
-void KDTree::kNearestNeighbors(KDNode* node, const Point& target, int depth,
-    std::priority_queue<std::pair<double, KDNode*>>& pq, int k) {
-    if (node == nullptr) return;
-
-    double dist = node->point.dist_to(target);
-    pq.push({ dist, node });
-
-    // Maintain only k elements in the priority queue
-    if (pq.size() > k) {
-        pq.pop();
+bool KDTree::Remove(int label) {
+    auto it = where.find(label);
+    if (it == where.end()) {
+        return false;
     }
-
-    int axis = depth % 2;
-    KDNode* nextBranch = nullptr;
-    KDNode* otherBranch = nullptr;
-
-    if ((axis == 0 && target.x < node->point.x) || (axis == 1 && target.y < node->point.y)) {
-        nextBranch = node->left;
-        otherBranch = node->right;
+    size_t i = it->second;
+    where.erase(it);
+    if (i < nodes.size()) {
+        alive[i] = 0;
+        ++dead;
     }
     else {
-        nextBranch = node->right;
-        otherBranch = node->left;
-    }
-
-    kNearestNeighbors(nextBranch, target, depth + 1, pq, k);
+        // Swap with the last buffered point
+        size_t j = i - nodes.size();
+        if (j + 1 != extra.size()) {
+            extra[j] = extra.back();
+            where[extra[j].label] = i;
+        }
+        extra.pop_back();
+    }
+    maybeRebuild();
+    return true;
+}
 
-    // Check if we need to search the other branch
-    double axisDist;
-    if (axis == 0) {
-        axisDist = target.x - node->point.x;
-    }
-    else {
-        axisDist = target.y - node->point.y;
-    }
+bool KDTree::Relocate(int label, double x, double y) {
+    auto it = where.find(label);
+    if (it == where.end()) {
+        return false;
+    }
+    size_t i = it->second;
+    if (i >= nodes.size()) {
+        // Buffered points are not indexed, so they can be moved in place
+        extra[i - nodes.size()].x = x;
+        extra[i - nodes.size()].y = y;
+        return true;
+    }
+    Remove(label);
+    Insert(Point(x, y, label));
+    return true;
+}
 
-    if (pq.size() < k || axisDist * axisDist < pq.top().first) {
-        kNearestNeighbors(otherBranch, target, depth + 1, pq, k);
+void KDTree::nearestNeighbor(size_t idx, const Point& target, int depth, size_t& best, double& bestDist) const {
+    const Point* data = nodes.data();
+    const size_t n = nodes.size();
+
+    // Branches not taken on the way down, with the squared distance to their splitting plane.
+    // A left-balanced tree of size_t nodes never gets deeper than 64 levels.
+    struct Pending { size_t idx; int depth; double planeDist; };
+    Pending stack[64];
+    int top = 0;
+
+    for (;;) {
+        // Descend towards the leaf containing the target
+        while (idx < n) {
+            const Point& node = data[idx];
+            double dist = node.dist_to(target);
+            if (dist < bestDist && alive[idx]) {
+                bestDist = dist;
+                best = idx;
+            }
+            double axisDist = axisDistance(target, node, depth % 2);
+            ++depth;
+            stack[top++] = { axisDist < 0 ? 2 * idx + 2 : 2 * idx + 1, depth, axisDist * axisDist };
+            idx = axisDist < 0 ? 2 * idx + 1 : 2 * idx + 2;
+        }
+
+        // Check if we need to search the other branch
+        do {
+            if (top == 0) return;
+            --top;
+        } while (stack[top].planeDist >= bestDist);
+        idx = stack[top].idx;
+        depth = stack[top].depth;
     }
 }
 
-Point KDTree::findNearestNeighbor(const Point& target) {
-    if (root == nullptr) {
+Point KDTree::findNearestNeighbor(const Point& target) const {
+    if (!Initialized()) {
         throw std::runtime_error("Tree is empty");
     }
 
-    KDNode* best = nullptr;
+    size_t best = SIZE_MAX;
     double bestDist = std::numeric_limits<double>::max();
-    nearestNeighbor(root, target, 0, best, bestDist);
+    nearestNeighbor(0, target, 0, best, bestDist);
+
+    // Buffered points are not in the tree and have to be checked one by one
+    size_t n = extra.size();
+    for (size_t j = 0; j < n; ++j) {
+        double dist = extra[j].dist_to(target);
+        if (dist < bestDist) {
+            bestDist = dist;
+            best = nodes.size() + j;
+        }
+    }
 
-    if (best == nullptr) {
+    if (best == SIZE_MAX) {
         throw std::runtime_error("No nearest neighbor found");
     }
 
-    return best->point;
+    return pointAt(best);
 }
 
-std::vector<Point> KDTree::findKNearestNeighbors(const Point& target, int k) {
-    if (root == nullptr) {
-        throw std::runtime_error("Tree is empty");
+void KDTree::withinRadius(size_t idx, const Point& target, int depth, double r2, std::vector<Point>& result) const {
+    if (idx >= nodes.size()) return;
+
+    const Point& node = nodes[idx];
+    if (alive[idx] && node.dist_to(target) <= r2) {
+        result.push_back(node);
     }
 
-    // Use a max-heap to keep track of the k smallest distances
-    std::priority_queue<std::pair<double, KDNode*>> pq;
-    kNearestNeighbors(root, target, 0, pq, k);
+    double axisDist = depth % 2 == 0 ? target.x - node.x : target.y - node.y;
+    // Points on the left are smaller along the axis and points on the right are not
+    if (axisDist <= 0 || axisDist * axisDist <= r2) {
+        withinRadius(2 * idx + 1, target, depth + 1, r2, result);
+    }
+    if (axisDist >= 0 || axisDist * axisDist <= r2) {
+        withinRadius(2 * idx + 2, target, depth + 1, r2, result);
+    }
+}
 
+std::vector<Point> KDTree::findWithinRadius(const Point& target, double radius) const {
     std::vector<Point> result;
-    while (!pq.empty()) {
-        result.push_back(pq.top().second->point);
-        pq.pop();
+    double r2 = radius * radius;
+    withinRadius(0, target, 0, r2, result);
+    for (auto& p : extra) {
+        if (p.dist_to(target) <= r2) {
+            result.push_back(p);
+        }
     }
-
-    // The results come out in reverse order (max to min), so reverse them
-    std::reverse(result.begin(), result.end());
-
     return result;
-}
\ No newline at end of file
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <span>
 #include "utilbase.h"
 
 // Structure to represent a 2D point with a label
@@ -16,78 +18,224 @@ struct Point {
     }
 };
 
-// Structure to represent a node in the KDTree
-struct KDNode {
-    Point point;
-    KDNode* left;
-    KDNode* right;
-
-    KDNode(const Point& point) : point(point), left(nullptr), right(nullptr) {}
-};
-
 
 // KDTree class
+// The tree is left-balanced and stored in one contiguous array in breadth-first order,
+// so the children of node i are 2i+1 and 2i+2 and no per-node allocation is needed.
+// Points can be inserted, removed and relocated by label without a full rebuild: 
+// removed nodes are only marked dead, and new points go to a small unsorted buffer that 
+// every query also scans. The tree is rebuilt once the dead nodes and buffered points 
+// exceed a fraction of its size, so the updates cost amortized O(log n).
 class KDTree {
 private:
-    KDNode* root;
+    std::vector<Point> nodes;
+    std::vector<unsigned char> alive; // Whether each node has not been removed
+    std::vector<Point> extra; // Points inserted since the last rebuild
+    std::unordered_map<int, size_t> where; // Label -> node index, or nodes.size() + index in extra
+    size_t dead = 0; // Number of removed nodes still in the tree
+
+    // Helper function to build the tree recursively by partial selection of the median.
+    // points[lo, hi) are placed into the subtree rooted at node idx.
+    void buildTree(std::vector<Point>& points, size_t lo, size_t hi, size_t idx, int depth);
 
-    // Helper function to build the tree recursively
-    KDNode* buildTree(std::vector<Point>& points, int depth = 0);
+    // Build the tree from scratch. Throw V2SimError if two points share a label.
+    void build(std::vector<Point>& points);
+
+    // Rebuild the tree if too many updates have accumulated
+    void maybeRebuild();
+
+    // Point by the index used in where and in the search heaps
+    const Point& pointAt(size_t i) const {
+        return i < nodes.size() ? nodes[i] : extra[i - nodes.size()];
+    }
 
     // Helper function for nearest neighbor search
-    void nearestNeighbor(KDNode* node, const Point& target, 
-        int depth, KDNode*& best, double& bestDist);
+    void nearestNeighbor(size_t idx, const Point& target,
+        int depth, size_t& best, double& bestDist) const;
+
+    // Offer a point to the k nearest neighbors heap
+    template <typename Pred>
+    static void offer(const Point& p, size_t i, double dist, std::pair<double, size_t>* heap, 
+        int& count, int k, double maxDist2, Pred& pred) {
+        if (dist <= maxDist2 && (count < k || dist < heap[0].first) && pred(p.label)) {
+            if (count < k) {
+                heap[count++] = { dist, i };
+            }
+            else {
+                std::pop_heap(heap, heap + count);
+                heap[count - 1] = { dist, i };
+            }
+            std::push_heap(heap, heap + count);
+        }
+    }
         
-    // Helper function for k nearest neighbors search
-    void kNearestNeighbors(KDNode* node, const Point& target, int depth,
-        std::priority_queue<std::pair<double, KDNode*>>& pq, int k);
-
-    // Helper function to delete the tree recursively
-    void deleteTree(KDNode* node) {
-        if (node == nullptr) return;
-        deleteTree(node->left);
-        deleteTree(node->right);
-        delete node;
+    // Helper function for k nearest neighbors search.
+    // heap[0, count) is a max-heap of (distance, point index) with at most k elements.
+    // Only the points within squared distance maxDist2 whose labels are accepted by pred are kept.
+    template <typename Pred>
+    void kNearestNeighbors(size_t idx, const Point& target, int depth,
+        std::pair<double, size_t>* heap, int& count, int k, double maxDist2, Pred& pred) const {
+        if (idx >= nodes.size()) return;
+
+        const Point& node = nodes[idx];
+        double dist = node.dist_to(target);
+
+        // Maintain only k elements in the heap
+        if (alive[idx]) {
+            offer(node, idx, dist, heap, count, k, maxDist2, pred);
+        }
+
+        double axisDist = depth % 2 == 0 ? target.x - node.x : target.y - node.y;
+        size_t nextBranch = axisDist < 0 ? 2 * idx + 1 : 2 * idx + 2;
+        size_t otherBranch = axisDist < 0 ? 2 * idx + 2 : 2 * idx + 1;
+
+        kNearestNeighbors(nextBranch, target, depth + 1, heap, count, k, maxDist2, pred);
+
+        // Check if we need to search the other branch
+        double bound = count < k ? maxDist2 : heap[0].first;
+        if (axisDist * axisDist <= bound) {
+            kNearestNeighbors(otherBranch, target, depth + 1, heap, count, k, maxDist2, pred);
+        }
+    }
+
+    // Find the k nearest neighbors accepted by pred and leave them in heap[0, return value) in ascending order
+    template <typename Pred>
+    int kNearestSorted(const Point& target, int k, std::pair<double, size_t>* heap, double maxDist2, Pred& pred) const {
+        int count = 0;
+        if (k > 0) {
+            kNearestNeighbors(0, target, 0, heap, count, k, maxDist2, pred);
+            size_t n = extra.size();
+            for (size_t j = 0; j < n; ++j) {
+                offer(extra[j], nodes.size() + j, extra[j].dist_to(target), heap, count, k, maxDist2, pred);
+            }
+        }
+        std::sort_heap(heap, heap + count);
+        return count;
     }
 
+    // Helper function for radius search
+    void withinRadius(size_t idx, const Point& target, int depth, double r2, std::vector<Point>& result) const;
+
+    struct AcceptAll {
+        bool operator()(int) const { return true; }
+    };
+
+    static constexpr double noLimit = std::numeric_limits<double>::infinity();
+
     KDTree(KDTree&) = delete;
     KDTree& operator=(KDTree&) = delete;
 
 public:
-	bool Initialized() const { return root != nullptr; }
+	bool Initialized() const { return size() > 0; }
 
-    KDTree() {
-        root = nullptr;
-    }
-    // Constructor builds the tree from a vector of points
-    KDTree(const std::vector<Point>& points) {
-        if (points.empty()) {
-            root = nullptr;
-            return;
-        }
+    // Number of points in the tree
+    size_t size() const { return nodes.size() - dead + extra.size(); }
+
+    KDTree() {}
 
+    // Constructor builds the tree from a vector of points. The labels must be unique.
+    KDTree(const std::vector<Point>& points) {
         std::vector<Point> pointsCopy = points;
-        root = buildTree(pointsCopy);
+        build(pointsCopy);
     }
 
-    // Constructor builds the tree from a vector of points
+    // Rebuild the tree from a vector of points. The labels must be unique.
     void Init(std::vector<Point>&& points) {
-        if (points.empty()) {
-            root = nullptr;
-            return;
+        build(points);
+    }
+
+    // Whether a point with the given label is in the tree
+    bool Contains(int label) const { return where.contains(label); }
+
+    // Insert a point. Return false if its label is already in the tree.
+    bool Insert(const Point& p);
+
+    // Remove the point with the given label. Return false if it is not in the tree.
+    bool Remove(int label);
+
+    // Move the point with the given label to a new position. Return false if it is not in the tree.
+    bool Relocate(int label, double x, double y);
+
+    // Rebuild the tree now if any point has been removed or buffered since the last rebuild
+    void Compact();
+
+    // Function to find the nearest neighbor to a given point
+    Point findNearestNeighbor(const Point& target) const;
+
+    // Function to find all the points within the given distance to a given point, in no particular order
+    std::vector<Point> findWithinRadius(const Point& target, double radius) const;
+
+    // Function to find the k nearest neighbors to a given point
+    std::vector<Point> findKNearestNeighbors(const Point& target, int k) const {
+        return findKNearestNeighborsIf(target, k, AcceptAll());
+    }
+
+    // Function to find the k nearest neighbors to a given point among the points within maxDist
+    // whose labels are accepted by pred. Rejected points are skipped inside the traversal,
+    // so up to k acceptable points are returned however many rejected ones are nearer.
+    template <typename Pred>
+    std::vector<Point> findKNearestNeighborsIf(const Point& target, int k, Pred pred, double maxDist = noLimit) const {
+        if (!Initialized()) {
+            throw std::runtime_error("Tree is empty");
         }
 
-        root = buildTree(points);
+        std::vector<std::pair<double, size_t>> heap(std::max(k, 0));
+        int count = kNearestSorted(target, k, heap.data(), maxDist * maxDist, pred);
+
+        std::vector<Point> result;
+        result.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            result.push_back(pointAt(heap[i].second));
+        }
+        return result;
     }
 
-    // Destructor to clean up memory
-    ~KDTree() {
-        deleteTree(root);
+    // Function to find the k nearest neighbors to many points at once.
+    // The labels of the neighbors of targets[i] are written to out[i * k, i * k + k) in ascending
+    // order of distance, padded with -1 if the tree has less than k points.
+    // The queries are split across up to the given number of threads: the calling thread and the
+    // workers of pool. Without a pool they all run on the calling thread.
+    void findKNearestNeighborsBatch(std::span<const Point> targets, int k, std::span<int> out, int threads = 1,
+        ThreadPool* pool = nullptr) const {
+        findKNearestNeighborsBatchIf(targets, k, out, AcceptAll(), {}, threads, pool);
     }
 
-    // Function to find the nearest neighbor to a given point
-    Point findNearestNeighbor(const Point& target);
+    // Batched version of findKNearestNeighborsIf. maxDists holds the search radius of each target,
+    // or is empty for no limit. pred is shared by all the threads, so it must be safe to call concurrently.
+    // An exception thrown by pred is rethrown on the calling thread once all the queries stop.
+    template <typename Pred>
+    void findKNearestNeighborsBatchIf(std::span<const Point> targets, int k, std::span<int> out, Pred pred,
+        std::span<const double> maxDists = {}, int threads = 1, ThreadPool* pool = nullptr) const {
+        if (!Initialized()) {
+            throw std::runtime_error("Tree is empty");
+        }
+        if (k <= 0) return;
+        if (out.size() < targets.size() * k) {
+            throw std::runtime_error(std::format("Output buffer too small: {} < {}", out.size(), targets.size() * k));
+        }
+        if (!maxDists.empty() && maxDists.size() < targets.size()) {
+            throw std::runtime_error(std::format("Too few search radii: {} < {}", maxDists.size(), targets.size()));
+        }
 
-    // Function to find the k nearest neighbors to a given point
-    std::vector<Point> findKNearestNeighbors(const Point& target, int k);
-};
\ No newline at end of file
+        // Each worker answers a contiguous block of queries with its own heap buffer
+        auto work = [&](size_t begin, size_t end) {
+            Pred localPred = pred;
+            std::vector<std::pair<double, size_t>> heap(k);
+            for (size_t i = begin; i < end; ++i) {
+                double maxDist = maxDists.empty() ? noLimit : maxDists[i];
+                int count = kNearestSorted(targets[i], k, heap.data(), maxDist * maxDist, localPred);
+                int* dst = out.data() + i * k;
+                for (int j = 0; j < count; ++j) {
+                    dst[j] = pointAt(heap[j].second).label;
+                }
+                std::fill(dst + count, dst + k, -1);
+            }
+        };
+
+        if (!pool) {
+            work(size_t(0), targets.size());
+            return;
+        }
+        ParallelFor(*pool, targets.size(), threads, work);
+    }
+};
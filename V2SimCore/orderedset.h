@@ -2,143 +2,211 @@
 
 #include "utilbase.h"
 
-template <typename T>
+// Set keeping the insertion order. The elements are linked by index in a slab whose free slots
+// are reused, and found through an open-addressing index, so once both have grown to the peak
+// size, insertions and removals allocate nothing.
+template <typename T, typename Hash = std::hash<T>>
 class OrderedHashSet {
 private:
+	static constexpr int NIL = -1;
+
 	struct Node {
 		T value;
-		Node* prev;
-		Node* next;
-		Node(const T& val) : value(val), prev(nullptr), next(nullptr) {}
+		int prev;
+		int next; // Next free node if the node is free
 	};
 
-	std::unordered_map<T, Node*> hash_map;
-	Node* head;
-	Node* tail;
+	std::vector<Node> nodes;
+	std::vector<int> index; // Node of each bucket, NIL if empty. Linear probing, at most half full.
+	int head = NIL, tail = NIL, free_head = NIL;
+	size_t cnt = 0;
+	Hash hasher;
+
+	size_t bucket(const T& value) const {
+		// Fibonacci hashing spreads identity hashes such as those of int
+		return (size_t)((uint64_t)hasher(value) * 0x9E3779B97F4A7C15ull >> 32) & (index.size() - 1);
+	}
+	// Bucket holding value, or the empty bucket ending its probe sequence
+	size_t find(const T& value) const {
+		size_t mask = index.size() - 1;
+		size_t i = bucket(value);
+		while (index[i] != NIL && !(nodes[index[i]].value == value)) {
+			i = (i + 1) & mask;
+		}
+		return i;
+	}
+	void rehash(size_t n_buckets) {
+		index.assign(n_buckets, NIL);
+		for (int p = head; p != NIL; p = nodes[p].next) {
+			index[find(nodes[p].value)] = p;
+		}
+	}
+	// Empty a bucket, shifting back the entries after it so that no probe sequence is broken
+	void removeBucket(size_t i) {
+		size_t mask = index.size() - 1;
+		index[i] = NIL;
+		for (size_t j = (i + 1) & mask; index[j] != NIL; j = (j + 1) & mask) {
+			size_t k = bucket(nodes[index[j]].value);
+			// Keep the entry at j if its home k lies cyclically in (i, j]
+			if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+				continue;
+			}
+			index[i] = index[j];
+			index[j] = NIL;
+			i = j;
+		}
+	}
 
 	// ɾڵ
-	void deleteNode(Node* node) {
-		if (node->prev) {
-			node->prev->next = node->next;
+	void deleteNode(int p) {
+		Node& node = nodes[p];
+		if (node.prev != NIL) {
+			nodes[node.prev].next = node.next;
 		}
 		else {
-			head = node->next;
+			head = node.next;
 		}
 
-		if (node->next) {
-			node->next->prev = node->prev;
+		if (node.next != NIL) {
+			nodes[node.next].prev = node.prev;
 		}
 		else {
-			tail = node->prev;
+			tail = node.prev;
 		}
 
-		delete node;
+		node.next = free_head;
+		free_head = p;
+		--cnt;
 	}
 
 public:
-	OrderedHashSet() : head(nullptr), tail(nullptr) {}
-
-	~OrderedHashSet() {
-		clear();
+	OrderedHashSet() {}
+
+	// Reserve room for n elements
+	void reserve(size_t n) {
+		nodes.reserve(n);
+		size_t b = 16;
+		while (b < 2 * n) {
+			b *= 2;
+		}
+		if (b > index.size()) {
+			rehash(b);
+		}
 	}
 
 	// ռеԪ
 	void clear() {
-		Node* current = head;
-		while (current) {
-			Node* next = current->next;
-			delete current;
-			current = next;
-		}
-		hash_map.clear();
-		head = tail = nullptr;
+		nodes.clear();
+		std::fill(index.begin(), index.end(), NIL);
+		head = tail = free_head = NIL;
+		cnt = 0;
 	}
 
 	// ԪأΪ򷵻std::nullopt
 	std::optional<T> pop() {
-		if (!head) {
+		if (head == NIL) {
 			return std::nullopt;
 		}
 
-		T value = head->value;
-		Node* toDelete = head;
-		hash_map.erase(value);
-		deleteNode(toDelete);
+		T value = nodes[head].value;
+		removeBucket(find(value));
+		deleteNode(head);
 		return value;
 	}
 
 	// Ԫ (Ѵ򷵻false)
 	bool insert(const T& value) {
-		if (hash_map.find(value) != hash_map.end()) {
+		if (2 * (cnt + 1) > index.size()) {
+			rehash(std::max<size_t>(16, index.size() * 2));
+		}
+		size_t i = find(value);
+		if (index[i] != NIL) {
 			return false;
 		}
 
-		Node* new_node = new Node(value);
-		hash_map[value] = new_node;
-
-		if (!head) {
-			head = tail = new_node;
+		int p;
+		if (free_head != NIL) {
+			p = free_head;
+			free_head = nodes[p].next;
+			nodes[p] = Node{ value, tail, NIL };
 		}
 		else {
-			tail->next = new_node;
-			new_node->prev = tail;
-			tail = new_node;
+			p = (int)nodes.size();
+			nodes.push_back(Node{ value, tail, NIL });
 		}
+		index[i] = p;
 
+		if (tail == NIL) {
+			head = p;
+		}
+		else {
+			nodes[tail].next = p;
+		}
+		tail = p;
+		++cnt;
 		return true;
 	}
 
 	// ɾԪ (򷵻false)
 	bool erase(const T& value) {
-		auto it = hash_map.find(value);
-		if (it == hash_map.end()) {
+		if (cnt == 0) {
+			return false;
+		}
+		size_t i = find(value);
+		if (index[i] == NIL) {
 			return false;
 		}
 
-		Node* node = it->second;
-		deleteNode(node);
-		hash_map.erase(it);
+		int p = index[i];
+		removeBucket(i);
+		deleteNode(p);
 		return true;
 	}
 
 	// ԪǷ
 	bool contains(const T& value) const {
-		return hash_map.find(value) != hash_map.end();
+		return cnt > 0 && index[find(value)] != NIL;
 	}
 
 	// ȡǰԪ
 	size_t size() const {
-		return hash_map.size();
+		return cnt;
 	}
 
 	// жǷΪ
 	bool empty() const {
-		return hash_map.empty();
+		return cnt == 0;
 	}
 
 	// ȡ˳еԪ
 	std::vector<T> getOrderedElements() const {
 		std::vector<T> elements;
-		Node* current = head;
-		while (current) {
-			elements.push_back(current->value);
-			current = current->next;
+		elements.reserve(cnt);
+		for (const T& value : *this) {
+			elements.push_back(value);
 		}
 		return elements;
 	}
 
 	// ֧
-	class iterator {
+	// The elements are the keys of the index, so they are not modifiable through an iterator.
+	class const_iterator {
 	private:
-		Node* current;
+		const std::vector<Node>* nodes;
+		int current;
 	public:
-		iterator(Node* node) : current(node) {}
+		const_iterator(const std::vector<Node>* nodes, int p) : nodes(nodes), current(p) {}
 
-		T& operator*() { return current->value; }
-		iterator& operator++() { current = current->next; return *this; }
-		bool operator!=(const iterator& other) { return current != other.current; }
+		const T& operator*() const { return (*nodes)[current].value; }
+		const T* operator->() const { return &(*nodes)[current].value; }
+		const_iterator& operator++() { current = (*nodes)[current].next; return *this; }
+		bool operator==(const const_iterator& other) const { return current == other.current; }
+		bool operator!=(const const_iterator& other) const { return current != other.current; }
 	};
+	using iterator = const_iterator;
 
-	iterator begin() { return iterator(head); }
-	iterator end() { return iterator(nullptr); }
+	const_iterator begin() const { return const_iterator(&nodes, head); }
+	const_iterator end() const { return const_iterator(&nodes, NIL); }
+	const_iterator cbegin() const { return begin(); }
+	const_iterator cend() const { return end(); }
 };
\ No newline at end of file
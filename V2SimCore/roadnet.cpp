@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cstring>
+#include "roadnet.h"
+
+// Whether a space-separated list of vehicle classes names passenger cars
+static bool namesPassenger(const char* list) {
+	string s(list);
+	size_t i = 0;
+	while (i < s.size()) {
+		size_t j = s.find(' ', i);
+		if (j == string::npos) j = s.size();
+		auto c = s.substr(i, j - i);
+		if (c == "passenger" || c == "all") return true;
+		i = j + 1;
+	}
+	return false;
+}
+
+// Whether a lane is open to passenger cars under SUMO's allow/disallow attributes
+static bool laneAllowsPassenger(const tinyxml2::XMLElement* lane) {
+	const char* allow = lane->Attribute("allow");
+	if (allow) return namesPassenger(allow);
+	const char* disallow = lane->Attribute("disallow");
+	return !disallow || !namesPassenger(disallow);
+}
+
+RoadNet::RoadNet(const string& filename): fname(filename) {
+	tinyxml2::XMLDocument doc;
+	if (doc.LoadFile(filename.c_str()) != tinyxml2::XML_SUCCESS) {
+		throw V2SimError(std::format("Fail to load roadnet {}.", filename));
+	}
+	auto* root = doc.RootElement();
+	if (!root) {
+		throw V2SimError(std::format("Fail to load roadnet {}. Root element not found!", filename));
+	}
+	for (auto* e = root->FirstChildElement("edge"); e; e = e->NextSiblingElement("edge")) {
+		const char* func = e->Attribute("function");
+		if (func && strcmp(func, "normal") != 0) continue;
+		const char* id = e->Attribute("id");
+		if (!id) {
+			throw V2SimError(std::format("Edge ID is not defined on line {} of {}!", e->GetLineNum(), filename));
+		}
+		auto* lane = e->FirstChildElement("lane");
+		if (!lane) {
+			throw V2SimError(std::format("Edge {} has no lane in {}!", id, filename));
+		}
+		int n = 0;
+		bool car = false;
+		for (auto* l = lane; l; l = l->NextSiblingElement("lane")) {
+			bool ok = laneAllowsPassenger(l);
+			lane_car.push_back(ok);
+			car = car || ok;
+			++n;
+		}
+		lane_off.push_back((int)lane_car.size());
+		edge_car.push_back(car);
+		mp[id] = (int)ids.size();
+		ids.emplace_back(id);
+		len.push_back(lane->DoubleAttribute("length", 0.0));
+		spd.push_back(lane->DoubleAttribute("speed", 13.89));
+		lane_cnt.push_back(n);
+		// The shape is "x1,y1 x2,y2 ..."
+		double x = 0, y = 0;
+		const char* shape = lane->Attribute("shape");
+		if (shape) {
+			char* p = nullptr;
+			x = strtod(shape, &p);
+			y = *p == ',' ? strtod(p + 1, nullptr) : 0;
+		}
+		x0.push_back(x);
+		y0.push_back(y);
+	}
+
+	// Lane-level connections are merged into one edge-level link. Like SUMO routing a passenger car,
+	// only the connections between lanes open to passenger cars are kept, so rail, footpaths and bus
+	// lanes are never part of a route.
+	auto carLane = [this](int e, int lane) {
+		if (lane < 0) return (bool)edge_car[e];
+		return lane < lane_cnt[e] && lane_car[lane_off[e] + lane];
+	};
+	vector<pair<int, int>> links;
+	for (auto* c = root->FirstChildElement("connection"); c; c = c->NextSiblingElement("connection")) {
+		const char* from = c->Attribute("from");
+		const char* to = c->Attribute("to");
+		if (!from || !to) continue;
+		int u = IndexOf(from), v = IndexOf(to);
+		if (u < 0 || v < 0) continue;
+		if (!carLane(u, c->IntAttribute("fromLane", -1)) || !carLane(v, c->IntAttribute("toLane", -1))) continue;
+		links.emplace_back(u, v);
+	}
+	sort(links.begin(), links.end());
+	links.erase(unique(links.begin(), links.end()), links.end());
+
+	size_t n = ids.size();
+	out_off.assign(n + 1, 0);
+	in_off.assign(n + 1, 0);
+	for (auto& [u, v] : links) {
+		++out_off[u + 1];
+		++in_off[v + 1];
+	}
+	for (size_t i = 0; i < n; ++i) {
+		out_off[i + 1] += out_off[i];
+		in_off[i + 1] += in_off[i];
+	}
+	out_to.resize(links.size());
+	in_from.resize(links.size());
+	vector<int> out_pos(out_off.begin(), out_off.end() - 1);
+	vector<int> in_pos(in_off.begin(), in_off.end() - 1);
+	for (auto& [u, v] : links) {
+		out_to[out_pos[u]++] = v;
+		in_from[in_pos[v]++] = u;
+	}
+}
+
+uint64_t FileHash(const string& filename) {
+	FILE* fh = nullptr;
+	if (fopen_s(&fh, filename.c_str(), "rb") != 0) {
+		throw V2SimError(std::format("Fail to open {}", filename));
+	}
+	uint64_t h = 14695981039346656037ull;
+	unsigned char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fh)) > 0) {
+		for (size_t i = 0; i < n; ++i) {
+			h = (h ^ buf[i]) * 1099511628211ull;
+		}
+	}
+	fclose(fh);
+	return h;
+}
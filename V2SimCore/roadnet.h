@@ -0,0 +1,57 @@
+#pragma once
+
+#include <span>
+#include "utilbase.h"
+using namespace std;
+
+// Road network loaded from a SUMO .net.xml file. 
+// Normal edges are interned to dense ids 0..n-1 with their geometry in flat arrays, and the connections
+// between them are stored in CSR form in both directions. Internal (junction) edges are skipped.
+// Connections are only kept between lanes open to passenger cars, so an edge without such a lane
+// has no links and is never on a route.
+class RoadNet {
+private:
+	string fname;
+	vector<string> ids;
+	unordered_map<string, int> mp; // Edge ID -> edge index
+	vector<double> len; // Length of the first lane, m
+	vector<double> spd; // Speed limit of the first lane, m/s
+	vector<int> lane_cnt;
+	vector<int> lane_off = { 0 }; // Lanes of edge i are lane_car[lane_off[i], lane_off[i + 1])
+	vector<unsigned char> lane_car; // Whether each lane is open to passenger cars
+	vector<unsigned char> edge_car; // Whether any lane of an edge is open to passenger cars
+	vector<double> x0, y0; // Start of the shape of the first lane
+	vector<int> out_off, out_to; // Successors of edge i are out_to[out_off[i], out_off[i + 1])
+	vector<int> in_off, in_from; // Predecessors of edge i are in_from[in_off[i], in_off[i + 1])
+	RoadNet(RoadNet&) = delete;
+	RoadNet& operator=(RoadNet&) = delete;
+public:
+	RoadNet(const string& filename);
+
+	const string& FileName() const { return fname; }
+	size_t size() const { return ids.size(); }
+
+	// Index of an edge, or -1 if it is not a normal edge of the network
+	int IndexOf(const string& edge) const {
+		auto it = mp.find(edge);
+		return it == mp.end() ? -1 : it->second;
+	}
+	const string& EdgeID(int e) const { return ids.at(e); }
+	double Length(int e) const { return len[e]; }
+	double Speed(int e) const { return spd[e]; }
+	int LaneCount(int e) const { return lane_cnt[e]; }
+	// Whether a passenger car may drive on any lane of an edge
+	bool AllowsPassenger(int e) const { return edge_car[e]; }
+	double X(int e) const { return x0[e]; }
+	double Y(int e) const { return y0[e]; }
+
+	span<const int> Successors(int e) const {
+		return span<const int>(out_to.data() + out_off[e], out_to.data() + out_off[e + 1]);
+	}
+	span<const int> Predecessors(int e) const {
+		return span<const int>(in_from.data() + in_off[e], in_from.data() + in_off[e + 1]);
+	}
+};
+
+// 64-bit FNV-1a hash of a file's content, used to tell whether a cache is stale
+uint64_t FileHash(const string& filename);
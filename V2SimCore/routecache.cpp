@@ -0,0 +1,68 @@
+#include "routecache.h"
+
+RouteCache::Entry* RouteCache::find(const string& from, const string& to, int bucket) {
+	auto it = mp.find(KeyView(from, to, bucket));
+	if (it == mp.end()) {
+		return nullptr;
+	}
+	lru.splice(lru.begin(), lru, it->second);
+	return &*it->second;
+}
+
+RouteCache::Entry& RouteCache::put(const string& from, const string& to, int bucket) {
+	Entry* e = find(from, to, bucket);
+	if (e) {
+		return *e;
+	}
+	if (mp.size() >= cap) {
+		mp.erase(lru.back().key);
+		lru.pop_back();
+	}
+	lru.push_front(Entry{ Key{ from, to, bucket }, {}, {} });
+	mp.emplace(lru.front().key, lru.begin());
+	return lru.front();
+}
+
+void RouteCache::SetCapacity(size_t capacity) {
+	cap = capacity;
+	while (mp.size() > cap) {
+		mp.erase(lru.back().key);
+		lru.pop_back();
+	}
+}
+
+const RouteCost* RouteCache::FindCost(const string& from, const string& to, int bucket) {
+	Entry* e = cap > 0 ? find(from, to, bucket) : nullptr;
+	if (e) {
+		++hits;
+		return &e->cost;
+	}
+	++misses;
+	return nullptr;
+}
+
+const vector<string>* RouteCache::FindRoute(const string& from, const string& to, int bucket) {
+	Entry* e = cap > 0 ? find(from, to, bucket) : nullptr;
+	if (e && !e->edges.empty()) {
+		++hits;
+		return &e->edges;
+	}
+	++misses;
+	return nullptr;
+}
+
+void RouteCache::PutCost(const string& from, const string& to, int bucket, const RouteCost& cost) {
+	if (cap == 0) return;
+	put(from, to, bucket).cost = cost;
+}
+
+const vector<string>& RouteCache::PutRoute(const string& from, const string& to, int bucket, const RouteCost& cost, vector<string>&& edges) {
+	if (cap == 0) {
+		uncached = std::move(edges);
+		return uncached;
+	}
+	Entry& e = put(from, to, bucket);
+	e.cost = cost;
+	e.edges = std::move(edges);
+	return e.edges;
+}
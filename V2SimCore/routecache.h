@@ -0,0 +1,70 @@
+#pragma once
+
+#include <list>
+#include <string_view>
+#include "router.h"
+
+// Bounded LRU cache of routes keyed by (from edge, to edge, time bucket).
+// An entry holds the cost of the route and, once a vehicle has been sent along it, its edges.
+// Entries of other time buckets are never returned; they age out of the cache.
+class RouteCache {
+private:
+	struct Key {
+		string from, to;
+		int bucket;
+	};
+	struct KeyView {
+		string_view from, to;
+		int bucket;
+		KeyView(string_view from, string_view to, int bucket) : from(from), to(to), bucket(bucket) {}
+		KeyView(const Key& k) : from(k.from), to(k.to), bucket(k.bucket) {}
+	};
+	struct KeyHash {
+		using is_transparent = void;
+		size_t operator()(const KeyView& k) const {
+			size_t h = hash<string_view>()(k.from);
+			h ^= hash<string_view>()(k.to) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+			return h ^ ((size_t)k.bucket * 0x9e3779b97f4a7c15ull);
+		}
+	};
+	struct KeyEq {
+		using is_transparent = void;
+		bool operator()(const KeyView& a, const KeyView& b) const {
+			return a.bucket == b.bucket && a.from == b.from && a.to == b.to;
+		}
+	};
+	struct Entry {
+		Key key;
+		RouteCost cost;
+		vector<string> edges; // Empty if only the cost is known
+	};
+	list<Entry> lru; // Most recently used first
+	unordered_map<Key, list<Entry>::iterator, KeyHash, KeyEq> mp;
+	size_t cap;
+	size_t hits = 0, misses = 0;
+	vector<string> uncached; // Route returned by PutRoute when the cache is disabled
+
+	Entry* find(const string& from, const string& to, int bucket);
+	Entry& put(const string& from, const string& to, int bucket);
+public:
+	RouteCache(size_t capacity = 65536) : cap(capacity) {}
+
+	size_t size() const { return mp.size(); }
+	size_t Capacity() const { return cap; }
+	// Set the maximum number of entries, evicting the least recently used ones. 0 disables the cache.
+	void SetCapacity(size_t capacity);
+	void Clear() { lru.clear(); mp.clear(); }
+
+	size_t Hits() const { return hits; }
+	size_t Misses() const { return misses; }
+	void ResetStats() { hits = misses = 0; }
+
+	// Cached cost of the route, or nullptr
+	const RouteCost* FindCost(const string& from, const string& to, int bucket);
+	// Cached edges of the route, or nullptr if they are not known
+	const vector<string>* FindRoute(const string& from, const string& to, int bucket);
+
+	void PutCost(const string& from, const string& to, int bucket, const RouteCost& cost);
+	// Cache the edges of a route and return the cached copy
+	const vector<string>& PutRoute(const string& from, const string& to, int bucket, const RouteCost& cost, vector<string>&& edges);
+};
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include "router.h"
+
+Router::Router(const RoadNet& net): net(net) {
+	size_t n = net.size();
+	cost.resize(n);
+	dist.resize(n);
+	seen.assign(n, 0);
+	done.assign(n, 0);
+	wanted.assign(n, 0);
+	ResetTravelTimes();
+}
+
+void Router::SetTravelTimes(span<const double> t) {
+	if (t.size() != tt.size()) {
+		throw V2SimError(std::format("Travel time vector has {} items, but the roadnet has {} edges.", t.size(), tt.size()));
+	}
+	tt.assign(t.begin(), t.end());
+}
+
+void Router::ResetTravelTimes() {
+	size_t n = net.size();
+	tt.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		double v = net.Speed((int)i);
+		tt[i] = v > 0 ? net.Length((int)i) / v : numeric_limits<double>::infinity();
+	}
+}
+
+void Router::newSearch() {
+	// Stamps mark the valid entries, so nothing is cleared between searches
+	if (++stamp == 0) {
+		fill(seen.begin(), seen.end(), 0);
+		fill(done.begin(), done.end(), 0);
+		fill(wanted.begin(), wanted.end(), 0);
+		stamp = 1;
+	}
+	heap.clear();
+}
+
+void Router::OneToMany(int from, span<const int> targets, span<RouteCost> out) {
+	if (from < 0 || from >= (int)net.size()) {
+		throw V2SimError(std::format("Invalid origin edge index {}.", from));
+	}
+	if (out.size() < targets.size()) {
+		throw V2SimError(std::format("Output buffer too small: {} < {}", out.size(), targets.size()));
+	}
+	newSearch();
+	size_t remaining = 0;
+	for (int t : targets) {
+		if (t >= 0 && wanted[t] != stamp) {
+			wanted[t] = stamp;
+			++remaining;
+		}
+	}
+
+	cost[from] = tt[from];
+	dist[from] = net.Length(from);
+	seen[from] = stamp;
+	heap.emplace_back(-cost[from], from); // Max-heap on negated cost
+	while (!heap.empty() && remaining > 0) {
+		pop_heap(heap.begin(), heap.end());
+		auto [c, u] = heap.back();
+		heap.pop_back();
+		if (done[u] == stamp || -c > cost[u]) continue;
+		done[u] = stamp;
+		if (wanted[u] == stamp) --remaining;
+		for (int v : net.Successors(u)) {
+			double nc = cost[u] + tt[v];
+			if (seen[v] != stamp || nc < cost[v]) {
+				seen[v] = stamp;
+				cost[v] = nc;
+				dist[v] = dist[u] + net.Length(v);
+				heap.emplace_back(-nc, v);
+				push_heap(heap.begin(), heap.end());
+			}
+		}
+	}
+
+	constexpr double inf = numeric_limits<double>::infinity();
+	size_t n = targets.size();
+	for (size_t i = 0; i < n; ++i) {
+		int t = targets[i];
+		if (t >= 0 && done[t] == stamp) {
+			out[i] = { dist[t], cost[t] };
+		}
+		else {
+			out[i] = { inf, inf };
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "roadnet.h"
+
+// Length and travel time of the fastest route to a target
+struct RouteCost {
+	double length; // m, infinity if unreachable
+	double travelTime; // s, infinity if unreachable
+};
+
+// In-process router over a RoadNet. It minimizes travel time like SUMO's routing, and one 
+// search from the origin edge settles all the target edges at once. Like libsumo's findRoute,
+// the cost of a route includes both its first and its last edge.
+// The scratch space is reused across searches, so a Router must not be shared between threads.
+class Router {
+private:
+	const RoadNet& net;
+	vector<double> tt; // Travel time of each edge, s
+	vector<double> cost; // Travel time from the origin
+	vector<double> dist; // Length of the route found to each edge
+	vector<unsigned> seen; // Edge reached in the search with this stamp
+	vector<unsigned> done; // Edge settled in the search with this stamp
+	vector<unsigned> wanted; // Edge is a target of the search with this stamp
+	vector<pair<double, int>> heap;
+	unsigned stamp = 0;
+	Router(Router&) = delete;
+	Router& operator=(Router&) = delete;
+	void newSearch();
+public:
+	// The travel time of each edge is initialized to its length divided by its speed limit
+	Router(const RoadNet& net);
+
+	const RoadNet& Net() const { return net; }
+	double TravelTime(int e) const { return tt[e]; }
+	void SetTravelTime(int e, double t) { tt[e] = t; }
+	span<const double> TravelTimes() const { return tt; }
+	// Replace the travel times of all the edges, such as SUMO's aggregated edge weights
+	void SetTravelTimes(span<const double> t);
+	// Restore free-flow travel times
+	void ResetTravelTimes();
+
+	// Fastest routes from edge `from` to every edge in targets. out[i] receives the cost of targets[i].
+	// The search stops as soon as all the targets are settled.
+	void OneToMany(int from, span<const int> targets, span<RouteCost> out);
+};
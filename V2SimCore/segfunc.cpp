@@ -1,3 +1,4 @@
+#include <atomic>
 #include "segfunc.h"
 
 void SegFunc::check() {
@@ -65,6 +66,106 @@ double SegFunc::Get(int time) const {
 	return d[distance(tl.begin(), upper_bound(tl.begin(), tl.end(), time)) - 1];
 }
 
+uint64_t SegFunc::newVersion() {
+	static atomic<uint64_t> next{ 1 };
+	return next.fetch_add(1, memory_order_relaxed);
+}
+
+size_t SegFunc::ScheduleHash() const {
+	size_t h = hash<int>()(loop_period) * 31 + hash<int>()(loop_times);
+	for (size_t i = 0; i < tl.size(); ++i) {
+		h = (h * 1000003) ^ hash<int>()(tl[i]);
+		h = (h * 1000003) ^ hash<double>()(d[i]);
+	}
+	return h;
+}
+
+void SegFuncTable::release(size_t i) {
+	int k = owner[i];
+	owner[i] = -1;
+	if (k < 0 || --refs[k] > 0) {
+		return;
+	}
+	auto [b, e] = byhash.equal_range(hashes[k]);
+	for (auto it = b; it != e; ++it) {
+		if (it->second == k) {
+			byhash.erase(it);
+			break;
+		}
+	}
+	funcs[k] = SegFunc();
+	unused.push_back(k);
+}
+
+void SegFuncTable::Set(size_t i, const SegFunc& f) {
+	if (i >= owner.size()) {
+		owner.resize(i + 1, -1);
+		owner_ver.resize(i + 1, 0);
+	}
+	if (owner[i] >= 0 && owner_ver[i] == f.Version()) {
+		return;
+	}
+	owner_ver[i] = f.Version();
+	size_t h = f.ScheduleHash();
+	auto [b, e] = byhash.equal_range(h);
+	for (auto it = b; it != e; ++it) {
+		if (funcs[it->second].SameSchedule(f)) {
+			int k = it->second;
+			if (owner[i] != k) {
+				++refs[k];
+				release(i);
+				owner[i] = k;
+			}
+			return;
+		}
+	}
+	// Release first, so that the slot of an edited schedule with no other owner is reused
+	release(i);
+	int k;
+	if (!unused.empty()) {
+		k = unused.back();
+		unused.pop_back();
+		curs[k] = SegFunc::Cursor();
+	}
+	else {
+		k = (int)funcs.size();
+		funcs.emplace_back();
+		curs.emplace_back();
+		vals.push_back(0.0);
+		refs.push_back(0);
+		hashes.push_back(0);
+	}
+	funcs[k] = f;
+	funcs[k].ClearOverride();
+	hashes[k] = h;
+	refs[k] = 1;
+	byhash.emplace(h, k);
+	owner[i] = k;
+}
+
+int SegFunc::NextChange(int time) const {
+	constexpr int never = numeric_limits<int>::max();
+	if (overrided || tl.empty()) {
+		return never;
+	}
+	if (loop_period <= 0) {
+		auto it = upper_bound(tl.begin(), tl.end(), time);
+		return it == tl.end() ? never : *it;
+	}
+	// Get() wraps the time into the period and returns 0 after the last loop
+	long long last = (long long)loop_period * loop_times;
+	if (loop_times > 0 && time > last) {
+		return never;
+	}
+	long long base = time - time % loop_period;
+	auto it = upper_bound(tl.begin(), tl.end(), time % loop_period);
+	long long t = base + (it == tl.end() ? loop_period : *it);
+	if (loop_times > 0 && t > last) {
+		t = last + 1;
+	}
+	return t >= never ? never : (int)t;
+}
+
 SegFunc QuickSum(const vector<SegFunc>& funcs) {
 	if (funcs.empty()) {
 		return SegFunc();
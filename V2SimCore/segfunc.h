@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include "utilbase.h"
 using namespace std;
 
@@ -11,8 +12,33 @@ private:
 	int loop_times; // Times for the loop. Should be positive or -1 (infinite).
 	bool overrided = false;
 	double overrided_val = 0.0;
+	uint64_t ver = newVersion(); // Changes whenever the schedule does, kept by copies
 	void check();
+	static uint64_t newVersion();
 public:
+	// Reads a SegFunc at times that mostly move forward. The value is kept for the interval up to the
+	// next change, so a read within it is O(1) and the search only runs when a breakpoint is passed.
+	// Any time can be read, and a changed schedule or an override is noticed at the next read.
+	class Cursor {
+	private:
+		uint64_t ver = 0;
+		int lo = 1, hi = 0; // The value holds on [lo, hi), empty at first
+		double v = 0.0;
+	public:
+		double operator()(const SegFunc& f, int t) {
+			if (f.overrided) {
+				return f.overrided_val;
+			}
+			if (f.ver != ver || t < lo || t >= hi) {
+				ver = f.ver;
+				lo = t;
+				hi = f.NextChange(t);
+				v = f.Get(t);
+			}
+			return v;
+		}
+	};
+
 	size_t size() const { return tl.size(); }
 	SegFunc() : loop_period(0), loop_times(1) { }
 	SegFunc(tinyxml2::XMLElement* e, bool allow_null = true, 
@@ -33,15 +59,25 @@ public:
 		}
 		check();
 	}
+	uint64_t Version() const { return ver; }
+	bool Overridden() const { return overrided; }
+	// Whether the schedules are the same, regardless of overrides
+	bool SameSchedule(const SegFunc& o) const {
+		return loop_period == o.loop_period && loop_times == o.loop_times && tl == o.tl && d == o.d;
+	}
+	size_t ScheduleHash() const;
 	int GetPeriod() const { return loop_period; }
 	int GetRepeatTimes() const { return loop_times; }
 	double Get(int time) const;
+	// The first time after the given time at which the value may change, or INT_MAX if never
+	int NextChange(int time) const;
 	void Add(int time, double data) {
 		if (time <= tl.back()) {
 			throw V2SimError(std::format("New time ({}) must be greater than the last time ({}) in the SegFunc.", time, tl.back()));
 		}
 		tl.push_back(time);
 		d.push_back(data);
+		ver = newVersion();
 	}
 	double operator()(int time) const {
 		return overrided ? overrided_val : Get(time);
@@ -95,6 +131,7 @@ public:
 		}
 		loop_times = 1;
 		loop_period = 0;
+		ver = newVersion();
 	}
 	int TimeLine(size_t i) const {
 		return tl.at(i);
@@ -104,4 +141,35 @@ public:
 	}
 };
 
-SegFunc QuickSum(const vector<SegFunc>& funcs);
\ No newline at end of file
+SegFunc QuickSum(const vector<SegFunc>& funcs);
+
+// Price schedules of many owners, such as the CS of a map, evaluated once per step. Owners with the same
+// schedule share one entry, and each entry is read through a cursor, so a step costs O(1) per distinct
+// schedule. Owner i is bound by Set(i, f) before Eval, which only looks f up again after it changes.
+class SegFuncTable {
+private:
+	vector<SegFunc> funcs; // Distinct schedules, without overrides. Slots without owners are empty.
+	vector<SegFunc::Cursor> curs;
+	vector<double> vals; // Values at the last Eval
+	vector<int> refs; // Number of owners of each slot
+	vector<size_t> hashes; // ScheduleHash of each slot
+	vector<int> unused; // Slots without owners, reused first
+	unordered_multimap<size_t, int> byhash;
+	vector<int> owner; // Entry of each owner
+	vector<uint64_t> owner_ver; // Version of the schedule each owner was bound with
+	// Drop owner i from its slot, which is freed if it was the last one
+	void release(size_t i);
+public:
+	size_t Distinct() const { return funcs.size() - unused.size(); }
+	void Set(size_t i, const SegFunc& f);
+	// Evaluate every distinct schedule at time t
+	void Eval(int t) {
+		for (size_t k = 0; k < funcs.size(); ++k) {
+			if (refs[k] > 0) {
+				vals[k] = curs[k](funcs[k], t);
+			}
+		}
+	}
+	// Value of the schedule of owner i at the last Eval, not counting its override
+	double operator[](size_t i) const { return vals[owner[i]]; }
+};
\ No newline at end of file
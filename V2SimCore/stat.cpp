@@ -22,9 +22,7 @@ void StatItem::load() {
     fprintf(fh, "Time,Item,Value\n");
 }
 
-void StatItem::recordItems(const V2SimCore& vc) {
-    vector<double> this_items = getItems(vc);
-    int t = vc.getTime();
+void StatItem::writeItems(int t, const vector<double>& this_items) {
     if (this_items.size() != _n) {
         throw runtime_error(format("Bad item length: get {}, but should be {}", this_items.size(), _n));
     }
@@ -95,10 +93,10 @@ vector<double> StatEV::getItems(const V2SimCore& vc) {
     int t = vc.getTime();
     for (auto& v : vc.EVs()) {
         ret.emplace_back(v.SoC());
-        ret.emplace_back((double)((int)v.Status));
-        ret.emplace_back(v.Cost);
+        ret.emplace_back((double)((int)v.Status()));
+        ret.emplace_back(v.Cost());
         ret.emplace_back(v.Revenue);
-        if (v.Status == VehStatus::Driving) {
+        if (v.Status() == VehStatus::Driving) {
             auto pos = libsumo::Vehicle::getPosition(v.ID);
             ret.emplace_back(pos.x);
             ret.emplace_back(pos.y);
@@ -26,8 +26,18 @@ public:
         load();
     }
     virtual vector<double> getItems(const V2SimCore& vc) = 0;
+    // Whether the items depend on the SCS or the EVs in them, which are updated in the background while pipelining
+    virtual bool ReadsSCS() const { return false; }
+    // Whether getItems may run in the background. It must not call libsumo or read the FCS then.
+    virtual bool ReadsInBackground() const { return false; }
+    // Whether the items read the batteries of the EVs, which the CS only write back lazily
+    virtual bool ReadsEVs() const { return false; }
 
-    void recordItems(const V2SimCore& vc);
+    void recordItems(const V2SimCore& vc) {
+        writeItems(vc.getTime(), getItems(vc));
+    }
+    // Write the items of time t that changed since the last record
+    void writeItems(int t, const vector<double>& this_items);
 
     void close() {
         if (fh) {
@@ -53,6 +63,8 @@ class StatSCS : public StatItem {
 public:
     StatSCS(const string& filename, const vector<string>& csnames, bool _compress);
     vector<double> getItems(const V2SimCore& vc) override;
+    bool ReadsSCS() const override { return true; }
+    bool ReadsInBackground() const override { return true; }
 };
 
 
@@ -60,4 +72,6 @@ class StatEV : public StatItem {
 public:
     StatEV(const string& filename, const vector<string>& evnames, bool _compress);
     vector<double> getItems(const V2SimCore& vc) override;
+    bool ReadsSCS() const override { return true; }
+    bool ReadsEVs() const override { return true; }
 };
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include <functional>
+#include <bit>
+#include "symbols.h"
+
+deque<string> Symbols::names;
+vector<Symbols::Slot> Symbols::slots;
+int Symbols::shift = 64;
+
+// Fibonacci hashing spreads the hash over the high bits used as the slot index
+static uint64_t hashOf(string_view s) {
+	return hash<string_view>{}(s) * 0x9E3779B97F4A7C15ull;
+}
+
+size_t Symbols::probe(string_view s, uint64_t h) {
+	size_t mask = slots.size() - 1;
+	uint32_t tag = (uint32_t)h;
+	for (size_t i = (size_t)(h >> shift);; i = (i + 1) & mask) {
+		const Slot& e = slots[i];
+		if (e.sym == NO_SYM || (e.tag == tag && names[e.sym] == s)) {
+			return i;
+		}
+	}
+}
+
+void Symbols::grow() {
+	size_t n = slots.empty() ? 1024 : slots.size() * 2;
+	slots.assign(n, Slot{ 0, NO_SYM });
+	shift = 64 - countr_zero(n);
+	for (Sym k = 0; k < (Sym)names.size(); ++k) {
+		uint64_t h = hashOf(names[k]);
+		slots[probe(names[k], h)] = Slot{ (uint32_t)h, k };
+	}
+}
+
+Sym Symbols::Find(string_view s) {
+	if (slots.empty()) {
+		return NO_SYM;
+	}
+	return slots[probe(s, hashOf(s))].sym;
+}
+
+Sym Symbols::Intern(string_view s) {
+	if ((names.size() + 1) * 2 > slots.size()) {
+		grow();
+	}
+	uint64_t h = hashOf(s);
+	Slot& e = slots[probe(s, h)];
+	if (e.sym == NO_SYM) {
+		e = Slot{ (uint32_t)h, (Sym)names.size() };
+		names.emplace_back(s);
+	}
+	return e.sym;
+}
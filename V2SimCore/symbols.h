@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <limits>
+#include <cstdint>
+using namespace std;
+
+// Handle of an interned id, its index in the symbol table
+using Sym = uint32_t;
+constexpr Sym NO_SYM = numeric_limits<Sym>::max();
+
+// Process-wide table interning the ids of vehicles, edges, TAZs and stations to 32-bit handles,
+// so that each distinct id is stored once and is compared and hashed as an integer. 
+// Ids are interned while loading, from one thread at a time. Names can be read from any thread.
+class Symbols {
+private:
+	struct Slot {
+		uint32_t tag; // Low bits of the hash, compared before the names
+		Sym sym; // NO_SYM if the slot is empty
+	};
+	static deque<string> names; // Stable, so that a name is never moved
+	static vector<Slot> slots; // Open addressing with linear probing, at most half full
+	static int shift; // 64 - log2(slots.size())
+
+	// Slot holding s, or the empty slot where it would go
+	static size_t probe(string_view s, uint64_t h);
+	static void grow();
+public:
+	// Handle of an id, adding it to the table if it is new
+	static Sym Intern(string_view s);
+	// Handle of an id, or NO_SYM if it has never been interned
+	static Sym Find(string_view s);
+	// Id of a handle
+	static const string& Name(Sym s) { return names[s]; }
+	static size_t size() { return names.size(); }
+};
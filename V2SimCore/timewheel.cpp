@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <bit>
+#include "timewheel.h"
+
+void TimingWheel::place(const Entry& e) {
+	if (e.time < now) {
+		late.push_back(e);
+		return;
+	}
+	auto x = (unsigned long long)(e.time ^ now);
+	int level = x == 0 ? 0 : (bit_width(x) - 1) / BITS;
+	slots[level][(e.time >> (BITS * level)) & MASK].push_back(e);
+	++cnt[level];
+}
+
+void TimingWheel::cascade() {
+	for (int level = 1; level < LEVELS; ++level) {
+		int idx = (int)((now >> (BITS * level)) & MASK);
+		auto moved = std::move(slots[level][idx]);
+		slots[level][idx].clear();
+		cnt[level] -= moved.size();
+		for (auto& e : moved) {
+			if (isLive(e)) {
+				place(e);
+			}
+		}
+		if (idx != 0) {
+			break;
+		}
+	}
+}
+
+int TimingWheel::slotMin(const vector<Entry>& s) const {
+	int t = numeric_limits<int>::max();
+	for (auto& e : s) {
+		if (isLive(e)) {
+			t = min(t, e.time);
+		}
+	}
+	return t;
+}
+
+void TimingWheel::Reset(int t) {
+	for (auto& level : slots) {
+		for (auto& s : level) {
+			s.clear();
+		}
+	}
+	fill(begin(cnt), end(cnt), 0);
+	late.clear();
+	now = max(t, 0);
+	fill(when.begin(), when.end(), NONE);
+	// Stamps keep increasing, so no entry of an earlier round is taken as live
+	for (auto& s : stamp) {
+		++s;
+	}
+	live = 0;
+}
+
+void TimingWheel::Assign(int t, const vector<pair<int, int>>& items) {
+	Reset(t);
+	int max_id = -1;
+	for (auto& [time, id] : items) {
+		max_id = max(max_id, id);
+	}
+	if (max_id >= (int)when.size()) {
+		when.resize(max_id + 1, NONE);
+		stamp.resize(max_id + 1, 0);
+	}
+	for (auto& [time, id] : items) {
+		Push(time, id);
+	}
+}
+
+void TimingWheel::Push(int t, int id) {
+	if (id >= (int)when.size()) {
+		when.resize(id + 1, NONE);
+		stamp.resize(id + 1, 0);
+	}
+	if (when[id] == NONE) {
+		++live;
+	}
+	when[id] = t;
+	place(Entry{ t, id, ++stamp[id] });
+}
+
+bool TimingWheel::Cancel(int id) {
+	if (!contains(id)) {
+		return false;
+	}
+	when[id] = NONE;
+	++stamp[id];
+	--live;
+	return true;
+}
+
+size_t TimingWheel::PopDue(int t, vector<pair<int, int>>& out) {
+	size_t n0 = out.size();
+	auto take = [&](const vector<Entry>& s) {
+		size_t k = out.size();
+		for (auto& e : s) {
+			if (isLive(e) && e.time <= t) {
+				out.emplace_back(e.time, e.id);
+			}
+		}
+		sort(out.begin() + k, out.end());
+		for (size_t i = k; i < out.size(); ++i) {
+			int id = out[i].second;
+			when[id] = NONE;
+			++stamp[id];
+		}
+		live -= out.size() - k;
+	};
+	if (!late.empty()) {
+		take(late);
+		// Entries of late not due yet are only possible if t < now - 1
+		if (out.size() - n0 < late.size()) {
+			erase_if(late, [this](const Entry& e) { return !isLive(e); });
+		}
+		else {
+			late.clear();
+		}
+	}
+	while (now <= t) {
+		if (cnt[0] == 0) {
+			// Jump over the empty lower levels to the next slot of the lowest occupied one
+			int level = 1;
+			while (level < LEVELS && cnt[level] == 0) {
+				++level;
+			}
+			if (level == LEVELS) {
+				now = (long long)t + 1;
+				break;
+			}
+			long long span = 1ll << (BITS * level);
+			long long next = (now / span + 1) * span;
+			if (next > (long long)t + 1) {
+				now = (long long)t + 1;
+				break;
+			}
+			now = next;
+			cascade();
+			continue;
+		}
+		auto& s = slots[0][now & MASK];
+		if (!s.empty()) {
+			cnt[0] -= s.size();
+			take(s);
+			s.clear();
+		}
+		++now;
+		if ((now & MASK) == 0) {
+			cascade();
+		}
+	}
+	return out.size() - n0;
+}
+
+int TimingWheel::NextTime() const {
+	if (live == 0) {
+		return numeric_limits<int>::max();
+	}
+	int t = slotMin(late);
+	if (t != numeric_limits<int>::max()) {
+		return t;
+	}
+	// Slots of a level before the digit of now are empty, and all the entries of a level are
+	// earlier than those of the levels above
+	for (int level = 0; level < LEVELS; ++level) {
+		if (cnt[level] == 0) {
+			continue;
+		}
+		int from = (int)((now >> (BITS * level)) & MASK);
+		for (int i = from; i < SLOTS; ++i) {
+			t = slotMin(slots[level][i]);
+			if (t != numeric_limits<int>::max()) {
+				return t;
+			}
+		}
+	}
+	return numeric_limits<int>::max();
+}
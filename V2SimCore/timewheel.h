@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <limits>
+using namespace std;
+
+// Hierarchical timing wheel of (time, id) entries keyed by simulation second, with at most one
+// entry per id. Level L has 256 slots of 256^L seconds, indexed by the L-th byte of the time,
+// and holds the entries whose times first differ from now in that byte. A slot is moved down a
+// level when now reaches it, so each entry is moved at most 3 times and popping the due entries
+// costs O(1) amortized. Cancelled and rescheduled entries stay in their slots and are skipped.
+class TimingWheel {
+private:
+	static constexpr int BITS = 8;
+	static constexpr int SLOTS = 1 << BITS;
+	static constexpr int MASK = SLOTS - 1;
+	static constexpr int LEVELS = 4; // Covers all non-negative int times
+	static constexpr int NONE = numeric_limits<int>::min();
+
+	struct Entry {
+		int time, id;
+		unsigned stamp; // Stale if it differs from the stamp of the id
+	};
+	vector<Entry> slots[LEVELS][SLOTS];
+	size_t cnt[LEVELS] = {}; // Entries at each level, including stale ones
+	vector<Entry> late; // Entries pushed before now
+	long long now = 0; // Earliest time not popped yet
+	vector<int> when; // Time of the entry of each id, or NONE
+	vector<unsigned> stamp;
+	size_t live = 0;
+
+	bool isLive(const Entry& e) const {
+		return stamp[e.id] == e.stamp;
+	}
+	void place(const Entry& e);
+	// Move the slots now has just reached down to the lower levels
+	void cascade();
+	// Earliest live time in a slot, or INT_MAX
+	int slotMin(const vector<Entry>& s) const;
+public:
+	TimingWheel() {}
+
+	size_t size() const { return live; }
+	bool empty() const { return live == 0; }
+	bool contains(int id) const {
+		return id >= 0 && id < (int)when.size() && when[id] != NONE;
+	}
+	// Time of the entry of an id, which must be contained
+	int When(int id) const { return when[id]; }
+
+	// Remove all the entries and start from time t
+	void Reset(int t);
+	// Remove all the entries, start from time t and insert the (time, id) pairs at once
+	void Assign(int t, const vector<pair<int, int>>& items);
+	// Schedule id at time t, replacing its entry if any. An entry earlier than now is due at once.
+	void Push(int t, int id);
+	// Remove the entry of an id. Return false if it has none.
+	bool Cancel(int id);
+	// Append the entries due by time t to out in order of time, then id, and remove them.
+	// Return the number of entries popped.
+	size_t PopDue(int t, vector<pair<int, int>>& out);
+	// Earliest time of all the entries, or INT_MAX if there is none
+	int NextTime() const;
+};
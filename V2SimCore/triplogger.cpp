@@ -23,7 +23,7 @@ void TripsLogger::depart(int simT, const EV& veh, int delay, const std::optional
 void TripsLogger::depart_delay(int simT, const EV& veh, double batt_req, int delay)
 {
     fprintf_s(fh, "%d|DD|%s|%lf|%lf|%d\n",
-		simT, veh.brief().c_str(), veh.BattElec, batt_req, delay);
+		simT, veh.brief().c_str(), veh.BattElec(), batt_req, delay);
 }
 
 void TripsLogger::depart_FCS(int simT, const EV& veh, const std::string& cs)
@@ -33,7 +33,7 @@ void TripsLogger::depart_FCS(int simT, const EV& veh, const std::string& cs)
 
 void TripsLogger::depart_failed(int simT, const EV& veh, double batt_req, const std::string& cs, int trT) {
     fprintf_s(fh, "%d|DF|%s|%lf|%lf|%s|%d\n",
-		simT, veh.brief().c_str(), veh.BattElec, batt_req, cs.c_str(), trT);
+		simT, veh.brief().c_str(), veh.BattElec(), batt_req, cs.c_str(), trT);
 }
 
 void TripsLogger::fault_deplete(int simT, const EV& veh, const std::string& cs, int trT) {
@@ -42,15 +42,15 @@ void TripsLogger::fault_deplete(int simT, const EV& veh, const std::string& cs,
 
 void TripsLogger::fault_nocharge(int simT, const EV& veh, const std::string& cs) {
     fprintf_s(fh, "%d|FN|%s|%lf|%s\n",
-		simT, veh.brief().c_str(), veh.BattElec, cs.c_str());
+		simT, veh.brief().c_str(), veh.BattElec(), cs.c_str());
 }
 
 void TripsLogger::fault_redirect(int simT, const EV& veh, const std::string& cs_old, const std::string& cs_new) {
-	fprintf_s(fh, "%d|FR|%s|%lf|%s|%s\n", simT, veh.brief().c_str(), veh.BattElec, cs_old.c_str(), cs_new.c_str());
+	fprintf_s(fh, "%d|FR|%s|%lf|%s|%s\n", simT, veh.brief().c_str(), veh.BattElec(), cs_old.c_str(), cs_new.c_str());
 }
 
 void TripsLogger::warn_smallcap(int simT, const EV& veh, double batt_req) {
-    fprintf_s(fh, "%d|WC|%s|%lf|%lf\n", simT, veh.brief().c_str(), veh.BattElec, batt_req);
+    fprintf_s(fh, "%d|WC|%s|%lf|%lf\n", simT, veh.brief().c_str(), veh.BattElec(), batt_req);
 }
 
 void TripsLogger::join_SCS(int simT, const EV& veh, const std::string& cs) {
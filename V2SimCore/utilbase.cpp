@@ -1,11 +1,17 @@
+#include <atomic>
 #include "utilbase.h"
 
+void SubscribeVehState(const string& name) {
+	libsumo::Vehicle::subscribe(name, { libsumo::VAR_DISTANCE, libsumo::VAR_ROAD_ID, libsumo::VAR_POSITION });
+}
+
 void AddVehToSUMO(const string& name, const string& from_edge, const string& to_edge) {
 	try {
 		libsumo::Vehicle::add(name, "");
 		libsumo::Vehicle::setRoute(name, { from_edge });
 		libsumo::Vehicle::setRoutingMode(name, libsumo::ROUTING_MODE_AGGREGATED);
 		libsumo::Vehicle::changeTarget(name, to_edge);
+		SubscribeVehState(name);
 	}
 	catch (libsumo::TraCIException e) {
 		cerr << e.what() << endl;
@@ -13,3 +19,105 @@ void AddVehToSUMO(const string& name, const string& from_edge, const string& to_
 	}
 	
 }
+
+void AddVehToSUMO(const string& name, const vector<string>& route) {
+	try {
+		libsumo::Vehicle::add(name, "");
+		libsumo::Vehicle::setRoute(name, route);
+		libsumo::Vehicle::setRoutingMode(name, libsumo::ROUTING_MODE_AGGREGATED);
+		SubscribeVehState(name);
+	}
+	catch (libsumo::TraCIException e) {
+		cerr << e.what() << endl;
+		throw e;
+	}
+}
+
+void ThreadPool::loop() {
+	for (;;) {
+		function<void()> task;
+		{
+			unique_lock<mutex> lock(mtx);
+			cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if (tasks.empty()) {
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::Resize(size_t n) {
+	{
+		lock_guard<mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	for (auto& w : workers) {
+		w.join();
+	}
+	workers.clear();
+	stopping = false;
+	workers.reserve(n);
+	for (size_t i = 0; i < n; ++i) {
+		workers.emplace_back([this] { loop(); });
+	}
+}
+
+void ThreadPool::Post(function<void()> task) {
+	if (workers.empty()) {
+		task();
+		return;
+	}
+	{
+		lock_guard<mutex> lock(mtx);
+		tasks.push_back(std::move(task));
+	}
+	cv.notify_one();
+}
+
+void ThreadPool::RunBlocks(size_t blocks, size_t helpers, const function<void(size_t)>& block) {
+	// Helpers may start after the call returns, so the state they claim from outlives it.
+	// They only touch block while some block is unclaimed, and the call waits for all of them.
+	struct State {
+		atomic<size_t> next = 0;
+		size_t left;
+		mutex mtx;
+		condition_variable cv;
+		vector<exception_ptr> errs;
+		const function<void(size_t)>* block;
+	};
+	auto st = make_shared<State>();
+	st->left = blocks;
+	st->errs.resize(blocks);
+	st->block = &block;
+	auto claim = [st, blocks] {
+		size_t b;
+		while ((b = st->next.fetch_add(1)) < blocks) {
+			try {
+				(*st->block)(b);
+			}
+			catch (...) {
+				st->errs[b] = current_exception();
+			}
+			lock_guard<mutex> lock(st->mtx);
+			if (--st->left == 0) {
+				st->cv.notify_all();
+			}
+		}
+	};
+	helpers = min(helpers, workers.size());
+	for (size_t i = 0; i < helpers; ++i) {
+		Post(claim);
+	}
+	claim();
+	{
+		unique_lock<mutex> lock(st->mtx);
+		st->cv.wait(lock, [&] { return st->left == 0; });
+	}
+	for (auto& e : st->errs) {
+		if (e) rethrow_exception(e);
+	}
+}
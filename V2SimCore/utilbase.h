@@ -9,12 +9,22 @@
 #include <unordered_map>
 #include <cmath>
 #include <limits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
 #include <libsumo/libsumo.h>
 #include "tinyxml2.h"
 #include <iostream>
 using namespace std;
 
+// Subscribe to the distance, road ID and position of a vehicle, read in bulk by V2SimCore::Step
+void SubscribeVehState(const string& name);
 void AddVehToSUMO(const string& name, const string& from_edge, const string& to_edge);
+void AddVehToSUMO(const string& name, const vector<string>& route);
 
 class V2SimError : public exception {
 private:
@@ -34,6 +44,61 @@ public:
 	}
 };
 
+// Persistent worker threads, so that the parallel updates of every step do not create and join
+// threads. Tasks run in the order they are queued.
+class ThreadPool {
+private:
+	vector<thread> workers;
+	deque<function<void()>> tasks;
+	mutex mtx;
+	condition_variable cv;
+	bool stopping = false;
+	void loop();
+	ThreadPool(ThreadPool&) = delete;
+	ThreadPool& operator=(ThreadPool&) = delete;
+public:
+	ThreadPool(size_t n = 0) { Resize(n); }
+	~ThreadPool() { Resize(0); }
+	size_t size() const { return workers.size(); }
+	// Set the number of workers once the queued tasks are done. Must not be called from a task.
+	void Resize(size_t n);
+	// Grow to at least n workers
+	void Reserve(size_t n) {
+		if (n > workers.size()) Resize(n);
+	}
+	// Queue a task, or run it now if there are no workers
+	void Post(function<void()> task);
+	// Run a task on a worker and return its future
+	template <typename F>
+	future<void> Submit(F&& f) {
+		auto task = make_shared<packaged_task<void()>>(std::forward<F>(f));
+		auto ret = task->get_future();
+		Post([task] { (*task)(); });
+		return ret;
+	}
+	// Call block(b) for every b in [0, blocks) on the calling thread and up to helpers workers.
+	// The blocks are claimed by whichever thread is free, so the call never waits for a block no
+	// thread has started, and it may be made from a task. The exception of the first failed
+	// block is rethrown after all the blocks finish.
+	void RunBlocks(size_t blocks, size_t helpers, const function<void(size_t)>& block);
+};
+
+// Call work(begin, end) on contiguous blocks of [0, n) on up to the given number of threads,
+// the calling thread and the workers of pool. The blocks do not depend on the number of workers.
+template <typename F>
+void ParallelFor(ThreadPool& pool, size_t n, int threads, F&& work) {
+	size_t blocks = min<size_t>(max(threads, 1), n);
+	if (blocks <= 1) {
+		work(size_t(0), n);
+		return;
+	}
+	size_t chunk = (n + blocks - 1) / blocks;
+	pool.RunBlocks(blocks, blocks - 1, [&](size_t b) {
+		size_t begin = min(n, b * chunk);
+		work(begin, min(n, begin + chunk));
+	});
+}
+
 class RangeList {
 private:
 	vector<pair<int, int>> d;
@@ -48,6 +113,8 @@ public:
 	RangeList(const vector<pair<int, int>>& d, int period = 0, int times = 1);
 	RangeList(const std::initializer_list<pair<int,int>> d, int period = 0, int times = 1);
 	bool Contains(int time) const;
+	// The first time after the given time at which Contains() may change, or INT_MAX if never
+	int NextChange(int time) const;
 	void SetForce(bool b) { forced = true; forced_value = b; }
 	void ClearForce() { forced = false; }
 	size_t size() const { return d.size(); }
@@ -87,6 +87,41 @@ bool RangeList::Contains(int time) const {
 	return false;
 }
 
+int RangeList::NextChange(int time) const {
+	constexpr int never = numeric_limits<int>::max();
+	if (forced || d.empty()) {
+		return never;
+	}
+	long long base = 0, off = time;
+	long long last = (long long)loop_period * loop_times; // End of the last loop
+	if (loop_period > 0) {
+		if (loop_times > 0 && time > last) {
+			return never;
+		}
+		base = time - time % loop_period;
+		off = time % loop_period;
+	}
+	// Ranges are closed, so membership changes at the start of a range and right after its end
+	long long t = numeric_limits<long long>::max();
+	for (auto& e : d) {
+		if (e.first > off) {
+			t = e.first;
+			break;
+		}
+		if (e.second + 1 > off) {
+			t = e.second + 1;
+			break;
+		}
+	}
+	if (loop_period > 0) {
+		t = min(t, (long long)loop_period) + base;
+		if (loop_times > 0 && t > last) {
+			t = last + 1;
+		}
+	}
+	return t >= never ? never : (int)t;
+}
+
 vector<string> cross_list(const vector<string>& a, const vector<string>& b) {
 	vector<string> ret;
 	for (auto& a0 : a) {
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+using namespace std;
+
+// State of a vehicle at a CS
+enum class CSVehState : uint8_t {
+	None = 0, // Not at any CS of the map
+	Charging = 1, // In a charger
+	Waiting = 2, // Queuing for a charger
+	Idle = 3, // Finished charging but still parked, only at SCS
+};
+
+// Where each vehicle of a CS map is, indexed by vid. Each entry packs the CS index and the state
+// into one int, so a query is a single load. Entries of different vehicles may be written
+// concurrently, but the table only grows from one thread at a time.
+class VehLocTable {
+private:
+	static constexpr int STATE_BITS = 2;
+	static constexpr int STATE_MASK = (1 << STATE_BITS) - 1;
+	vector<int> loc; // (CS index << STATE_BITS) | state, 0 if none
+
+	int at(int vid) const {
+		return (size_t)vid < loc.size() ? loc[vid] : 0;
+	}
+public:
+	size_t size() const { return loc.size(); }
+	// Make room for vids below n, so that later updates never grow the table
+	void Reserve(size_t n) {
+		if (n > loc.size()) {
+			loc.resize(n, 0);
+		}
+	}
+
+	CSVehState State(int vid) const { return (CSVehState)(at(vid) & STATE_MASK); }
+	// CS index of a vehicle, or -1 if it is not at any CS
+	int CS(int vid) const {
+		int v = at(vid);
+		return (v & STATE_MASK) ? v >> STATE_BITS : -1;
+	}
+	void Set(int vid, int cs, CSVehState s) {
+		Reserve((size_t)vid + 1);
+		loc[vid] = (cs << STATE_BITS) | (int)s;
+	}
+	// Remove a vehicle if it is recorded at CS cs
+	void Clear(int vid, int cs) {
+		if ((size_t)vid < loc.size() && (loc[vid] >> STATE_BITS) == cs) {
+			loc[vid] = 0;
+		}
+	}
+	void Clear() {
+		fill(loc.begin(), loc.end(), 0);
+	}
+
+	// Write the CS index (-1 if none) and the state of vids 0..n-1
+	void Export(size_t n, vector<int>& cs, vector<CSVehState>& state) const {
+		cs.resize(n);
+		state.resize(n);
+		for (size_t i = 0; i < n; ++i) {
+			int v = i < loc.size() ? loc[i] : 0;
+			state[i] = (CSVehState)(v & STATE_MASK);
+			cs[i] = (v & STATE_MASK) ? v >> STATE_BITS : -1;
+		}
+	}
+};